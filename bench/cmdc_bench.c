@@ -0,0 +1,181 @@
+#define _GNU_SOURCE
+#include "cmdc.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * @define  BENCH_CALLS     commands run in a single library session
+ */
+#ifndef BENCH_CALLS
+#define BENCH_CALLS 2000
+#endif
+
+/**
+ * @define  BENCH_SPAWNS    commands run with a session or a process each
+ */
+#ifndef BENCH_SPAWNS
+#define BENCH_SPAWNS 200
+#endif
+
+/**
+ * @define  BENCH_SESSIONS  sessions kept open at the same time by the process
+ */
+#ifndef BENCH_SESSIONS
+#define BENCH_SESSIONS 4
+#endif
+
+static char cmd_true[] = "true";
+static char *const cmd[] = {cmd_true, NULL};
+
+/**
+ * @function  elapsed
+ * @abstract  seconds elapsed since start
+ */
+static double elapsed(const struct timespec *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)(now.tv_sec - start->tv_sec) +
+         (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * @function  run
+ * @abstract  run cmd in a session, exit on failure
+ */
+static void run(cmdc_session *s, int *fds) {
+  completion rec;
+  if (cmdc_run_argv(s, cmd, cmdc_to_fds, fds, &rec) == -1 ||
+      rec.exit_code != 0) {
+    perror("cmdc_run_argv");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/**
+ * @function  bench_session
+ * @abstract  cost of a command in a session kept open
+ * @result    double  us per command
+ */
+static double bench_session(int *fds) {
+  cmdc_session *s = cmdc_open(0, 0);
+  if (s == NULL) {
+    perror("cmdc_open");
+    exit(EXIT_FAILURE);
+  }
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < BENCH_CALLS; i++) {
+    run(s, fds);
+  }
+  double us = elapsed(&start) * 1e6 / BENCH_CALLS;
+  cmdc_close(&s);
+  return us;
+}
+
+/**
+ * @function  bench_sessions
+ * @abstract  cost of a command with BENCH_SESSIONS sessions open, used in
+ *            turn
+ * @result    double  us per command
+ */
+static double bench_sessions(int *fds) {
+  cmdc_session *s[BENCH_SESSIONS];
+  for (int i = 0; i < BENCH_SESSIONS; i++) {
+    if ((s[i] = cmdc_open(0, 0)) == NULL) {
+      perror("cmdc_open");
+      exit(EXIT_FAILURE);
+    }
+  }
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < BENCH_CALLS; i++) {
+    run(s[i % BENCH_SESSIONS], fds);
+  }
+  double us = elapsed(&start) * 1e6 / BENCH_CALLS;
+  for (int i = 0; i < BENCH_SESSIONS; i++) {
+    cmdc_close(&s[i]);
+  }
+  return us;
+}
+
+/**
+ * @function  bench_open
+ * @abstract  cost of a command in a session of its own
+ * @result    double  us per command
+ */
+static double bench_open(int *fds) {
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < BENCH_SPAWNS; i++) {
+    cmdc_session *s = cmdc_open(0, 0);
+    if (s == NULL) {
+      perror("cmdc_open");
+      exit(EXIT_FAILURE);
+    }
+    run(s, fds);
+    cmdc_close(&s);
+  }
+  return elapsed(&start) * 1e6 / BENCH_SPAWNS;
+}
+
+/**
+ * @function  bench_cli
+ * @abstract  cost of a command through a cmdc process of its own, as a
+ *            service shelling out to it pays
+ * @result    double  us per command
+ */
+static double bench_cli(const char *cmdc, int null) {
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < BENCH_SPAWNS; i++) {
+    int in[2];
+    if (pipe(in) == -1) {
+      perror("pipe");
+      exit(EXIT_FAILURE);
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+      dup2(in[0], STDIN_FILENO);
+      dup2(null, STDOUT_FILENO);
+      dup2(null, STDERR_FILENO);
+      close(in[0]);
+      close(in[1]);
+      execl(cmdc, cmdc, "-p", "0", (char *)NULL);
+      _exit(EXIT_FAILURE);
+    }
+    close(in[0]);
+    if (write(in[1], "true\n", 5) == -1) {
+      perror("write");
+    }
+    close(in[1]);
+    int status;
+    if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0) {
+      fprintf(stderr, "%s failed\n", cmdc);
+      exit(EXIT_FAILURE);
+    }
+  }
+  return elapsed(&start) * 1e6 / BENCH_SPAWNS;
+}
+
+int main(int argc, char **argv) {
+  const char *cmdc = argc > 1 ? argv[1] : "./cmdc";
+  int null = open("/dev/null", O_WRONLY);
+  if (null == -1) {
+    perror("open");
+    return EXIT_FAILURE;
+  }
+  int fds[2] = {null, null};
+  printf("libcmdc, one session:     %8.0f us/cmd\n", bench_session(fds));
+  printf("libcmdc, %d sessions:      %8.0f us/cmd\n", BENCH_SESSIONS,
+         bench_sessions(fds));
+  printf("libcmdc, session per cmd: %8.0f us/cmd\n", bench_open(fds));
+  printf("cmdc, process per cmd:    %8.0f us/cmd\n", bench_cli(cmdc, null));
+  close(null);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,436 @@
+#define _GNU_SOURCE
+#include "cmdc.h"
+#include "config.h"
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * @define  LOADGEN_SESSIONS    default number of concurrent sessions, more
+ *                              than CAPACITY so that some are rejected
+ */
+#ifndef LOADGEN_SESSIONS
+#define LOADGEN_SESSIONS (CAPACITY + CAPACITY / 2)
+#endif
+
+/**
+ * @define  LOADGEN_BACKOFF_MS  time a rejected session waits before trying
+ *                              to connect again
+ */
+#ifndef LOADGEN_BACKOFF_MS
+#define LOADGEN_BACKOFF_MS 20
+#endif
+
+/**
+ * @define  LOADGEN_KINDS       number of kinds of commands in the mix
+ */
+#define LOADGEN_KINDS 3
+
+static const char *kind_names[LOADGEN_KINDS] = {"true", "cat", "sleep"};
+
+/**
+ * @struct    options
+ * @abstract  settings of a run
+ *
+ * @field     sessions  number of concurrent sessions, one thread each
+ * @field     seconds   duration of the run
+ * @field     rate      requests per second of all the sessions, 0 for a
+ *                      closed loop where each session sends its next request
+ *                      as soon as the previous one ended
+ * @field     weights   share of each kind of command in the mix
+ * @field     size      size of the file read by cat
+ * @field     sleep_ms  duration of sleep
+ * @field     per_conn  requests sent by a session before it reconnects, 0 to
+ *                      keep it
+ * @field     lane      priority lane of the sessions
+ * @field     lines     command line of each kind
+ */
+struct options {
+  unsigned sessions;
+  double seconds;
+  double rate;
+  unsigned weights[LOADGEN_KINDS];
+  long size;
+  long sleep_ms;
+  unsigned long per_conn;
+  unsigned lane;
+  char lines[LOADGEN_KINDS][PATH_MAX];
+};
+
+/**
+ * @struct    samples
+ * @abstract  growing array of latencies in us
+ */
+struct samples {
+  double *v;
+  size_t n;
+  size_t cap;
+};
+
+/**
+ * @struct    worker
+ * @abstract  a session driven by its own thread, and what it measured
+ *
+ * @field     th        the thread
+ * @field     id        index of the worker
+ * @field     connect   time to get a runner
+ * @field     queue     time waited for an execution slot, as reported by the
+ *                      daemon
+ * @field     done      time from the planned send of a request to its
+ *                      completion, so that a late request counts its delay
+ * @field     completed number of requests completed
+ * @field     rejected  number of connections refused for want of a runner
+ * @field     errors    number of failed connections and requests
+ * @field     bytes     bytes of output received
+ */
+struct worker {
+  pthread_t th;
+  unsigned id;
+  struct samples connect;
+  struct samples queue;
+  struct samples done;
+  unsigned long completed;
+  unsigned long rejected;
+  unsigned long errors;
+  unsigned long long bytes;
+};
+
+static struct options opt;
+static struct timespec start;
+
+/**
+ * @function  usage
+ * @abstract  show help and exit
+ */
+static void usage(void) {
+  printf("Usage: loadgen [-n sessions] [-d seconds] [-r rate] [-m mix] "
+         "[-s bytes] [-S ms] [-k requests] [-p lane]\n");
+  printf("  -n sessions concurrent sessions (default %d)\n", LOADGEN_SESSIONS);
+  printf("  -d seconds  duration of the run (default 5)\n");
+  printf("  -r rate     requests per second of all the sessions, 0 for a "
+         "closed loop (default 0)\n");
+  printf("  -m mix      share of each command, as true=80,cat=15,sleep=5\n");
+  printf("  -s bytes    size of the file read by cat (default 65536)\n");
+  printf("  -S ms       duration of sleep (default 10)\n");
+  printf("  -k requests requests of a session before it reconnects, 0 to "
+         "keep it (default 20)\n");
+  printf("  -p lane     priority lane (default %d)\n", LINKER_LANES - 1);
+  printf("The daemon must be running.\n");
+  exit(EXIT_FAILURE);
+}
+
+/**
+ * @function  number
+ * @abstract  parse a non negative number, exit on failure
+ */
+static double number(const char *s) {
+  char *end;
+  double d = strtod(s, &end);
+  if (*s == 0 || *end != 0 || d < 0) {
+    usage();
+  }
+  return d;
+}
+
+/**
+ * @function  parse_mix
+ * @abstract  parse a list of kind=weight, kinds not listed are not sent
+ */
+static void parse_mix(char *mix) {
+  memset(opt.weights, 0, sizeof(opt.weights));
+  unsigned total = 0;
+  for (char *tok = strtok(mix, ","); tok != NULL; tok = strtok(NULL, ",")) {
+    char *eq = strchr(tok, '=');
+    if (eq == NULL) {
+      usage();
+    }
+    *eq = 0;
+    int k = 0;
+    while (k < LOADGEN_KINDS && strcmp(tok, kind_names[k]) != 0) {
+      k++;
+    }
+    if (k == LOADGEN_KINDS) {
+      usage();
+    }
+    opt.weights[k] = (unsigned)number(eq + 1);
+    total += opt.weights[k];
+  }
+  if (total == 0) {
+    usage();
+  }
+}
+
+/**
+ * @function  now_us
+ * @abstract  microseconds elapsed since the start of the run
+ */
+static double now_us(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)(now.tv_sec - start.tv_sec) * 1e6 +
+         (double)(now.tv_nsec - start.tv_nsec) / 1e3;
+}
+
+/**
+ * @function  sleep_until
+ * @abstract  sleep until us microseconds after the start of the run
+ */
+static void sleep_until(double us) {
+  long long ns = (long long)(us * 1e3) + start.tv_nsec;
+  struct timespec t = {.tv_sec = start.tv_sec + (time_t)(ns / 1000000000),
+                       .tv_nsec = (long)(ns % 1000000000)};
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) == EINTR) {
+  }
+}
+
+/**
+ * @function  push
+ * @abstract  add a latency to samples, exit on failure
+ */
+static void push(struct samples *s, double us) {
+  if (s->n == s->cap) {
+    s->cap = s->cap == 0 ? 1024 : 2 * s->cap;
+    s->v = realloc(s->v, s->cap * sizeof(double));
+    if (s->v == NULL) {
+      perror("realloc");
+      exit(EXIT_FAILURE);
+    }
+  }
+  s->v[s->n++] = us;
+}
+
+/**
+ * @function  count_bytes
+ * @abstract  output callback counting the bytes and dropping them
+ */
+static int count_bytes(void *bytes, uint32_t stream, const char *data,
+                       size_t len) {
+  (void)stream;
+  (void)data;
+  *(unsigned long long *)bytes += len;
+  return 0;
+}
+
+/**
+ * @function  pick
+ * @abstract  draw the kind of the next command from the mix
+ */
+static int pick(unsigned *seed) {
+  unsigned total = 0;
+  for (int k = 0; k < LOADGEN_KINDS; k++) {
+    total += opt.weights[k];
+  }
+  unsigned x = (unsigned)rand_r(seed) % total;
+  int k = 0;
+  while (x >= opt.weights[k]) {
+    x -= opt.weights[k++];
+  }
+  return k;
+}
+
+/**
+ * @function  work
+ * @abstract  routine of a worker: send requests until the end of the run,
+ *            reconnecting every per_conn requests
+ */
+static void *work(void *arg) {
+  struct worker *w = arg;
+  unsigned seed = w->id + 1;
+  double end = opt.seconds * 1e6;
+  // each session sends its share of the rate, the sessions staggered
+  double period = opt.rate > 0 ? opt.sessions * 1e6 / opt.rate : 0;
+  double next = period * w->id / opt.sessions;
+  cmdc_session *s = NULL;
+  unsigned long used = 0;
+  while (now_us() < end) {
+    if (s == NULL) {
+      double t0 = now_us();
+      if ((s = cmdc_open(opt.lane, 0)) == NULL) {
+        if (errno == EBUSY) {
+          w->rejected++;
+        } else {
+          w->errors++;
+        }
+        usleep(LOADGEN_BACKOFF_MS * 1000);
+        continue;
+      }
+      push(&w->connect, now_us() - t0);
+    }
+    double sent = now_us();
+    if (period > 0) {
+      if (next > sent) {
+        sleep_until(next);
+      }
+      sent = next;
+      next += period;
+    }
+    completion rec;
+    if (cmdc_run(s, opt.lines[pick(&seed)], count_bytes, &w->bytes, &rec) ==
+        -1) {
+      w->errors++;
+      cmdc_close(&s);
+      continue;
+    }
+    push(&w->done, now_us() - sent);
+    push(&w->queue, (double)rec.queued_ms * 1e3);
+    w->completed++;
+    if (opt.per_conn > 0 && ++used == opt.per_conn) {
+      cmdc_close(&s);
+      used = 0;
+    }
+  }
+  cmdc_close(&s);
+  return NULL;
+}
+
+/**
+ * @function  cmp
+ * @abstract  order of two latencies for qsort
+ */
+static int cmp(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * @function  report
+ * @abstract  print the percentiles of the samples of all the workers
+ */
+static void report(const char *name, struct worker *ws, size_t offset) {
+  struct samples all = {NULL, 0, 0};
+  for (unsigned i = 0; i < opt.sessions; i++) {
+    struct samples *s = (struct samples *)((char *)&ws[i] + offset);
+    for (size_t j = 0; j < s->n; j++) {
+      push(&all, s->v[j]);
+    }
+  }
+  if (all.n == 0) {
+    printf("%-8s %10s %10s %10s\n", name, "-", "-", "-");
+    return;
+  }
+  qsort(all.v, all.n, sizeof(double), cmp);
+  double p[3] = {0.5, 0.99, 0.999};
+  printf("%-8s", name);
+  for (int i = 0; i < 3; i++) {
+    size_t k = (size_t)ceil(p[i] * (double)all.n) - 1;
+    printf(" %10.0f", all.v[k]);
+  }
+  printf("\n");
+  free(all.v);
+}
+
+int main(int argc, char **argv) {
+  opt.sessions = LOADGEN_SESSIONS;
+  opt.seconds = 5;
+  opt.rate = 0;
+  opt.weights[0] = 80;
+  opt.weights[1] = 15;
+  opt.weights[2] = 5;
+  opt.size = 65536;
+  opt.sleep_ms = 10;
+  opt.per_conn = 20;
+  opt.lane = LINKER_LANES - 1;
+  int o;
+  while ((o = getopt(argc, argv, "n:d:r:m:s:S:k:p:")) != -1) {
+    switch (o) {
+    case 'n':
+      opt.sessions = (unsigned)number(optarg);
+      break;
+    case 'd':
+      opt.seconds = number(optarg);
+      break;
+    case 'r':
+      opt.rate = number(optarg);
+      break;
+    case 'm':
+      parse_mix(optarg);
+      break;
+    case 's':
+      opt.size = (long)number(optarg);
+      break;
+    case 'S':
+      opt.sleep_ms = (long)number(optarg);
+      break;
+    case 'k':
+      opt.per_conn = (unsigned long)number(optarg);
+      break;
+    case 'p':
+      opt.lane = (unsigned)number(optarg);
+      break;
+    default:
+      usage();
+    }
+  }
+  if (optind < argc || opt.sessions == 0 || opt.lane >= LINKER_LANES) {
+    usage();
+  }
+
+  // the file read by cat, removed at the end of the run
+  char file[] = "/tmp/cmds_loadgen_XXXXXX";
+  int fd = mkstemp(file);
+  if (fd == -1 || ftruncate(fd, opt.size) == -1) {
+    perror("mkstemp");
+    return EXIT_FAILURE;
+  }
+  close(fd);
+  snprintf(opt.lines[0], PATH_MAX, "true");
+  snprintf(opt.lines[1], PATH_MAX, "cat %s", file);
+  snprintf(opt.lines[2], PATH_MAX, "sleep %ld.%03ld", opt.sleep_ms / 1000,
+           opt.sleep_ms % 1000);
+
+  struct worker *ws = calloc(opt.sessions, sizeof(struct worker));
+  if (ws == NULL) {
+    perror("calloc");
+    return EXIT_FAILURE;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (unsigned i = 0; i < opt.sessions; i++) {
+    ws[i].id = i;
+    if (pthread_create(&ws[i].th, NULL, work, &ws[i]) != 0) {
+      perror("pthread_create");
+      return EXIT_FAILURE;
+    }
+  }
+  unsigned long completed = 0, rejected = 0, errors = 0;
+  unsigned long long bytes = 0;
+  for (unsigned i = 0; i < opt.sessions; i++) {
+    pthread_join(ws[i].th, NULL);
+    completed += ws[i].completed;
+    rejected += ws[i].rejected;
+    errors += ws[i].errors;
+    bytes += ws[i].bytes;
+  }
+  double secs = now_us() / 1e6;
+  unlink(file);
+
+  printf("%u sessions, %.1f s, ", opt.sessions, secs);
+  if (opt.rate > 0) {
+    printf("%.0f requests/s planned, ", opt.rate);
+  } else {
+    printf("closed loop, ");
+  }
+  printf("mix true=%u cat=%u (%ld bytes) sleep=%u (%ld ms)\n", opt.weights[0],
+         opt.weights[1], opt.size, opt.weights[2], opt.sleep_ms);
+  printf("completed %lu (%.0f/s, %.1f MB/s), rejected %lu, errors %lu\n",
+         completed, (double)completed / secs, (double)bytes / secs / 1e6,
+         rejected, errors);
+  printf("%-8s %10s %10s %10s\n", "us", "p50", "p99", "p99.9");
+  report("connect", ws, offsetof(struct worker, connect));
+  report("queue", ws, offsetof(struct worker, queue));
+  report("command", ws, offsetof(struct worker, done));
+
+  for (unsigned i = 0; i < opt.sessions; i++) {
+    free(ws[i].connect.v);
+    free(ws[i].queue.v);
+    free(ws[i].done.v);
+  }
+  free(ws);
+  return errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
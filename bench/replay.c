@@ -0,0 +1,433 @@
+#define _GNU_SOURCE
+#include "capture.h"
+#include "cmdc.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * @struct    samples
+ * @abstract  growing array of latencies in us
+ */
+struct samples {
+  double *v;
+  size_t n;
+  size_t cap;
+};
+
+/**
+ * @struct    command
+ * @abstract  a command line of a captured session
+ *
+ * @field     t_us      time it was sent, since the capture started
+ * @field     line      the command line
+ */
+struct command {
+  uint64_t t_us;
+  char *line;
+};
+
+/**
+ * @struct    session
+ * @abstract  a captured session, replayed by its own thread, and what it
+ *            measured
+ *
+ * @field     th        the thread
+ * @field     started   was the thread started?
+ * @field     known     was the arrival of the session captured?
+ * @field     t_us      time the session arrived, since the capture started
+ * @field     end_us    time the session ended, 0 if the capture missed it
+ * @field     lane      priority lane of the session
+ * @field     flags     CLIENT_* options of the session
+ * @field     wd        working directory of the session
+ * @field     cmds      the command lines of the session
+ * @field     ncmds     number of command lines
+ * @field     connect   time to get a runner
+ * @field     done      time from the planned send of a command to its
+ *                      completion, so that a late command counts its delay
+ * @field     completed number of commands completed
+ * @field     rejected  was the session refused for want of a runner?
+ * @field     errors    number of failed connections and commands
+ * @field     moved     did the session run elsewhere than in its directory?
+ * @field     bytes     bytes of output received
+ */
+struct session {
+  pthread_t th;
+  bool started;
+  bool known;
+  uint64_t t_us;
+  uint64_t end_us;
+  unsigned lane;
+  unsigned flags;
+  char *wd;
+  struct command *cmds;
+  size_t ncmds;
+  struct samples connect;
+  struct samples done;
+  unsigned long completed;
+  bool rejected;
+  unsigned long errors;
+  bool moved;
+  unsigned long long bytes;
+};
+
+static struct session *sessions;
+static size_t nsessions;
+static double speed = 1;
+static struct timespec start;
+static int home_fd;
+static char home[PATH_MAX];
+// the working directory is shared by the threads, see open_in
+static pthread_rwlock_t wd_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+/**
+ * @function  usage
+ * @abstract  show help and exit
+ */
+static void usage(void) {
+  printf("Usage: replay [-x speed] file\n");
+  printf("  -x speed    how many times faster than captured, 0 not to "
+         "wait at all (default 1)\n");
+  printf("The daemon must be running.\n");
+  exit(EXIT_FAILURE);
+}
+
+/**
+ * @function  now_us
+ * @abstract  microseconds elapsed since the start of the replay
+ */
+static double now_us(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)(now.tv_sec - start.tv_sec) * 1e6 +
+         (double)(now.tv_nsec - start.tv_nsec) / 1e3;
+}
+
+/**
+ * @function  planned
+ * @abstract  time of the replay matching a time of the capture
+ */
+static double planned(uint64_t t_us) {
+  return speed > 0 ? (double)t_us / speed : 0;
+}
+
+/**
+ * @function  sleep_until
+ * @abstract  sleep until us microseconds after the start of the replay
+ */
+static void sleep_until(double us) {
+  long long ns = (long long)(us * 1e3) + start.tv_nsec;
+  struct timespec t = {.tv_sec = start.tv_sec + (time_t)(ns / 1000000000),
+                       .tv_nsec = (long)(ns % 1000000000)};
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) == EINTR) {
+  }
+}
+
+/**
+ * @function  push
+ * @abstract  add a latency to samples, exit on failure
+ */
+static void push(struct samples *s, double us) {
+  if (s->n == s->cap) {
+    s->cap = s->cap == 0 ? 64 : 2 * s->cap;
+    s->v = realloc(s->v, s->cap * sizeof(double));
+    if (s->v == NULL) {
+      perror("realloc");
+      exit(EXIT_FAILURE);
+    }
+  }
+  s->v[s->n++] = us;
+}
+
+/**
+ * @function  session_of
+ * @abstract  the session of a number of the capture, added if needed, exit
+ *            on failure
+ */
+static struct session *session_of(uint32_t id) {
+  if (id == 0) {
+    return NULL;
+  }
+  if (id > nsessions) {
+    sessions = realloc(sessions, id * sizeof(struct session));
+    if (sessions == NULL) {
+      perror("realloc");
+      exit(EXIT_FAILURE);
+    }
+    memset(sessions + nsessions, 0,
+           (id - nsessions) * sizeof(struct session));
+    nsessions = id;
+  }
+  return &sessions[id - 1];
+}
+
+/**
+ * @function  load
+ * @abstract  read the sessions of a capture, exit on failure
+ */
+static void load(const char *path) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  int64_t t;
+  if (fd == -1 || capture_check(fd, &t) == -1) {
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+  cap_record rec;
+  char *payload;
+  int rc;
+  while ((rc = capture_next(fd, &rec, &payload)) == 1) {
+    struct session *s = session_of(rec.session);
+    if (s == NULL) {
+      free(payload);
+      continue;
+    }
+    switch (rec.type) {
+    case CAP_SESSION:
+      s->known = true;
+      s->t_us = rec.t_us;
+      s->lane = rec.lane;
+      s->flags = rec.flags & (CLIENT_RING | CLIENT_PTY);
+      free(s->wd);
+      s->wd = payload;
+      payload = NULL;
+      break;
+    case CAP_CMD:
+      s->cmds = realloc(s->cmds, (s->ncmds + 1) * sizeof(struct command));
+      if (s->cmds == NULL) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+      }
+      s->cmds[s->ncmds++] = (struct command){rec.t_us, payload};
+      payload = NULL;
+      break;
+    case CAP_END:
+      s->end_us = rec.t_us;
+      break;
+    }
+    free(payload);
+  }
+  if (rc == -1) {
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+  close(fd);
+}
+
+/**
+ * @function  open_in
+ * @abstract  open a session in a working directory, the current one if it
+ *            can't be entered. The runner takes the working directory of the
+ *            process when it starts: another directory is entered until
+ *            cmdc_open returns, sessions of the current one opening together.
+ */
+static cmdc_session *open_in(struct session *s) {
+  bool away = s->wd != NULL && s->wd[0] != 0 && strcmp(s->wd, home) != 0;
+  if (away) {
+    pthread_rwlock_wrlock(&wd_lock);
+    away = chdir(s->wd) == 0;
+    s->moved = !away;
+  } else {
+    pthread_rwlock_rdlock(&wd_lock);
+    s->moved = s->wd == NULL || s->wd[0] == 0;
+  }
+  cmdc_session *cs = cmdc_open(s->lane, s->flags);
+  int err = errno;
+  if (away && fchdir(home_fd) == -1) {
+    perror("fchdir");
+    exit(EXIT_FAILURE);
+  }
+  pthread_rwlock_unlock(&wd_lock);
+  errno = err;
+  return cs;
+}
+
+/**
+ * @function  count_bytes
+ * @abstract  output callback counting the bytes and dropping them
+ */
+static int count_bytes(void *bytes, uint32_t stream, const char *data,
+                       size_t len) {
+  (void)stream;
+  (void)data;
+  *(unsigned long long *)bytes += len;
+  return 0;
+}
+
+/**
+ * @function  replay
+ * @abstract  routine of a session: send its commands at their captured times
+ *            then leave when it left
+ */
+static void *replay(void *arg) {
+  struct session *s = arg;
+  double t0 = now_us();
+  cmdc_session *cs = open_in(s);
+  if (cs == NULL) {
+    if (errno == EBUSY) {
+      s->rejected = true;
+    } else {
+      s->errors++;
+    }
+    return NULL;
+  }
+  push(&s->connect, now_us() - t0);
+  for (size_t i = 0; i < s->ncmds; i++) {
+    double sent = now_us();
+    if (speed > 0) {
+      sent = planned(s->cmds[i].t_us);
+      sleep_until(sent);
+    }
+    completion rec;
+    if (cmdc_run(cs, s->cmds[i].line, count_bytes, &s->bytes, &rec) == -1) {
+      s->errors++;
+      cmdc_close(&cs);
+      return NULL;
+    }
+    push(&s->done, now_us() - sent);
+    s->completed++;
+  }
+  // the session keeps its runner as long as it did
+  if (s->end_us > 0) {
+    sleep_until(planned(s->end_us));
+  }
+  cmdc_close(&cs);
+  return NULL;
+}
+
+/**
+ * @function  cmp
+ * @abstract  order of two latencies for qsort
+ */
+static int cmp(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * @function  by_arrival
+ * @abstract  order of two sessions for qsort, the first arrived first
+ */
+static int by_arrival(const void *a, const void *b) {
+  const struct session *x = *(struct session *const *)a;
+  const struct session *y = *(struct session *const *)b;
+  return (x->t_us > y->t_us) - (x->t_us < y->t_us);
+}
+
+/**
+ * @function  report
+ * @abstract  print the percentiles of the samples of all the sessions
+ */
+static void report(const char *name, size_t offset) {
+  struct samples all = {NULL, 0, 0};
+  for (size_t i = 0; i < nsessions; i++) {
+    struct samples *s = (struct samples *)((char *)&sessions[i] + offset);
+    for (size_t j = 0; j < s->n; j++) {
+      push(&all, s->v[j]);
+    }
+  }
+  if (all.n == 0) {
+    printf("%-8s %10s %10s %10s\n", name, "-", "-", "-");
+    return;
+  }
+  qsort(all.v, all.n, sizeof(double), cmp);
+  double p[3] = {0.5, 0.99, 0.999};
+  printf("%-8s", name);
+  for (int i = 0; i < 3; i++) {
+    size_t k = (size_t)ceil(p[i] * (double)all.n) - 1;
+    printf(" %10.0f", all.v[k]);
+  }
+  printf("\n");
+  free(all.v);
+}
+
+int main(int argc, char **argv) {
+  int o;
+  while ((o = getopt(argc, argv, "x:")) != -1) {
+    char *end;
+    switch (o) {
+    case 'x':
+      speed = strtod(optarg, &end);
+      if (*optarg == 0 || *end != 0 || speed < 0) {
+        usage();
+      }
+      break;
+    default:
+      usage();
+    }
+  }
+  if (optind != argc - 1) {
+    usage();
+  }
+  load(argv[optind]);
+  if ((home_fd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC)) == -1 ||
+      getcwd(home, sizeof(home)) == NULL) {
+    perror("open");
+    return EXIT_FAILURE;
+  }
+
+  // the shards of a daemon number their sessions apart
+  struct session **order = malloc(nsessions * sizeof(struct session *));
+  if (order == NULL && nsessions > 0) {
+    perror("malloc");
+    return EXIT_FAILURE;
+  }
+  size_t known = 0;
+  for (size_t i = 0; i < nsessions; i++) {
+    if (sessions[i].known) {
+      order[known++] = &sessions[i];
+    }
+  }
+  qsort(order, known, sizeof(struct session *), by_arrival);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  size_t ncmds = 0;
+  uint64_t last = 0;
+  for (size_t i = 0; i < known; i++) {
+    struct session *s = order[i];
+    ncmds += s->ncmds;
+    last = s->end_us > last ? s->end_us : last;
+    sleep_until(planned(s->t_us));
+    if (pthread_create(&s->th, NULL, replay, s) != 0) {
+      perror("pthread_create");
+      return EXIT_FAILURE;
+    }
+    s->started = true;
+  }
+  unsigned long completed = 0, rejected = 0, errors = 0, moved = 0;
+  unsigned long long bytes = 0;
+  for (size_t i = 0; i < nsessions; i++) {
+    if (sessions[i].started) {
+      pthread_join(sessions[i].th, NULL);
+    }
+    completed += sessions[i].completed;
+    rejected += sessions[i].rejected;
+    errors += sessions[i].errors;
+    moved += sessions[i].moved;
+    bytes += sessions[i].bytes;
+  }
+  double secs = now_us() / 1e6;
+
+  printf("%zu sessions, %zu commands, captured over %.1f s, ", known, ncmds,
+         (double)last / 1e6);
+  if (speed > 0) {
+    printf("replayed at x%g in %.1f s\n", speed, secs);
+  } else {
+    printf("replayed back to back in %.1f s\n", secs);
+  }
+  printf("completed %lu (%.1f MB), rejected %lu, errors %lu, "
+         "moved %lu\n",
+         completed, (double)bytes / 1e6, rejected, errors, moved);
+  printf("us       %10s %10s %10s\n", "p50", "p99", "p99.9");
+  report("connect", offsetof(struct session, connect));
+  report("command", offsetof(struct session, done));
+  return EXIT_SUCCESS;
+}
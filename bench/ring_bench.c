@@ -0,0 +1,134 @@
+#define _GNU_SOURCE
+#include "config.h"
+#include "linker.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * @define  BENCH_MB      megabytes sent through each transport
+ */
+#ifndef BENCH_MB
+#define BENCH_MB 2048
+#endif
+
+/**
+ * @define  BENCH_CHUNK   bytes written at once by the producer
+ */
+#ifndef BENCH_CHUNK
+#define BENCH_CHUNK 65536
+#endif
+
+/**
+ * @function  elapsed
+ * @abstract  seconds elapsed since start
+ */
+static double elapsed(const struct timespec *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)(now.tv_sec - start->tv_sec) +
+         (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * @function  bench_fifo
+ * @abstract  throughput of a fifo read by a loop writing to out, as cmdc does
+ * @result    double  MB/s
+ */
+static double bench_fifo(int out) {
+  char path[PIPE_LEN];
+  snprintf(path, sizeof(path), "/tmp/%d_bench", getpid());
+  if (mkfifo(path, S_IRUSR | S_IWUSR) == -1) {
+    perror("mkfifo");
+    exit(EXIT_FAILURE);
+  }
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  pid_t pid = fork();
+  if (pid == 0) {
+    static char chunk[BENCH_CHUNK];
+    memset(chunk, 'x', sizeof(chunk));
+    int fd = open(path, O_WRONLY);
+    for (size_t n = 0; n < (size_t)BENCH_MB << 20; n += sizeof(chunk)) {
+      if (write(fd, chunk, sizeof(chunk)) == -1) {
+        _exit(EXIT_FAILURE);
+      }
+    }
+    _exit(EXIT_SUCCESS);
+  }
+  int fd = open(path, O_RDONLY);
+  unlink(path);
+  static char buf[BENCH_CHUNK];
+  ssize_t r;
+  while ((r = read(fd, buf, sizeof(buf))) > 0) {
+    if (write(out, buf, (size_t)r) == -1) {
+      perror("write");
+      exit(EXIT_FAILURE);
+    }
+  }
+  close(fd);
+  waitpid(pid, NULL, 0);
+  return BENCH_MB / elapsed(&start);
+}
+
+/**
+ * @function  bench_ring
+ * @abstract  throughput of an output ring written to out from the mapped
+ *            pages, as cmdc -s does
+ * @result    double  MB/s
+ */
+static double bench_ring(int out) {
+  char name[PIPE_LEN];
+  snprintf(name, sizeof(name), RING_SHM, getpid(), 0u);
+  ring *rg = ring_create(name);
+  if (rg == NULL) {
+    exit(EXIT_FAILURE);
+  }
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  pid_t pid = fork();
+  if (pid == 0) {
+    static char chunk[BENCH_CHUNK];
+    memset(chunk, 'x', sizeof(chunk));
+    ring *prod = ring_open(name);
+    for (size_t n = 0; n < (size_t)BENCH_MB << 20; n += sizeof(chunk)) {
+      size_t done = 0;
+      while ((done += ring_write(prod, chunk + done, sizeof(chunk) - done)) <
+             sizeof(chunk)) {
+        ring_wait_space(prod, 100);
+      }
+    }
+    ring_end(prod);
+    _exit(EXIT_SUCCESS);
+  }
+  const char *data;
+  size_t len;
+  while ((len = ring_read(rg, &data)) > 0) {
+    if (write(out, data, len) == -1) {
+      perror("write");
+      exit(EXIT_FAILURE);
+    }
+    ring_consume(rg, len);
+  }
+  waitpid(pid, NULL, 0);
+  double mbs = BENCH_MB / elapsed(&start);
+  ring_close(&rg, name);
+  return mbs;
+}
+
+int main(void) {
+  int out = open("/dev/null", O_WRONLY);
+  if (out == -1) {
+    perror("open");
+    return EXIT_FAILURE;
+  }
+  printf("fifo: %8.0f MB/s\n", bench_fifo(out));
+  printf("ring: %8.0f MB/s\n", bench_ring(out));
+  close(out);
+  return EXIT_SUCCESS;
+}
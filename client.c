@@ -1,13 +1,135 @@
+#ifdef _XOPEN_SOURCE
+#undef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 700
+#endif
+#include "cmdc.h"
 #include "tools/config.h"
 #include "tools/linker.h"
+#include "tools/proto.h"
+#include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+/**
+ * @define  FANOUT    prefix of the lines sent as fan-out requests
+ */
+#ifndef FANOUT
+#define FANOUT "@fanout"
+#endif
+
+/**
+ * @define  EXPORT    prefix of the lines setting a variable of the session
+ * @define  UNSET     prefix of the lines unsetting variables of the session
+ */
+#ifndef EXPORT
+#define EXPORT "export"
+#endif
+#ifndef UNSET
+#define UNSET "unset"
+#endif
+
+/**
+ * @define  OPEN_RETRY_MS   max time a session that can't be signaled waits
+ *                          for the runner before checking again whether the
+ *                          daemon cancelled it
+ */
+#ifndef OPEN_RETRY_MS
+#define OPEN_RETRY_MS 10
+#endif
+
+extern char **environ;
+
+struct cmdc_session {
+  pid_t pid;
+  uint32_t sid;
+  unsigned flags;
+  int fd_in;
+  char pipe_out[PIPE_LEN];
+  ring *rg;
+  char ring_name[PIPE_LEN];
+  slot *sl;
+  char slot_name[PIPE_LEN];
+};
+
+/**
+ * @function  build_fanout
+ * @abstract  build the payload of a fan-out request from a line of the form
+ *            "@fanout [-P n] [-k] cmd [{}] args... (::: input... | :::: file)"
+ * @param     line      the line, modified
+ * @param     payload   buffer to store the allocated payload
+ * @param     len       buffer to store the length of the payload
+ */
+int build_fanout(char *line, char **payload, size_t *len);
+/**
+ * @function  build_env
+ * @abstract  build the payload of the request sending the whole environment
+ *            of the client
+ * @param     payload   buffer to store the allocated payload
+ * @param     len       buffer to store the length of the payload
+ */
+static int build_env(char **payload, size_t *len);
+/**
+ * @function  build_env_delta
+ * @abstract  build the payload of an environment request from a line of the
+ *            form "export NAME=value" or "unset NAME..."
+ * @param     line      the line, modified
+ * @param     payload   buffer to store the allocated payload
+ * @param     len       buffer to store the length of the payload
+ */
+int build_env_delta(char *line, char **payload, size_t *len);
+/**
+ * @struct    demux
+ * @abstract  state of the split of the output of a request into its stdout
+ *            and stderr frames
+ * @field     hdr       header of the current frame
+ * @field     hdr_len   bytes of hdr received
+ * @field     left      bytes of the current frame not received yet
+ * @field     out       callback receiving the frames, NULL once it gave up
+ * @field     arg       argument given to out
+ */
+struct demux {
+  frame hdr;
+  size_t hdr_len;
+  size_t left;
+  cmdc_output_fn out;
+  void *arg;
+};
+
+/**
+ * @function  demux_feed
+ * @abstract  give output received from the daemon to the callback of its
+ *            stream
+ * @param     dm        state of the split, kept between calls
+ * @param     data      the bytes received
+ * @param     len       number of bytes
+ */
+static void demux_feed(struct demux *dm, const char *data, size_t len);
+/**
+ * @function  report
+ * @abstract  report how a request ended
+ * @param     rec       the completion record of the request
+ * @param     verbose   report the timings of every request, not only the
+ *                      failures
+ * @result    int       the exit status of the request, as a shell gives it
+ */
+int report(const completion *rec, bool verbose);
+/**
+ * @function  close_session
+ * @abstract  end the session of the command line client, registered with
+ *            atexit
+ */
+void close_session(void);
 /**
  * @function  setup_signals
  * @abstract  setup signal handling, catch them and affect handler
@@ -21,135 +143,865 @@ void setup_signals(void);
  */
 void handler(int signum);
 
+static _Atomic uint32_t next_sid;
+
+/**
+ * @function  append
+ * @abstract  append n bytes to a growing buffer
+ */
+static int append(char **buf, size_t *len, size_t *cap, const char *s,
+                  size_t n) {
+  if (*len + n > *cap) {
+    size_t ncap = *cap * 2 > *len + n ? *cap * 2 : *len + n;
+    char *nbuf = realloc(*buf, ncap);
+    if (nbuf == NULL) {
+      return -1;
+    }
+    *buf = nbuf;
+    *cap = ncap;
+  }
+  memcpy(*buf + *len, s, n);
+  *len += n;
+  return 0;
+}
+
+/**
+ * @function  _send
+ * @abstract  send a request to the runner of a session. A runner gone makes
+ *            the write fail with EPIPE, the SIGPIPE it raises is kept from
+ *            the process.
+ */
+static int _send(cmdc_session *s, uint32_t type, const void *payload,
+                 size_t len) {
+  sigset_t pipe_set, old_set;
+  sigemptyset(&pipe_set);
+  sigaddset(&pipe_set, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &pipe_set, &old_set);
+  int rc = proto_send(s->fd_in, type, payload, len);
+  if (rc == -1 && errno == EPIPE) {
+    struct timespec now = {0, 0};
+    sigtimedwait(&pipe_set, NULL, &now);
+    errno = EPIPE;
+  }
+  pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+  return rc;
+}
+
+/**
+ * @function  _connect
+ * @abstract  open the request pipe of a session once a runner reads it. A
+ *            session that can't be signaled sleeps on its completion slot
+ *            while waiting, the daemon posting a record there if it is
+ *            refused.
+ */
+static int _connect(cmdc_session *s, const char *pipe_in) {
+  if (!(s->flags & CLIENT_NOSIG)) {
+    return open(pipe_in, O_WRONLY | O_CLOEXEC);
+  }
+  for (;;) {
+    int fd = open(pipe_in, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd != -1) {
+      int fl = fcntl(fd, F_GETFL);
+      if (fl == -1 || fcntl(fd, F_SETFL, fl & ~O_NONBLOCK) == -1) {
+        close(fd);
+        return -1;
+      }
+      return fd;
+    }
+    if (errno != ENXIO) {
+      return -1;
+    }
+    completion rec;
+    if (slot_timedwait(s->sl, &rec, OPEN_RETRY_MS) == 0) {
+      errno = EBUSY;
+      return -1;
+    }
+  }
+}
+
+/**
+ * @function  _open_output
+ * @abstract  open the output pipe of a request and wait for the runner to
+ *            write it. A session that can't be signaled checks its completion
+ *            slot while waiting, the daemon posting a record there if it
+ *            cancels the session. The slot is only peeked: any other record
+ *            is left for slot_wait once the output is read.
+ */
+static int _open_output(cmdc_session *s) {
+  if (!(s->flags & CLIENT_NOSIG)) {
+    return open(s->pipe_out, O_RDONLY | O_CLOEXEC);
+  }
+  int fd = open(s->pipe_out, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  if (fd == -1) {
+    return -1;
+  }
+  struct pollfd pfd = {.fd = fd, .events = POLLIN};
+  int rc;
+  while ((rc = poll(&pfd, 1, OPEN_RETRY_MS)) <= 0) {
+    if (rc == -1 && errno != EINTR) {
+      close(fd);
+      return -1;
+    }
+    // the record of a request may come before the end of its output, a
+    // command forked by another runner holding the pipe until it execs
+    completion rec;
+    if (rc == 0 && slot_peek(s->sl, &rec) == 0 && rec.exit_code == -1 &&
+        rec.signal == 0) {
+      close(fd);
+      errno = ECANCELED;
+      return -1;
+    }
+  }
+  int fl = fcntl(fd, F_GETFL);
+  if (fl == -1 || fcntl(fd, F_SETFL, fl & ~O_NONBLOCK) == -1) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/**
+ * @function  _create
+ * @abstract  allocate a session and create its slot and ring. The session is
+ *            stored in session_p before anything else, so that an exit while
+ *            it is opened still frees it.
+ * @param     session_p buffer to store the session, NULL on failure
+ * @param     flags     CLIENT_* options of the session
+ */
+static int _create(cmdc_session **session_p, unsigned flags) {
+  cmdc_session *s = malloc(sizeof(cmdc_session));
+  if (s == NULL) {
+    return -1;
+  }
+  s->pid = getpid();
+  s->sid = atomic_fetch_add(&next_sid, 1);
+  s->flags = flags;
+  s->fd_in = -1;
+  s->rg = NULL;
+  s->sl = NULL;
+  snprintf(s->pipe_out, sizeof(s->pipe_out), PIPE_OUT, s->pid, s->sid);
+  snprintf(s->slot_name, sizeof(s->slot_name), SLOT_SHM, s->pid, s->sid);
+  snprintf(s->ring_name, sizeof(s->ring_name), RING_SHM, s->pid, s->sid);
+  *session_p = s;
+  if ((s->sl = slot_create(s->slot_name)) == NULL ||
+      ((flags & CLIENT_RING) && (s->rg = ring_create(s->ring_name)) == NULL)) {
+    cmdc_close(session_p);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * @function  _pick_shard
+ * @abstract  connect to the linker of the least loaded shard of the daemon,
+ *            shards as loaded being chosen by a hash of the session so that
+ *            clients starting together spread
+ * @param     c       the client
+ * @result    linker *  the linker of the shard, NULL on failure
+ */
+static linker *_pick_shard(const client *c) {
+  linker *first = linker_connect(LINKER_SHM);
+  if (first == NULL) {
+    return NULL;
+  }
+  unsigned n = linker_shards(first);
+  if (n <= 1) {
+    return first;
+  }
+  unsigned from = ((unsigned)c->pid * 31 + c->sid) % n;
+  linker *best = NULL;
+  unsigned best_load = UINT_MAX;
+  for (unsigned k = 0; k < n; k++) {
+    unsigned i = (from + k) % n;
+    linker *lp = first;
+    if (i != 0) {
+      char name[PIPE_LEN];
+      linker_name(name, sizeof(name), i);
+      if ((lp = linker_connect(name)) == NULL) {
+        continue;
+      }
+    }
+    unsigned load = linker_load(lp, NULL);
+    if (load < best_load) {
+      if (best != first) {
+        linker_disconnect(&best);
+      }
+      best = lp;
+      best_load = load;
+    } else if (lp != first) {
+      linker_disconnect(&lp);
+    }
+  }
+  if (best != first) {
+    linker_disconnect(&first);
+  }
+  return best;
+}
+
+/**
+ * @function  _open
+ * @abstract  open a session with the daemon
+ * @param     session_p buffer to store the session, NULL on failure
+ * @param     lane      the priority lane
+ * @param     flags     CLIENT_* options of the session
+ */
+static int _open(cmdc_session **session_p, unsigned lane, unsigned flags) {
+  struct stat wd_st;
+  if (stat(".", &wd_st) == -1 || _create(session_p, flags) == -1) {
+    return -1;
+  }
+  cmdc_session *s = *session_p;
+  client c = {.pid = s->pid,
+              .sid = s->sid,
+              .flags = flags,
+              .wd_dev = (uint64_t)wd_st.st_dev,
+              .wd_ino = (uint64_t)wd_st.st_ino};
+
+  char pipe_in[PIPE_LEN];
+  snprintf(pipe_in, sizeof(pipe_in), PIPE_IN, s->pid, s->sid);
+  linker *lp = NULL;
+  if (mkfifo(pipe_in, S_IRUSR | S_IWUSR) == -1 ||
+      (lp = _pick_shard(&c)) == NULL ||
+      linker_push(lp, &c, lane) == -1) {
+    linker_disconnect(&lp);
+    cmdc_close(session_p);
+    return -1;
+  }
+  linker_disconnect(&lp);
+
+  if ((s->fd_in = _connect(s, pipe_in)) == -1) {
+    cmdc_close(session_p);
+    return -1;
+  }
+  unlink(pipe_in);
+
+  char *env_payload;
+  size_t env_len;
+  if (build_env(&env_payload, &env_len) == -1) {
+    cmdc_close(session_p);
+    return -1;
+  }
+  int rc = _send(s, REQ_ENV, env_payload, env_len);
+  free(env_payload);
+  if (rc == -1) {
+    cmdc_close(session_p);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * @function  _collect
+ * @abstract  give the output of a request sent to out then wait for its
+ *            completion record
+ */
+static int _collect(cmdc_session *s, cmdc_output_fn out, void *arg,
+                    completion *rec) {
+  struct demux dm = {.hdr_len = 0, .left = 0, .out = out, .arg = arg};
+  if (s->rg != NULL) {
+    const char *data;
+    size_t n;
+    while ((n = ring_read(s->rg, &data)) > 0) {
+      demux_feed(&dm, data, n);
+      ring_consume(s->rg, n);
+    }
+  } else {
+    int fd_out = _open_output(s);
+    unlink(s->pipe_out);
+    struct stat st;
+    if (fd_out == -1 || fstat(fd_out, &st) == -1) {
+      return -1;
+    }
+    char buf_out[st.st_blksize];
+    ssize_t r_out;
+    while ((r_out = read(fd_out, buf_out, sizeof(buf_out))) > 0) {
+      demux_feed(&dm, buf_out, (size_t)r_out);
+    }
+    if (close(fd_out) == -1) {
+      return -1;
+    }
+  }
+
+  slot_wait(s->sl, rec);
+  if (rec->exit_code == -1 && rec->signal == 0) {
+    errno = ECANCELED;
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * @function  _request
+ * @abstract  send a request, give its output to out then wait for its
+ *            completion record
+ */
+static int _request(cmdc_session *s, uint32_t type, const void *payload,
+                    size_t len, cmdc_output_fn out, void *arg,
+                    completion *rec) {
+  if (s->rg == NULL && mkfifo(s->pipe_out, S_IRUSR | S_IWUSR) == -1) {
+    return -1;
+  }
+  if (_send(s, type, payload, len) == -1) {
+    if (s->rg == NULL) {
+      unlink(s->pipe_out);
+    }
+    return -1;
+  }
+  return _collect(s, out, arg, rec);
+}
+
+/**
+ * @function  _accepted
+ * @abstract  wait for the runner to take over a session after a REQ_RESUME:
+ *            it writes the session in the slot, or drops the request and
+ *            closes the resume pipe if the token is wrong
+ */
+static int _accepted(cmdc_session *s, uint64_t runner, uint64_t token) {
+  for (;;) {
+    uint64_t r, t;
+    slot_session(s->sl, &r, &t);
+    if (r == runner && t == token) {
+      return 0;
+    }
+    // a pipe left without reader polls as an error for its writer
+    struct pollfd pfd = {.fd = s->fd_in, .events = 0};
+    if (poll(&pfd, 1, OPEN_RETRY_MS) == 1) {
+      errno = ECANCELED;
+      return -1;
+    }
+  }
+}
+
+/**
+ * @function  _resume
+ * @abstract  take over a session whose client was lost, through the resume
+ *            pipe of its runner, without going through the linker
+ * @param     session_p buffer to store the session, NULL on failure
+ * @param     token     the token of the session, see cmdc_token
+ * @param     flags     CLIENT_* options of the session
+ * @param     out       callback receiving the output the lost client missed
+ * @param     arg       argument given to out
+ * @param     rec       buffer to store the record the lost client missed
+ */
+static int _resume(cmdc_session **session_p, const char *token,
+                   unsigned flags, cmdc_output_fn out, void *arg,
+                   completion *rec) {
+  uint64_t runner;
+  resume rs;
+  int end = 0;
+  if (sscanf(token, "%" SCNu64 "-%" SCNx64 "%n", &runner, &rs.token, &end) !=
+          2 ||
+      token[end] != 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (_create(session_p, flags) == -1) {
+    return -1;
+  }
+  cmdc_session *s = *session_p;
+  rs.clt = (client){.pid = s->pid,
+                    .sid = s->sid,
+                    .flags = flags,
+                    .wd_dev = 0,
+                    .wd_ino = 0};
+
+  char name[PIPE_LEN];
+  snprintf(name, sizeof(name), RESUME_PIPE, (size_t)runner);
+  // no pipe or no reader: the session expired
+  int fl;
+  if ((s->fd_in = open(name, O_WRONLY | O_NONBLOCK | O_CLOEXEC)) == -1 ||
+      (fl = fcntl(s->fd_in, F_GETFL)) == -1 ||
+      fcntl(s->fd_in, F_SETFL, fl & ~O_NONBLOCK) == -1) {
+    if (errno == ENXIO) {
+      errno = ENOENT;
+    }
+    cmdc_close(session_p);
+    return -1;
+  }
+  if (s->rg == NULL && mkfifo(s->pipe_out, S_IRUSR | S_IWUSR) == -1) {
+    cmdc_close(session_p);
+    return -1;
+  }
+  if (_send(s, REQ_RESUME, &rs, sizeof(rs)) == -1 ||
+      _accepted(s, runner, rs.token) == -1 ||
+      _collect(s, out, arg, rec) == -1) {
+    if (s->rg == NULL) {
+      unlink(s->pipe_out);
+    }
+    cmdc_close(session_p);
+    return -1;
+  }
+  return 0;
+}
+
+cmdc_session *cmdc_open(unsigned lane, unsigned flags) {
+  if (lane >= LINKER_LANES) {
+    errno = EINVAL;
+    return NULL;
+  }
+  cmdc_session *s;
+  if (_open(&s, lane, (flags & (CLIENT_RING | CLIENT_PTY)) | CLIENT_NOSIG) ==
+      -1) {
+    return NULL;
+  }
+  return s;
+}
+
+cmdc_session *cmdc_resume(const char *token, unsigned flags,
+                          cmdc_output_fn out, void *arg, completion *rec) {
+  cmdc_session *s;
+  if (_resume(&s, token, (flags & (CLIENT_RING | CLIENT_PTY)) | CLIENT_NOSIG,
+              out, arg, rec) == -1) {
+    return NULL;
+  }
+  return s;
+}
+
+int cmdc_token(cmdc_session *s, char *buf, size_t len) {
+  uint64_t runner, token;
+  slot_session(s->sl, &runner, &token);
+  int n = snprintf(buf, len, "%" PRIu64 "-%016" PRIx64, runner, token);
+  if (n < 0 || (size_t)n >= len) {
+    errno = ERANGE;
+    return -1;
+  }
+  return 0;
+}
+
+int cmdc_run(cmdc_session *s, const char *line, cmdc_output_fn out,
+             void *arg, completion *rec) {
+  return _request(s, REQ_CMD, line, strlen(line), out, arg, rec);
+}
+
+int cmdc_run_argv(cmdc_session *s, char *const argv[], cmdc_output_fn out,
+                  void *arg, completion *rec) {
+  // each word is single quoted, a quote being written '\''
+  char *line = NULL;
+  size_t len = 0, cap = 0;
+  for (size_t i = 0; argv[i] != NULL; i++) {
+    if ((i > 0 && append(&line, &len, &cap, " ", 1) == -1) ||
+        append(&line, &len, &cap, "'", 1) == -1) {
+      free(line);
+      return -1;
+    }
+    for (const char *p = argv[i]; *p != 0; p++) {
+      if ((*p == '\'' ? append(&line, &len, &cap, "'\\''", 4)
+                      : append(&line, &len, &cap, p, 1)) == -1) {
+        free(line);
+        return -1;
+      }
+    }
+    if (append(&line, &len, &cap, "'", 1) == -1) {
+      free(line);
+      return -1;
+    }
+  }
+  if (len == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  int rc = _request(s, REQ_CMD, line, len, out, arg, rec);
+  free(line);
+  return rc;
+}
+
+int cmdc_setenv(cmdc_session *s, const char *name, const char *value) {
+  if (*name == 0 || strchr(name, '=') != NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  char *var = NULL;
+  size_t len = 0, cap = 0;
+  if (append(&var, &len, &cap, name, strlen(name)) == -1 ||
+      (value != NULL && (append(&var, &len, &cap, "=", 1) == -1 ||
+                         append(&var, &len, &cap, value, strlen(value)) ==
+                             -1)) ||
+      append(&var, &len, &cap, "", 1) == -1) {
+    free(var);
+    return -1;
+  }
+  int rc = _send(s, REQ_ENV, var, len);
+  free(var);
+  return rc;
+}
+
+int cmdc_to_fds(void *fds, uint32_t stream, const char *data, size_t len) {
+  const int *fd = fds;
+  return proto_write_full(fd[stream == STREAM_ERR], data, len);
+}
+
+void cmdc_close(cmdc_session **session_p) {
+  cmdc_session *s = *session_p;
+  if (s == NULL) {
+    return;
+  }
+  int err = errno;
+  if (s->fd_in != -1) {
+    // the daemon does not keep the session for a resume
+    _send(s, REQ_BYE, "", 0);
+    close(s->fd_in);
+  } else {
+    // the request pipe is removed once connected
+    char pipe_in[PIPE_LEN];
+    snprintf(pipe_in, sizeof(pipe_in), PIPE_IN, s->pid, s->sid);
+    unlink(pipe_in);
+  }
+  // left by a request cancelled before opening it
+  unlink(s->pipe_out);
+  ring_close(&s->rg, s->ring_name);
+  slot_close(&s->sl, s->slot_name);
+  free(s);
+  *session_p = NULL;
+  errno = err;
+}
+
+static void demux_feed(struct demux *dm, const char *data, size_t len) {
+  while (len > 0) {
+    if (dm->left == 0) {
+      // a header may be split between two reads
+      size_t n = sizeof(dm->hdr) - dm->hdr_len;
+      n = n < len ? n : len;
+      memcpy((char *)&dm->hdr + dm->hdr_len, data, n);
+      dm->hdr_len += n;
+      data += n;
+      len -= n;
+      if (dm->hdr_len == sizeof(dm->hdr)) {
+        dm->hdr_len = 0;
+        dm->left = dm->hdr.len;
+      }
+      continue;
+    }
+    size_t n = dm->left < len ? dm->left : len;
+    if (dm->out != NULL && dm->out(dm->arg, dm->hdr.stream, data, n) == -1) {
+      // the rest is still read to keep the session in step
+      dm->out = NULL;
+    }
+    dm->left -= n;
+    data += n;
+    len -= n;
+  }
+}
+
+static int build_env(char **payload, size_t *len) {
+  char *buf = NULL;
+  size_t blen = 0, bcap = 0;
+  for (char **var = environ; *var != NULL; var++) {
+    if (append(&buf, &blen, &bcap, *var, strlen(*var) + 1) == -1) {
+      free(buf);
+      return -1;
+    }
+  }
+  if (blen > REQ_MAX) {
+    free(buf);
+    return -1;
+  }
+  *payload = buf;
+  *len = blen;
+  return 0;
+}
+
+#ifndef CMDC_LIBRARY
+static cmdc_session *cli_session;
+
+int build_fanout(char *line, char **payload, size_t *len) {
+  fanout fo = {.parallel = 0, .ordered = 0, .ninputs = 0};
+  char *save;
+  char *tok = strtok_r(line, " ", &save);
+
+  // options, until the first word of the template
+  while ((tok = strtok_r(NULL, " ", &save)) != NULL && tok[0] == '-') {
+    if (strcmp(tok, "-k") == 0) {
+      fo.ordered = 1;
+    } else if (strcmp(tok, "-P") == 0 &&
+               (tok = strtok_r(NULL, " ", &save)) != NULL) {
+      char *end;
+      unsigned long p = strtoul(tok, &end, 10);
+      // the daemon runs no more commands at once than it has runners
+      if (end == tok || *end != 0 || p == 0 || p > CAPACITY) {
+        return -1;
+      }
+      fo.parallel = (uint32_t)p;
+    } else {
+      return -1;
+    }
+  }
+
+  char *buf = NULL;
+  size_t blen = 0, bcap = 0;
+  if (append(&buf, &blen, &bcap, (const char *)&fo, sizeof(fo)) == -1) {
+    return -1;
+  }
+
+  // template, words joined by spaces
+  bool first = true;
+  for (; tok != NULL && strcmp(tok, ":::") != 0 && strcmp(tok, "::::") != 0;
+       tok = strtok_r(NULL, " ", &save)) {
+    if ((!first && append(&buf, &blen, &bcap, " ", 1) == -1) ||
+        append(&buf, &blen, &bcap, tok, strlen(tok)) == -1) {
+      free(buf);
+      return -1;
+    }
+    first = false;
+  }
+  if (first || tok == NULL || append(&buf, &blen, &bcap, "", 1) == -1) {
+    free(buf);
+    return -1;
+  }
+
+  if (strcmp(tok, ":::") == 0) {
+    while ((tok = strtok_r(NULL, " ", &save)) != NULL) {
+      if (append(&buf, &blen, &bcap, tok, strlen(tok) + 1) == -1) {
+        free(buf);
+        return -1;
+      }
+      fo.ninputs++;
+    }
+  } else {
+    // inputs are the lines of a file
+    FILE *f;
+    if ((tok = strtok_r(NULL, " ", &save)) == NULL ||
+        (f = fopen(tok, "r")) == NULL) {
+      free(buf);
+      return -1;
+    }
+    char *in = NULL;
+    size_t in_cap = 0;
+    ssize_t r;
+    while ((r = getline(&in, &in_cap, f)) > 0) {
+      if (in[r - 1] == '\n') {
+        in[--r] = 0;
+      }
+      if (r > 0 && append(&buf, &blen, &bcap, in, (size_t)r + 1) == -1) {
+        free(in);
+        fclose(f);
+        free(buf);
+        return -1;
+      }
+      fo.ninputs += r > 0;
+    }
+    free(in);
+    fclose(f);
+  }
+
+  memcpy(buf, &fo, sizeof(fo));
+  *payload = buf;
+  *len = blen;
+  return 0;
+}
+
+int build_env_delta(char *line, char **payload, size_t *len) {
+  char *buf = NULL;
+  size_t blen = 0, bcap = 0;
+  if (strncmp(line, EXPORT " ", strlen(EXPORT) + 1) == 0) {
+    // the value may hold spaces
+    char *var = line + strlen(EXPORT) + 1;
+    char *eq = strchr(var, '=');
+    if (eq == NULL || eq == var ||
+        append(&buf, &blen, &bcap, var, strlen(var) + 1) == -1) {
+      free(buf);
+      return -1;
+    }
+  } else {
+    char *save;
+    char *tok = strtok_r(line, " ", &save);
+    while ((tok = strtok_r(NULL, " ", &save)) != NULL) {
+      if (strchr(tok, '=') != NULL ||
+          append(&buf, &blen, &bcap, tok, strlen(tok) + 1) == -1) {
+        free(buf);
+        return -1;
+      }
+    }
+    if (blen == 0) {
+      return -1;
+    }
+  }
+  *payload = buf;
+  *len = blen;
+  return 0;
+}
+
 /**
  * @function  help
  * @abstract  show heplp and exit
  */
 void help(void) {
   printf("***\nUsage:\n");
-  printf("./cmdc\n");
+  printf("./cmdc [-p lane] [-r token] [-s] [-t] [-v]\n");
+  printf("  -p lane   priority lane, 0 is the most urgent (default %d)\n",
+         LINKER_LANES - 1);
+  printf("  -r token  resume the session of a lost client, given by -v\n");
+  printf("  -s        read the output from shared memory instead of a pipe\n");
+  printf("  -t        run the commands on a terminal: output comes line by "
+         "line\n");
+  printf("  -v        report the status and timings of every command\n");
   printf("CmdC>\ncmd arg1 ... argN\n");
+  printf("%s [-P n] [-k] cmd [{}] args... (::: input... | :::: file)\n",
+         FANOUT);
+  printf("  run cmd once per input, {} being replaced by the input\n");
+  printf("  -P n      run at most n inputs at the same time\n");
+  printf("  -k        keep the input order instead of tagging the lines\n");
+  printf("%s NAME=value | %s NAME...\n", EXPORT, UNSET);
+  printf("  change the environment of the next commands\n");
   exit(EXIT_SUCCESS);
 }
 
 int main(int argc, char **argv) {
-  if (argc > 1) {
+  unsigned lane = LINKER_LANES - 1;
+  unsigned flags = 0;
+  bool verbose = false;
+  const char *token = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "p:r:stv")) != -1) {
+    switch (opt) {
+    case 'p': {
+      char *end;
+      unsigned long l = strtoul(optarg, &end, 10);
+      if (*end != 0 || l >= LINKER_LANES) {
+        help();
+      }
+      lane = (unsigned)l;
+      break;
+    }
+    case 'r':
+      token = optarg;
+      break;
+    case 's':
+      flags |= CLIENT_RING;
+      break;
+    case 't':
+      flags |= CLIENT_PTY;
+      break;
+    case 'v':
+      verbose = true;
+      break;
+    default:
+      help();
+    }
+  }
+  if (optind < argc) {
     help();
-    exit(EXIT_FAILURE);
   }
   setup_signals();
-  pid_t pid = getpid();
-  char wd_buf[WD_LEN] = {0};
-  if (getcwd(wd_buf, WD_LEN) == NULL) {
+  char wd_buf[PATH_MAX] = {0};
+  if (getcwd(wd_buf, sizeof(wd_buf)) == NULL) {
     perror("getcwd");
     exit(EXIT_FAILURE);
   }
 
-  client c;
-  c.pid = pid;
-  strcpy(c.working_dir, wd_buf);
-
-  char pipe_in[PIPE_LEN] = {0};
-  snprintf(pipe_in, sizeof(pipe_in), "/tmp/%d_in", pid);
-  char pipe_out[PIPE_LEN] = {0};
-  snprintf(pipe_out, sizeof(pipe_out), "/tmp/%d_out", pid);
-
-  if (mkfifo(pipe_in, S_IRUSR | S_IWUSR) == -1) {
-    perror("mkfifo");
+  if (atexit(close_session) != 0) {
+    fprintf(stderr, "Error: atexit failed.\n");
     exit(EXIT_FAILURE);
   }
-
-  linker *lp = linker_connect(LINKER_SHM);
-  if (lp == NULL) {
+  int fds[2] = {STDOUT_FILENO, STDERR_FILENO};
+  int status = EXIT_SUCCESS;
+  // the command line client is signaled if it is refused
+  if (token != NULL) {
+    completion rec;
+    if (_resume(&cli_session, token, flags, cmdc_to_fds, fds, &rec) == -1) {
+      perror("Error: Can't resume session");
+      exit(EXIT_FAILURE);
+    }
+    // the lost client missed the end of a request
+    if (rec.queued_ms >= 0) {
+      status = report(&rec, verbose);
+    }
+  } else if (_open(&cli_session, lane, flags) == -1) {
     fprintf(stderr, "Error: Can't connect to server.\n");
     exit(EXIT_FAILURE);
   }
-  if (linker_push(lp, &c) == -1) {
-    fprintf(stderr, "Error: Cant send request.");
-    exit(EXIT_FAILURE);
-  }
-
-  int fd_in = open(pipe_in, O_WRONLY);
-  if (fd_in == -1) {
-    perror("open in");
-    exit(EXIT_FAILURE);
-  }
-
-  if (unlink(pipe_in) == -1) {
-    perror("unlink");
-    exit(EXIT_FAILURE);
+  char token_buf[CMDC_TOKEN_LEN];
+  if (verbose && cmdc_token(cli_session, token_buf, sizeof(token_buf)) == 0) {
+    fprintf(stderr, "[session %s]\n", token_buf);
   }
 
-  struct stat st;
-  if (fstat(fd_in, &st) == -1) {
-    perror("fstat");
-    exit(EXIT_FAILURE);
-  }
-  ssize_t blksize_pipe_in = st.st_blksize;
-
-  char buf_in[blksize_pipe_in];
-
-  printf("%s>\n", c.working_dir);
+  char *line = NULL;
+  size_t line_cap = 0;
+  printf("%s>\n", wd_buf);
   ssize_t r_in;
-  while ((r_in = read(STDIN_FILENO, buf_in, blksize_pipe_in)) > 0) {
-    if (mkfifo(pipe_out, S_IRUSR | S_IWUSR) == -1) {
-      perror("mkfifo");
-      exit(EXIT_FAILURE);
+  while ((r_in = getline(&line, &line_cap, stdin)) > 0) {
+    if (line[r_in - 1] == '\n') {
+      line[--r_in] = 0;
     }
-    if (write(fd_in, buf_in, r_in) == -1) {
-      perror("write");
-      exit(EXIT_FAILURE);
+    if (r_in == 0) {
+      printf("%s>\n", wd_buf);
+      continue;
     }
 
-    int fd_out = open(pipe_out, O_RDONLY);
-    if (fd_out == -1) {
-      perror("open in");
-      exit(EXIT_FAILURE);
+    uint32_t type = REQ_CMD;
+    char *payload = line;
+    size_t len = (size_t)r_in;
+    if (strncmp(line, EXPORT " ", strlen(EXPORT) + 1) == 0 ||
+        strncmp(line, UNSET " ", strlen(UNSET) + 1) == 0) {
+      // no output nor completion record answers it
+      if (build_env_delta(line, &payload, &len) == -1) {
+        fprintf(stderr, "Usage: %s NAME=value | %s NAME...\n", EXPORT, UNSET);
+      } else if (_send(cli_session, REQ_ENV, payload, len) == -1) {
+        perror("write");
+        exit(EXIT_FAILURE);
+      } else {
+        free(payload);
+      }
+      printf("%s>\n", wd_buf);
+      continue;
     }
-    if (unlink(pipe_out) == -1) {
-      perror("unlink");
-      exit(EXIT_FAILURE);
+    if (strncmp(line, FANOUT " ", strlen(FANOUT) + 1) == 0) {
+      type = REQ_FANOUT;
+      if (build_fanout(line, &payload, &len) == -1) {
+        fprintf(stderr, "Usage: %s [-P n] [-k] cmd [{}] args... "
+                        "(::: input... | :::: file)\n",
+                FANOUT);
+        printf("%s>\n", wd_buf);
+        continue;
+      }
     }
-    if (fstat(fd_out, &st) == -1) {
-      perror("fstat");
-      exit(EXIT_FAILURE);
+
+    // the buffered prompt must not come after the output
+    fflush(stdout);
+    completion rec;
+    int rc = _request(cli_session, type, payload, len, cmdc_to_fds, fds, &rec);
+    if (payload != line) {
+      free(payload);
     }
-    ssize_t blksize_pipe_out = st.st_blksize;
-    if (fstat(STDOUT_FILENO, &st) == -1) {
-      perror("fstat");
+    if (rc == -1) {
+      perror("request");
       exit(EXIT_FAILURE);
     }
-    ssize_t blksize_std_out = st.st_blksize;
-
-    char buf_out[blksize_pipe_out];
-
-    ssize_t r_out;
-    while ((r_out = read(fd_out, buf_out, (size_t)blksize_pipe_out)) > 0) {
-      char *b = buf_out;
-      do {
-        ssize_t w = r_out > blksize_std_out ? blksize_std_out : r_out;
-        if ((w = write(STDOUT_FILENO, b, w)) == -1) {
-          perror("write");
-          exit(EXIT_FAILURE);
-        }
+    status = report(&rec, verbose);
+    printf("%s>\n", wd_buf);
+  }
+  free(line);
 
-        r_out -= w;
-        b += w;
+  return status;
+}
 
-      } while (r_out > 0);
+int report(const completion *rec, bool verbose) {
+  if (rec->signal != 0) {
+    fprintf(stderr, "[signal %d: %s]", rec->signal, strsignal(rec->signal));
+  } else if (rec->exit_code != EXIT_SUCCESS || verbose) {
+    fprintf(stderr, "[exit %d]", rec->exit_code);
+  }
+  if (verbose) {
+    fprintf(stderr, " %lldms (queued %lldms) %llu bytes",
+            (long long)rec->run_ms, (long long)rec->queued_ms,
+            (unsigned long long)rec->bytes);
+    if (rec->first_ms >= 0) {
+      fprintf(stderr, ", first after %lldms", (long long)rec->first_ms);
     }
-    if (close(fd_out) == -1) {
-      perror("close");
-      exit(EXIT_FAILURE);
+    if (rec->cpu >= 0) {
+      fprintf(stderr, ", cpu %d", rec->cpu);
+    }
+    if (rec->majflt > 0) {
+      fprintf(stderr, ", %d major faults", rec->majflt);
     }
-    printf("%s>\n", c.working_dir);
   }
-  if (close(fd_in) == -1) {
-    perror("close");
-    exit(EXIT_FAILURE);
+  if (rec->signal != 0 || rec->exit_code != EXIT_SUCCESS || verbose) {
+    fprintf(stderr, "\n");
   }
+  return rec->signal != 0 ? 128 + rec->signal : rec->exit_code;
+}
 
-  return EXIT_SUCCESS;
+void close_session(void) {
+  cmdc_close(&cli_session);
 }
 
 void setup_signals(void) {
@@ -187,3 +1039,4 @@ void handler(int signum) {
   fprintf(stderr, "Wrong signal received [%d].\n", signum);
   exit(EXIT_FAILURE);
 }
+#endif
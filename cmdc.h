@@ -0,0 +1,130 @@
+#ifndef CMDC__H
+#define CMDC__H
+
+#include "tools/linker.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+* @define CMDC_TOKEN_LEN  size of a buffer holding a session token
+*/
+#define CMDC_TOKEN_LEN 40
+
+/**
+* @typedef cmdc_session
+*         a session opened with the daemon, as `cmdc` opens one. A process can
+*         keep many sessions open, each one used by one thread at a time.
+* @field    pid         the process id
+* @field    sid         the session id, unique in the process
+* @field    flags       CLIENT_* options of the session
+* @field    fd_in       the request pipe
+* @field    pipe_out    name of the output pipe
+* @field    rg          the output ring, NULL if the output comes by pipe_out
+* @field    ring_name   name of the ring's shm
+* @field    sl          the completion slot
+* @field    slot_name   name of the slot's shm
+*/
+typedef struct cmdc_session cmdc_session;
+
+/**
+* @typedef cmdc_output_fn
+*         callback receiving the output of a request as it comes
+* @param    arg       the argument given with the callback
+* @param    stream    STREAM_OUT or STREAM_ERR
+* @param    data      a chunk of the stream
+* @param    len       length of the chunk
+* @result   int       0 to go on, -1 to drop the rest of the output
+*/
+typedef int (*cmdc_output_fn)(void *arg, uint32_t stream, const char *data,
+                              size_t len);
+
+/**
+ * @function  cmdc_open
+ * @abstract  open a session with the daemon, the commands running in the
+ *            current working directory and environment. The process is never
+ *            signaled by the daemon.
+ * @param   lane    the priority lane, 0 is the most urgent
+ * @param   flags   CLIENT_RING and CLIENT_PTY options
+ * @result  cmdc_session *  the session, NULL on failure or if the daemon has
+ *                          no runner left (errno EBUSY)
+ */
+extern cmdc_session *cmdc_open(unsigned lane, unsigned flags);
+/**
+ * @function  cmdc_resume
+ * @abstract  take over the session of a lost client, keeping its working
+ *            directory and environment, without waiting for a runner. The
+ *            session of a client that closed it or left RESUME_GRACE_MS ago
+ *            can't be resumed.
+ * @param   token   the token of the session, see cmdc_token
+ * @param   flags   CLIENT_RING and CLIENT_PTY options
+ * @param   out     callback receiving the output the lost client missed
+ * @param   arg     argument given to out
+ * @param   rec     buffer to store how the request the lost client missed
+ *                  ended, queued_ms is -1 if it missed none
+ * @result  cmdc_session *  the session, NULL on failure, errno ENOENT if it
+ *                          expired or ECANCELED if the token is wrong
+ */
+extern cmdc_session *cmdc_resume(const char *token, unsigned flags,
+                                 cmdc_output_fn out, void *arg,
+                                 completion *rec);
+/**
+ * @function  cmdc_token
+ * @abstract  get the token of a session, needed to resume it from another
+ *            process if this one is lost
+ * @param   s       the session
+ * @param   buf     buffer to store the token
+ * @param   len     size of buf, CMDC_TOKEN_LEN is enough
+ * @result  int     0 on success, -1 if buf is too small
+ */
+extern int cmdc_token(cmdc_session *s, char *buf, size_t len);
+/**
+ * @function  cmdc_run
+ * @abstract  run a command line and wait for its end
+ * @param   s       the session
+ * @param   line    the command line, as typed in `cmdc`
+ * @param   out     callback receiving the output, see cmdc_to_fds
+ * @param   arg     argument given to out
+ * @param   rec     buffer to store how the command ended
+ * @result  int     0 on success, -1 if the session is broken or cancelled by
+ *                  the daemon (errno ECANCELED)
+ */
+extern int cmdc_run(cmdc_session *s, const char *line, cmdc_output_fn out,
+                    void *arg, completion *rec);
+/**
+ * @function  cmdc_run_argv
+ * @abstract  run a command given as an argv array, quoted so that it reaches
+ *            the command as is, and wait for its end
+ * @param   s       the session
+ * @param   argv    the command, NULL terminated
+ * @param   out     callback receiving the output, see cmdc_to_fds
+ * @param   arg     argument given to out
+ * @param   rec     buffer to store how the command ended
+ * @result  int     0 on success, -1 on failure
+ */
+extern int cmdc_run_argv(cmdc_session *s, char *const argv[],
+                         cmdc_output_fn out, void *arg, completion *rec);
+/**
+ * @function  cmdc_setenv
+ * @abstract  change a variable of the environment of the next commands
+ * @param   s       the session
+ * @param   name    name of the variable
+ * @param   value   the new value, NULL to unset the variable
+ * @result  int     0 on success, -1 on failure
+ */
+extern int cmdc_setenv(cmdc_session *s, const char *name, const char *value);
+/**
+ * @function  cmdc_to_fds
+ * @abstract  output callback writing each stream to a file descriptor
+ * @param   fds     int[2], the fds of the standard and error outputs
+ */
+extern int cmdc_to_fds(void *fds, uint32_t stream, const char *data,
+                       size_t len);
+/**
+ * @function  cmdc_close
+ * @abstract  end a session and free its resources, the session can't be
+ *            resumed afterwards
+ * @param   session_p   a pointer to the session's pointer
+ */
+extern void cmdc_close(cmdc_session **session_p);
+
+#endif
@@ -1,19 +1,38 @@
+#define _GNU_SOURCE
+#include "tools/capture.h"
+#include "tools/cgroup.h"
+#include "tools/cmdline.h"
 #include "tools/config.h"
+#include "tools/env.h"
+#include "tools/handover.h"
+#include "tools/history.h"
 #include "tools/linker.h"
+#include "tools/prewarm.h"
+#include "tools/proto.h"
+#include "tools/runq.h"
+#include "tools/spool.h"
+#include "tools/topo.h"
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
 #include <pthread.h>
 #include <semaphore.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/random.h>
 #include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/syslog.h>
 #include <sys/wait.h>
+#include <termios.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -38,6 +57,241 @@
 #define STOP "stop"
 #endif
 
+/**
+ * #define  RESTART           string "restart", followed by the options of
+ *                            start
+ */
+#ifndef RESTART
+#define RESTART "restart"
+#endif
+
+/**
+ * #define  DRAIN             string "drain", optionally followed by the
+ *                            seconds left to the commands running
+ */
+#ifndef DRAIN
+#define DRAIN "drain"
+#endif
+
+/**
+ * #define  STATS             string "stats"
+ */
+#ifndef STATS
+#define STATS "stats"
+#endif
+
+/**
+ * #define  WEIGHTED          string "weighted", option of start
+ */
+#ifndef WEIGHTED
+#define WEIGHTED "weighted"
+#endif
+
+/**
+ * #define  CAPTURE           string "capture", option of start followed by
+ *                            the file recording the sessions
+ */
+#ifndef CAPTURE
+#define CAPTURE "capture"
+#endif
+
+/**
+ * #define  SHARDS            string "shards", option of start followed by the
+ *                            number of daemon processes
+ */
+#ifndef SHARDS
+#define SHARDS "shards"
+#endif
+
+/**
+ * #define  NUMA              string "numa", option of start binding each shard
+ *                            to the CPUs of a NUMA node in turn
+ */
+#ifndef NUMA
+#define NUMA "numa"
+#endif
+
+/**
+ * #define  PIN               string "pin", option of start pinning each runner
+ *                            to a CPU of its shard, its commands inheriting it
+ */
+#ifndef PIN
+#define PIN "pin"
+#endif
+
+/**
+ * #define  SPREAD            string "spread", option of start pinning each
+ *                            command to the next CPU of the shard in turn
+ */
+#ifndef SPREAD
+#define SPREAD "spread"
+#endif
+
+/**
+ * #define  MEMBIND           string "membind", option of start binding the
+ *                            memory of each runner and of its commands to the
+ *                            NUMA node it runs on
+ */
+#ifndef MEMBIND
+#define MEMBIND "membind"
+#endif
+
+/**
+ * #define  PREWARM           string "prewarm", option of start keeping the
+ *                            binaries run the most in the page cache
+ */
+#ifndef PREWARM
+#define PREWARM "prewarm"
+#endif
+
+/**
+ * #define  MLOCK             string "mlock", option of start also locking
+ *                            them in memory, up to PREWARM_LOCK_BYTES
+ */
+#ifndef MLOCK
+#define MLOCK "mlock"
+#endif
+
+/**
+ * #define  CGROUP            string "cgroup", option of start running the
+ *                            commands of each session in a cgroup of its own,
+ *                            under the cgroup the daemon is started in
+ */
+#ifndef CGROUP
+#define CGROUP "cgroup"
+#endif
+
+/**
+ * #define  WEIGHT            string "weight", option of start followed by the
+ *                            cpu.weight of each session, implies cgroup
+ */
+#ifndef WEIGHT
+#define WEIGHT "weight"
+#endif
+
+/**
+ * #define  MEMORY            string "memory", option of start followed by the
+ *                            memory.max of each session, implies cgroup
+ */
+#ifndef MEMORY
+#define MEMORY "memory"
+#endif
+
+/**
+ * #define  PIDS              string "pids", option of start followed by the
+ *                            pids.max of each session, implies cgroup
+ */
+#ifndef PIDS
+#define PIDS "pids"
+#endif
+
+/**
+ * @define  HANDOVER_SOCK     format of the path of the socket through which
+ *                            a shard of a restarted daemon takes the sessions
+ *                            of the daemon it replaces, from the shard
+ */
+#ifndef HANDOVER_SOCK
+#define HANDOVER_SOCK "/tmp/cmds_handover_%u"
+#endif
+
+/**
+ * @define  SIG_DRAIN         signal asking the daemon to drain then stop, its
+ *                            value being the deadline in ms if queued
+ */
+#ifndef SIG_DRAIN
+#define SIG_DRAIN SIGINT
+#endif
+
+/**
+ * @define  SIG_HANDOVER      signal asking the daemon to drain into the
+ *                            daemon replacing it
+ */
+#ifndef SIG_HANDOVER
+#define SIG_HANDOVER SIGHUP
+#endif
+
+/**
+ * @define  DRAIN_TIMEOUT_MS  milliseconds a draining daemon waits for its
+ *                            commands before stopping them
+ */
+#ifndef DRAIN_TIMEOUT_MS
+#define DRAIN_TIMEOUT_MS 30000
+#endif
+
+/**
+ * @define  DRAIN_POLL_MS     time between two checks of the runners left to
+ *                            a draining daemon
+ */
+#ifndef DRAIN_POLL_MS
+#define DRAIN_POLL_MS 100
+#endif
+
+/**
+ * @define  POP_CHECK_MS      longest wait for a client before checking
+ *                            whether the daemon drains, the signal may come
+ *                            just before the wait
+ */
+#ifndef POP_CHECK_MS
+#define POP_CHECK_MS 1000
+#endif
+
+/**
+ * @define  WAIT_DRAIN        returned by wait_request when the daemon drains
+ */
+#define WAIT_DRAIN -2
+
+/**
+ * @define  FANOUT_MARK       placeholder replaced by the input in a fan-out
+ *                            template
+ */
+#ifndef FANOUT_MARK
+#define FANOUT_MARK "{}"
+#endif
+
+/**
+ * @define  FANOUT_CHUNK      growth of the output buffer of a fan-out input
+ */
+#ifndef FANOUT_CHUNK
+#define FANOUT_CHUNK 4096
+#endif
+
+/**
+ * @define  FANOUT_RETRY_MS   delay before asking again for an execution slot
+ *                            while a fan-out has inputs left to start
+ */
+#ifndef FANOUT_RETRY_MS
+#define FANOUT_RETRY_MS 20
+#endif
+
+/**
+ * @define  SPOOL_CHUNK       bytes moved at once from a command to its client
+ */
+#ifndef SPOOL_CHUNK
+#define SPOOL_CHUNK 65536
+#endif
+
+/**
+ * @define  RING_RETRY_MS     time between two checks for room in a full
+ *                            output ring
+ */
+#ifndef RING_RETRY_MS
+#define RING_RETRY_MS 10
+#endif
+
+/**
+ * @define  CMD_ERROR         exit status of a request the daemon can't run
+ */
+#ifndef CMD_ERROR
+#define CMD_ERROR 2
+#endif
+
+/**
+ * @define  EXEC_ERROR        exit status of a command that can't be executed
+ */
+#ifndef EXEC_ERROR
+#define EXEC_ERROR 127
+#endif
+
 #define TESTOPT(opt) strcmp(opt, argv[1]) == 0
 
 /**
@@ -49,6 +303,35 @@
  * @field     th        allocated thread
  * @field     running   is this runner working?
  * @field     start_t   time runner start working
+ * @field     pipe_out  name of the pipe answering the client
+ * @field     rg        output ring of the client, NULL if it reads pipe_out
+ * @field     fd_out    pipe_out once opened, -1 otherwise
+ * @field     reading   is the client reading the current output?
+ * @field     out_bytes bytes of output of the current request
+ * @field     first_t   time of the first byte of output of the current request
+ * @field     sl        completion slot of the client
+ * @field     wd_fd     O_PATH descriptor of the client working directory
+ * @field     env       environment of the session, NULL until the client
+ *                      sends it
+ * @field     token     secret given to the client to resume the session
+ * @field     lost      did the client stop reading the current output?
+ * @field     held      output of the last request the client lost, kept for
+ *                      a resume
+ * @field     last      completion record of the last request
+ * @field     parked    is the session waiting for its lost client?
+ * @field     lost_t    time the session was parked
+ * @field     cap_id    number of the session in the capture, 0 if it is not
+ *                      captured
+ * @field     cpu       CPU the last command of the current request ran on
+ *                      last, -1 if unknown
+ * @field     majflt    major page faults of the commands of the current
+ *                      request, -1 if unknown
+ * @field     cg_fd     cgroup.procs of the cgroup of the sessions of the
+ *                      runner, -1 without cgroups
+ * @field     fd_in     request pipe of a session handed over by a previous
+ *                      daemon, until its runner starts
+ * @field     fd_resume resume pipe of a session handed over by a previous
+ *                      daemon, until its runner starts
  */
 struct runner {
   size_t id;
@@ -56,6 +339,71 @@ struct runner {
   pthread_t th;
   bool running;
   struct timespec start_t;
+  char pipe_out[PIPE_LEN];
+  ring *rg;
+  int fd_out;
+  bool reading;
+  size_t out_bytes;
+  struct timespec first_t;
+  slot *sl;
+  int wd_fd;
+  env *env;
+  uint64_t token;
+  bool lost;
+  spool *held;
+  completion last;
+  bool parked;
+  struct timespec lost_t;
+  uint32_t cap_id;
+  int cpu;
+  long majflt;
+  int cg_fd;
+  int fd_in;
+  int fd_resume;
+};
+
+/**
+ * @enum   drain_mode
+ *         how the daemon stops taking clients
+ * @const  DRAIN_NONE      it takes clients
+ * @const  DRAIN_STOP      it stops once its sessions end
+ * @const  DRAIN_HANDOVER  it hands its sessions over to the daemon replacing
+ *                         it, then stops
+ */
+enum drain_mode { DRAIN_NONE, DRAIN_STOP, DRAIN_HANDOVER };
+
+/**
+ * @struct    handed
+ * @abstract  session handed over to the daemon replacing this one, followed
+ *            by the entries of its environment. The working directory, the
+ *            request pipe and the resume pipe of the session come along as
+ *            descriptors, in this order, for those it has.
+ *
+ * @field     clt       the client
+ * @field     id        id of the runner, naming the resume pipe
+ * @field     token     secret of the session
+ * @field     last      completion record of the last request
+ * @field     start_t   time the session started
+ * @field     lost_t    time the session was parked
+ * @field     parked    is the session waiting for its lost client?
+ * @field     held      did the client lose the output of its last request?
+ *                      The output is not handed over.
+ * @field     has_env   did the client send an environment?
+ * @field     has_in    is the request pipe handed over?
+ * @field     has_resume  is the resume pipe handed over?
+ */
+struct handed {
+  client clt;
+  size_t id;
+  uint64_t token;
+  completion last;
+  struct timespec start_t;
+  struct timespec lost_t;
+  bool parked;
+  bool held;
+  bool has_env;
+  bool has_in;
+  bool has_resume;
 };
 
 /* Functions declarations */
@@ -74,20 +422,12 @@ void quit(const char *fmt, ...);
  */
 void cleanup(void);
 /**
- * @function  count_args
- * @abstract  count words in a string separated by ' '
- * @param     str       the string in which the function will count words
- * @result    size_t    the number of word(s)
- */
-size_t count_args(const char *str);
-/**
- * @function  fmt_args
- * @abstract  put a sliced version of the string str in argv
- * @param     str       the string to slice !Not modified
- * @param     argv      the array buffer in which we place words
- * @param     buf       buffer used to keep words separated by null char
+ * @function  diff_ms
+ * @abstract  milliseconds elapsed between two times
+ * @param     start     the first time
+ * @param     end       the second time
  */
-void fmt_args(const char *str, char *argv[], char *buf);
+long diff_ms(const struct timespec *start, const struct timespec *end);
 
 // daemon handling
 /**
@@ -117,8 +457,81 @@ void create_daemon(pid_t ppid);
  * @param     starter_pid    the starter process pid
  */
 void daemon_main(pid_t starter_pid);
+/**
+ * @function  start_shards
+ * @abstract  Create the linker of every shard, then fork a process for each
+ *            shard but the first one, run by the daemon itself
+ * @param     starter_pid    the starter process pid
+ */
+void start_shards(pid_t starter_pid);
+/**
+ * @function  delegate_cgroups
+ * @abstract  Move the daemon to its cgroup under the subtree delegated to it,
+ *            that of the daemon it replaces on a restart, and keep the limits
+ *            of the controllers available
+ * @param     starter_pid    the starter process pid
+ */
+void delegate_cgroups(pid_t starter_pid);
+/**
+ * @function  cancel
+ * @abstract  Tell a client its session is refused or over: SIG_FAILURE, or a
+ *            cancelled completion record for a CLIENT_NOSIG client
+ * @param     c       the client
+ * @param     r       the runner of the client, NULL if it has none
+ */
+void cancel(const client *c, struct runner *r);
+/**
+ * @function  forget_client
+ * @abstract  Remove the shm of a lost client if its process is dead, as it
+ *            could not remove them itself
+ * @param     c       the client
+ */
+void forget_client(const client *c);
+/**
+ * @function  capture_arrival
+ * @abstract  Record the arrival of a client in the capture, if any
+ * @param     c       the client
+ * @param     lane    the priority lane of the client
+ * @result    uint32_t  the number of the session in the capture, 0 if it is
+ *                      not captured
+ */
+uint32_t capture_arrival(const client *c, int lane);
+/**
+ * @function  print_stats
+ * @abstract  Print the metrics of each priority lane of the running daemon
+ */
+void print_stats(void);
+/**
+ * @function  print_binaries
+ * @abstract  print the binaries a shard runs the most, how often they were
+ *            read from the disk and how much of them is cached
+ * @param     s     the shard
+ */
+void print_binaries(unsigned s);
+/**
+ * @function  print_cgroups
+ * @abstract  print the usage and the pressure stall information of the
+ *            cgroups of the sessions, if the daemon runs with cgroups
+ */
+void print_cgroups(void);
+/**
+ * @function  print_cgroup
+ * @abstract  print a line of print_cgroups
+ * @param     name  the name shown
+ * @param     dir   the directory of the cgroup
+ */
+void print_cgroup(const char *name, const char *dir);
 
 // Threads related
+/**
+ * @function  create_th
+ * @abstract  create a detached thread, drain signals being left to the main
+ *            thread
+ * @param     th        buffer to store the thread
+ * @param     routine   the routine of the thread
+ * @param     arg       the argument of the routine
+ */
+void create_th(pthread_t *th, void *(*routine)(void *), void *arg);
 /**
  * @function  start_th
  * @abstract  Start the ith thread in the runner_pool binding it to the client c
@@ -132,6 +545,280 @@ void start_th(size_t i, client c);
  * @param     r       the runner associated to the thread
  */
 void *runner_routine(struct runner *r);
+/**
+ * @function  adopt_routine
+ * @abstract  routine of a runner serving a session handed over by a previous
+ *            daemon
+ * @param     r         the runner, holding the session
+ */
+void *adopt_routine(struct runner *r);
+/**
+ * @function  serve_session
+ * @abstract  serve the requests of a session until it ends, then free the
+ *            runner
+ * @param     r         the runner, its client connected
+ * @param     fd_in     the request pipe, -1 if the client is lost
+ * @param     fd_resume the resume pipe, -1 if the session can't be resumed
+ */
+void serve_session(struct runner *r, int fd_in, int fd_resume);
+/**
+ * @function  place_runner
+ * @abstract  pin a runner to its CPU and memory, as the start options ask
+ * @param     r         the runner
+ */
+void place_runner(struct runner *r);
+/**
+ * @function  wait_client
+ * @abstract  Wait for the first request of a client on its request pipe,
+ *            opened non blocking, then make the pipe blocking
+ * @param     fd_in   the request pipe
+ * @result    int     0 on success, -1 on failure
+ */
+int wait_client(int fd_in);
+/**
+ * @function  open_resume
+ * @abstract  Create the RESUME_PIPE of a session, writable by the user of the
+ *            daemon only, and open it without blocking
+ * @param     r       the runner
+ * @result    int     the pipe, -1 on failure
+ */
+int open_resume(struct runner *r);
+/**
+ * @function  recv_resume
+ * @abstract  Read a REQ_RESUME from the RESUME_PIPE, giving up on a writer
+ *            that does not write it whole within RESUME_READ_MS
+ * @param     fd      the RESUME_PIPE
+ * @param     rs      buffer to store the payload
+ * @result    int     1 on success, 0 if the writer left without writing,
+ *                    -1 on a partial or malformed request
+ */
+int recv_resume(int fd, resume *rs);
+/**
+ * @function  drain_runners
+ * @abstract  wait for the runners to end or hand their sessions over, at most
+ *            until the drain deadline
+ */
+void drain_runners(void);
+/**
+ * @function  hand_over
+ * @abstract  send an idle session to the shard of the daemon replacing this
+ *            one
+ * @param     r         the runner of the session
+ * @param     fd_in     the request pipe, -1 if the client is lost
+ * @param     fd_resume the resume pipe, -1 if the session can't be resumed
+ * @result    bool      was the session taken over? The caller then closes
+ *                      its pipes without ending the session.
+ */
+bool hand_over(struct runner *r, int fd_in, int fd_resume);
+/**
+ * @function  handover_routine
+ * @abstract  routine of the thread taking over the sessions of the daemon
+ *            this one replaces
+ * @param     arg       unused
+ */
+void *handover_routine(void *arg);
+/**
+ * @function  adopt
+ * @abstract  start a runner on a session handed over
+ * @param     h         the session
+ * @param     vars      the entries of its environment
+ * @param     vars_len  length of vars
+ * @param     fds       its descriptors, left to the caller on failure
+ * @param     nfds      number of descriptors
+ * @result    bool      was a runner started?
+ */
+bool adopt(const struct handed *h, const char *vars, size_t vars_len,
+           const int *fds, size_t nfds);
+/**
+ * @function  wait_request
+ * @abstract  Wait for a request of the client or for a client resuming the
+ *            session. A client leaving without REQ_BYE parks the session for
+ *            RESUME_GRACE_MS.
+ * @param     r         the runner
+ * @param     fd_in     the request pipe, -1 once the client is lost
+ * @param     fd_resume the RESUME_PIPE, -1 if the session can't be resumed
+ * @result    int       the pipe to read, -1 if the session is over,
+ *                      WAIT_DRAIN if the daemon drains
+ */
+int wait_request(struct runner *r, int *fd_in, int *fd_resume);
+/**
+ * @function  refuse_resume
+ * @abstract  Cancel a client that asked to resume a session that is over,
+ *            if it presented the token of the session
+ * @param     r         the runner
+ * @param     fd_resume the RESUME_PIPE, already unlinked
+ */
+void refuse_resume(struct runner *r, int fd_resume);
+/**
+ * @function  resume_session
+ * @abstract  Hand the session over to the client of a REQ_RESUME presenting
+ *            its token, then send it what its previous client lost. The
+ *            resume pipe becomes its request pipe.
+ * @param     r         the runner
+ * @param     fd_in     the request pipe, replaced by the resume pipe
+ * @param     fd_resume the RESUME_PIPE, replaced by a new one
+ * @param     rs        the REQ_RESUME payload, none of its fields being
+ *                      trusted before its token is checked
+ * @result    bool      false if the session was not resumed
+ */
+bool resume_session(struct runner *r, int *fd_in, int *fd_resume,
+                    const resume *rs);
+/**
+ * @function  run_cmd
+ * @abstract  Execute a command line for the client of a runner
+ * @param     r       the runner
+ * @param     cmd     the command line
+ * @result    bool    false if the client must be disconnected
+ */
+bool run_cmd(struct runner *r, char *cmd);
+/**
+ * @function  complete
+ * @abstract  Post the completion record of a request to the client, once its
+ *            output ended
+ * @param     r       the runner
+ * @param     status  wait status of the request
+ * @param     times   receipt, start and end of the request, NULL if it never
+ *                    started
+ */
+void complete(struct runner *r, int status, const struct timespec *times);
+/**
+ * @function  record_binaries
+ * @abstract  Count the binaries the commands of a request were run from, as
+ *            resolved in the PATH of the session
+ * @param     r       the runner
+ * @param     cl      the request
+ * @param     majflt  major page faults of each command, -1 if unknown
+ * @param     ms      runtime of the request, only kept for a single command
+ */
+void record_binaries(struct runner *r, const cmdline *cl, const long *majflt,
+                     long ms);
+/**
+ * @function  run_fanout
+ * @abstract  Execute a command template once per input, spreading the inputs
+ *            over the execution pool
+ * @param     r       the runner
+ * @param     payload the REQ_FANOUT payload
+ * @param     len     length of the payload
+ * @result    bool    false if the client must be disconnected
+ */
+bool run_fanout(struct runner *r, char *payload, size_t len);
+/**
+ * @function  spawn
+ * @abstract  Fork and exec a command in the client working directory, with
+ *            the session environment once the client sent it
+ * @param     r       the runner
+ * @param     argv    the command, NULL terminated
+ * @param     fd_in   fd given as stdin to the command, -1 to keep the daemon's
+ * @param     fd_out  fd given as stdout to the command, -1 to keep the
+ *                    daemon's
+ * @param     fd_err  fd given as stderr to the command, -1 to keep the
+ *                    daemon's
+ * @result    pid_t   the child pid, -1 on failure
+ */
+pid_t spawn(struct runner *r, char *argv[], int fd_in, int fd_out,
+            int fd_err);
+/**
+ * @function  open_wd
+ * @abstract  Open the working directory of the client once for the session,
+ *            through /proc so that it is not resolved again for each command
+ *            and survives a rename
+ * @param     r       the runner
+ * @result    int     an O_PATH descriptor of the directory, -1 on failure or
+ *                    if it is not the directory announced by the client
+ */
+int open_wd(struct runner *r);
+/**
+ * @function  open_redirect
+ * @abstract  Open the target of a redirection, relative to the client
+ *            working directory
+ * @param     r       the runner
+ * @param     path    the target
+ * @param     append  append to the target instead of truncating it
+ * @param     size    buffer to store the size of the target once opened
+ * @result    int     the file descriptor, -1 on failure
+ */
+int open_redirect(struct runner *r, const char *path, bool append,
+                  off_t *size);
+/**
+ * @function  close_redirects
+ * @abstract  Close the redirections of a pipeline
+ * @param     n       number of commands in the pipeline
+ * @param     redir   stdout and stderr redirections of each command, -1 if none
+ */
+void close_redirects(size_t n, int redir[][2]);
+/**
+ * @function  open_stdout
+ * @abstract  Create the channel carrying the output of a command to the
+ *            runner: a pseudo terminal in raw mode if the client asked for
+ *            one, so that the command flushes each line, a pipe otherwise
+ * @param     r       the runner
+ * @param     fds     buffer to store the end read by the runner then the end
+ *                    given to the command, both close on exec
+ * @result    int     0 on success, -1 on failure
+ */
+int open_stdout(struct runner *r, int fds[2]);
+/**
+ * @function  open_output
+ * @abstract  Start sending an output to the client: open its output pipe,
+ *            non blocking once opened, nothing to open for a ring
+ * @param     r       the runner
+ * @result    int     0 on success, -1 if the client can't be reached
+ */
+int open_output(struct runner *r);
+/**
+ * @function  pump
+ * @abstract  Move the output available on in to the client, spooling what
+ *            the client can't take right away
+ * @param     r       the runner
+ * @param     sp      the spool of the command
+ * @param     in      the output of the command
+ * @param     stream  the stream_id of in
+ * @result    ssize_t number of bytes moved, 0 at end of file, -1 on failure
+ */
+ssize_t pump(struct runner *r, spool *sp, int in, uint32_t stream);
+/**
+ * @function  put_frame
+ * @abstract  Spool a chunk of output for the client, preceded by its frame
+ *            header
+ * @param     sp      the spool of the request
+ * @param     stream  the stream_id of the chunk
+ * @param     data    the chunk, NULL to spool only the header, the caller
+ *                    spooling the len bytes of the chunk itself
+ * @param     len     length of the chunk
+ * @result    int     0 on success, -1 on failure
+ */
+int put_frame(spool *sp, uint32_t stream, const void *data, size_t len);
+/**
+ * @function  count_output
+ * @abstract  Account bytes of output of the current request, timing the first
+ *            one
+ * @param     r       the runner
+ * @param     n       number of bytes
+ */
+void count_output(struct runner *r, size_t n);
+/**
+ * @function  forward
+ * @abstract  Send the client as much spooled output as it takes right away
+ * @param     r       the runner
+ * @param     sp      the spool of the command
+ */
+void forward(struct runner *r, spool *sp);
+/**
+ * @function  drain
+ * @abstract  Wait for the client to read all the spooled output, then mark
+ *            the end of the output
+ * @param     r       the runner
+ * @param     sp      the spool of the command
+ */
+void drain(struct runner *r, spool *sp);
+/**
+ * @function  reply
+ * @abstract  Send a message to the client through its output pipe
+ * @param     r       the runner
+ * @param     fmt     format of the message
+ * @param     ...     args associated to the format
+ */
+void reply(struct runner *r, const char *fmt, ...);
 
 // Signal Handler
 /**
@@ -140,11 +827,49 @@ void *runner_routine(struct runner *r);
  * @param     signum    signal received
  */
 void handler(int signum);
+/**
+ * @function  drain_handler
+ * @abstract  handle SIG_DRAIN and SIG_HANDOVER, passing them on to the other
+ *            shards
+ * @param     signum    signal received
+ * @param     info      its value, the deadline in ms if it was queued
+ * @param     ctx       unused
+ */
+void drain_handler(int signum, siginfo_t *info, void *ctx);
 
 /* Global scoped variables */
 
 static struct runner *runner_pool;
 static linker *lin;
+static history *hist;
+static prewarm *pw;
+static bool prewarm_on;
+static size_t prewarm_lock;
+static bool use_cgroups;
+static char cg_base[PATH_MAX];
+static cgroup_limits cg_limits = {.cpu_weight = CGROUP_CPU_WEIGHT,
+                                  .memory_max = CGROUP_MEMORY_MAX,
+                                  .pids_max = CGROUP_PIDS_MAX};
+static runq *exec_runq;
+static size_t exec_slots;
+static enum linker_policy policy = LINKER_STRICT;
+static capture *cap;
+static unsigned nshards = 1;
+static unsigned shard;
+static bool numa;
+static pid_t shard_pids[SHARDS_MAX];
+static bool pin_runners;
+static bool spread_cmds;
+static bool bind_memory;
+static atomic_uint spread_next;
+static pid_t daemon_pid;
+static pid_t old_daemon;
+static size_t id_base;
+static int handover_sock = -1;
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static volatile sig_atomic_t drain_mode = DRAIN_NONE;
+static volatile sig_atomic_t drain_ms = DRAIN_TIMEOUT_MS;
+static int drain_pipe[2] = {-1, -1};
 
 // MAIN
 /**
@@ -153,12 +878,16 @@ static linker *lin;
  */
 void help(void) {
   printf("***\nUsage:\n");
-  printf("./cmds [start|stop]\n");
+  printf("./cmds [start [strict|weighted] [capture FILE] [shards N [numa]]"
+         " [pin] [spread] [membind] [prewarm] [mlock] [cgroup] [weight N]"
+         " [memory BYTES] [pids N]|restart [OPTIONS]|drain [SECONDS]|stop"
+         "|stats]\n");
   exit(EXIT_SUCCESS);
 }
 
 int main(int argc, char **argv) {
-  if (argc < 2 || !(TESTOPT(START) || TESTOPT(STOP))) {
+  if (argc < 2 || !(TESTOPT(START) || TESTOPT(RESTART) || TESTOPT(DRAIN) ||
+                    TESTOPT(STOP) || TESTOPT(STATS))) {
     help();
   }
 
@@ -182,6 +911,98 @@ int main(int argc, char **argv) {
       exit(EXIT_FAILURE);
     }
     exit(EXIT_SUCCESS);
+  } else if (TESTOPT(STATS)) {
+    if (!running) {
+      fprintf(stderr, "Error: Server is not running.\n");
+      exit(EXIT_FAILURE);
+    }
+    print_stats();
+    exit(EXIT_SUCCESS);
+  } else if (TESTOPT(DRAIN)) {
+    if (!running) {
+      fprintf(stderr, "Error: Server is not running.\n");
+      exit(EXIT_FAILURE);
+    }
+    union sigval deadline = {.sival_int = DRAIN_TIMEOUT_MS};
+    if (argc > 2) {
+      char *end;
+      long sec = strtol(argv[2], &end, 10);
+      if (*end != 0 || sec <= 0 || sec > INT_MAX / 1000) {
+        help();
+      }
+      deadline.sival_int = (int)sec * 1000;
+    }
+    pid_t pid;
+    if ((pid = get_dpid()) == -1) {
+      fprintf(stderr, "Can't get daemon pid\n");
+      exit(EXIT_FAILURE);
+    }
+    if (sigqueue(pid, SIG_DRAIN, deadline) == -1) {
+      perror("sigqueue");
+      exit(EXIT_FAILURE);
+    }
+    // the daemon removes its pid once drained
+    struct timespec pause = {.tv_sec = 0, .tv_nsec = DRAIN_POLL_MS * 1000000L};
+    while (isRunning() && kill(pid, 0) == 0) {
+      nanosleep(&pause, NULL);
+    }
+    exit(EXIT_SUCCESS);
+  } else if (TESTOPT(RESTART)) {
+    if (!running) {
+      fprintf(stderr, "Error: Server is not running.\n");
+      exit(EXIT_FAILURE);
+    }
+    if ((old_daemon = get_dpid()) == -1) {
+      fprintf(stderr, "Can't get daemon pid\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  const char *cap_path = NULL;
+  for (int i = 2; i < argc; i++) {
+    if (strcmp(argv[i], WEIGHTED) == 0) {
+      policy = LINKER_WEIGHTED;
+    } else if (strcmp(argv[i], CAPTURE) == 0 && i + 1 < argc) {
+      cap_path = argv[++i];
+    } else if (strcmp(argv[i], SHARDS) == 0 && i + 1 < argc) {
+      if (old_daemon != 0) {
+        fprintf(stderr, "Error: A restart keeps the shards of the daemon.\n");
+        exit(EXIT_FAILURE);
+      }
+      char *end;
+      unsigned long n = strtoul(argv[++i], &end, 10);
+      if (*end != 0 || n == 0 || n > SHARDS_MAX) {
+        help();
+      }
+      nshards = (unsigned)n;
+    } else if (strcmp(argv[i], NUMA) == 0) {
+      numa = true;
+    } else if (strcmp(argv[i], PIN) == 0) {
+      pin_runners = true;
+    } else if (strcmp(argv[i], SPREAD) == 0) {
+      spread_cmds = true;
+    } else if (strcmp(argv[i], MEMBIND) == 0) {
+      bind_memory = true;
+    } else if (strcmp(argv[i], PREWARM) == 0) {
+      prewarm_on = true;
+    } else if (strcmp(argv[i], MLOCK) == 0) {
+      prewarm_on = true;
+      prewarm_lock = PREWARM_LOCK_BYTES;
+    } else if (strcmp(argv[i], CGROUP) == 0) {
+      use_cgroups = true;
+    } else if (strcmp(argv[i], WEIGHT) == 0 && i + 1 < argc) {
+      // the kernel checks the values when the cgroups are created
+      use_cgroups = true;
+      cg_limits.cpu_weight = argv[++i];
+    } else if (strcmp(argv[i], MEMORY) == 0 && i + 1 < argc) {
+      use_cgroups = true;
+      cg_limits.memory_max = argv[++i];
+    } else if (strcmp(argv[i], PIDS) == 0 && i + 1 < argc) {
+      use_cgroups = true;
+      cg_limits.pids_max = argv[++i];
+    } else if (strcmp(argv[i], "strict") != 0) {
+      help();
+    }
   }
 
   // Open logger
@@ -195,6 +1016,11 @@ int main(int argc, char **argv) {
       break;
     }
   }
+  // opened before the daemon leaves the current directory
+  if (cap_path != NULL && (cap = capture_open(cap_path)) == NULL) {
+    fprintf(stderr, "Error: Can't open capture [%s].\n", cap_path);
+    exit(EXIT_FAILURE);
+  }
   // ignore all signals
   sigset_t set;
   if (sigfillset(&set) == -1) {
@@ -242,12 +1068,18 @@ int main(int argc, char **argv) {
 // AUXILIARY FUNCS
 
 bool isRunning(void) {
-  return shm_open(DAEMON_PID_SHM, O_RDONLY, S_IRUSR) != -1;
+  int shm_fd = shm_open(DAEMON_PID_SHM, O_RDONLY, S_IRUSR);
+  if (shm_fd == -1) {
+    return false;
+  }
+  close(shm_fd);
+  return true;
 }
 
 pid_t store_dpid(void) {
-  int shm_fd =
-      shm_open(DAEMON_PID_SHM, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+  // a restarted daemon takes the pid over
+  int flags = O_RDWR | O_CREAT | (old_daemon != 0 ? 0 : O_EXCL);
+  int shm_fd = shm_open(DAEMON_PID_SHM, flags, S_IRUSR | S_IWUSR);
   if (shm_fd == -1) {
     return -1;
   }
@@ -339,7 +1171,9 @@ void create_daemon(pid_t ppid) {
       }
       quit("close");
     }
-    if (store_dpid() == -1) {
+    daemon_pid = getpid();
+    // the daemon replaced keeps its pid until this one is ready
+    if (old_daemon == 0 && store_dpid() == -1) {
       if (kill(ppid, SIG_FAILURE) == -1) {
         quit("kill");
       }
@@ -390,22 +1224,70 @@ void create_daemon(pid_t ppid) {
 }
 
 void cleanup(void) {
+  // a daemon handing over, or whose restart failed, leaves the linkers and
+  // the pid to the other daemon
+  bool owner = drain_mode != DRAIN_HANDOVER &&
+               (old_daemon == 0 || get_dpid() == daemon_pid);
   if (runner_pool != NULL) {
     for (size_t i = 0; i < CAPACITY; i++) {
       struct runner rnr = runner_pool[i];
       if (rnr.running) {
         pthread_cancel(rnr.th);
         pthread_join(rnr.th, NULL);
-        kill(rnr.clt.pid, SIG_FAILURE);
+        char name[PIPE_LEN];
+        snprintf(name, sizeof(name), RESUME_PIPE, rnr.id);
+        unlink(name);
+        // the client of a parked session is gone
+        if (!runner_pool[i].parked) {
+          cancel(&rnr.clt, &runner_pool[i]);
+        }
         syslog(LOG_INFO, "[cmds] - Killed client[%d]", rnr.clt.pid);
       }
+      // a cgroup still holding commands left behind stays
+      if (rnr.cg_fd != -1) {
+        close(rnr.cg_fd);
+        cgroup_remove(cg_base, rnr.id);
+      }
     }
   }
   closelog();
-  if (lin != NULL) {
-    linker_dispose(&lin);
+  if (hist != NULL) {
+    history_close(&hist);
+  }
+  if (pw != NULL) {
+    prewarm_close(&pw);
+  }
+  if (exec_runq != NULL) {
+    runq_dispose(&exec_runq);
+  }
+  if (cap != NULL) {
+    capture_close(&cap);
+  }
+  if (lin != NULL && owner) {
+    linker_dispose(&lin);
+  } else if (lin != NULL) {
+    linker_disconnect(&lin);
+  }
+  if (handover_sock != -1 && owner) {
+    char path[PIPE_LEN];
+    snprintf(path, sizeof(path), HANDOVER_SOCK, shard);
+    unlink(path);
+  }
+  if (shard != 0) {
+    return;
+  }
+  // the other shards stop with the first one, or drain on their own
+  for (unsigned i = 1; i < nshards; i++) {
+    if (shard_pids[i] > 0) {
+      if (drain_mode == DRAIN_NONE) {
+        kill(shard_pids[i], SIGTERM);
+      }
+      waitpid(shard_pids[i], NULL, 0);
+    }
+  }
+  if (owner) {
+    shm_unlink(DAEMON_PID_SHM);
   }
-  shm_unlink(DAEMON_PID_SHM);
 }
 
 void quit(const char *fmt, ...) {
@@ -427,54 +1309,423 @@ void quit(const char *fmt, ...) {
   exit(EXIT_FAILURE);
 }
 
-void daemon_main(pid_t starter_pid) {
-  lin = linker_init(LINKER_SHM);
-  if (lin == NULL) {
+/**
+ * @function  take_over_shards
+ * @abstract  connect to the linkers of the daemon being replaced and listen
+ *            for the sessions of each of its shards
+ */
+static void take_over_shards(pid_t starter_pid, linker *lins[],
+                             int socks[]) {
+  char name[PIPE_LEN];
+  linker_name(name, sizeof(name), 0);
+  if ((lins[0] = linker_connect(name)) == NULL) {
+    if (kill(starter_pid, SIG_FAILURE) == -1) {
+      quit("kill");
+    }
+    quit("linker_connect");
+  }
+  nshards = linker_shards(lins[0]);
+  for (unsigned i = 0; i < nshards; i++) {
+    linker_name(name, sizeof(name), i);
+    char path[PIPE_LEN];
+    snprintf(path, sizeof(path), HANDOVER_SOCK, i);
+    if ((i > 0 && (lins[i] = linker_connect(name)) == NULL) ||
+        (socks[i] = handover_listen(path)) == -1) {
+      for (unsigned j = 0; j <= i; j++) {
+        linker_disconnect(&lins[j]);
+        if (socks[j] != -1) {
+          close(socks[j]);
+        }
+      }
+      if (kill(starter_pid, SIG_FAILURE) == -1) {
+        quit("kill");
+      }
+      quit("take over shard %u", i);
+    }
+  }
+  // the runner ids of the daemons following each other don't meet
+  unsigned epoch = linker_next_epoch(lins[0]);
+  id_base = (size_t)epoch * SHARDS_MAX * CAPACITY;
+}
+
+void delegate_cgroups(pid_t starter_pid) {
+  int enabled = -1;
+  if (cgroup_base(old_daemon, cg_base, sizeof(cg_base)) != -1) {
+    enabled = cgroup_delegate(cg_base);
+  }
+  if (enabled == -1) {
+    syslog(LOG_ERR, "[cmds] Can't delegate cgroups [%s]: %s", cg_base,
+           strerror(errno));
     if (kill(starter_pid, SIG_FAILURE) == -1) {
       quit("kill");
     }
-    quit("linker_init");
+    quit("cgroup_delegate");
+  }
+  // sessions are still isolated by the controllers the subtree has
+  const struct {
+    int mask;
+    const char *name;
+    const char **limit;
+  } ctrls[] = {{CGROUP_CPU, "cpu", &cg_limits.cpu_weight},
+               {CGROUP_MEMORY, "memory", &cg_limits.memory_max},
+               {CGROUP_PIDS, "pids", &cg_limits.pids_max}};
+  for (size_t i = 0; i < sizeof(ctrls) / sizeof(ctrls[0]); i++) {
+    if (!(enabled & ctrls[i].mask)) {
+      syslog(LOG_WARNING, "[cmds] Controller %s not delegated to [%s]",
+             ctrls[i].name, cg_base);
+      *ctrls[i].limit = NULL;
+    }
+  }
+}
+
+void start_shards(pid_t starter_pid) {
+  if (use_cgroups) {
+    delegate_cgroups(starter_pid);
+  }
+  // every linker exists once the starter is told the daemon started
+  linker *lins[SHARDS_MAX] = {NULL};
+  int socks[SHARDS_MAX];
+  for (unsigned i = 0; i < SHARDS_MAX; i++) {
+    socks[i] = -1;
+  }
+  char name[PIPE_LEN];
+  for (unsigned i = 0; old_daemon == 0 && i < nshards; i++) {
+    linker_name(name, sizeof(name), i);
+    if ((lins[i] = linker_init(name)) == NULL) {
+      while (i > 0) {
+        linker_dispose(&lins[--i]);
+      }
+      if (kill(starter_pid, SIG_FAILURE) == -1) {
+        quit("kill");
+      }
+      quit("linker_init");
+    }
+  }
+  if (old_daemon != 0) {
+    take_over_shards(starter_pid, lins, socks);
+  } else {
+    linker_set_shards(lins[0], nshards);
+  }
+
+  for (unsigned i = 1; i < nshards; i++) {
+    pid_t pid = fork();
+    if (pid == -1) {
+      for (unsigned j = i; j < nshards; j++) {
+        if (old_daemon != 0) {
+          linker_disconnect(&lins[j]);
+        } else {
+          linker_dispose(&lins[j]);
+        }
+      }
+      lin = lins[0];
+      if (kill(starter_pid, SIG_FAILURE) == -1) {
+        quit("kill");
+      }
+      quit("fork shard");
+    }
+    if (pid == 0) {
+      shard = i;
+      // a shard left alone stops
+      prctl(PR_SET_PDEATHSIG, SIGTERM);
+      break;
+    }
+    shard_pids[i] = pid;
+  }
+  lin = lins[shard];
+  handover_sock = socks[shard];
+  id_base += (size_t)shard * CAPACITY;
+  for (unsigned i = 0; i < nshards; i++) {
+    if (i != shard) {
+      linker_disconnect(&lins[i]);
+      if (socks[i] != -1) {
+        close(socks[i]);
+      }
+    }
+  }
+  if (numa && topo_bind_node(shard % topo_nodes()) == -1) {
+    syslog(LOG_WARNING, "[cmds] Can't bind shard %u to node %u: %s", shard,
+           shard % topo_nodes(), strerror(errno));
+  }
+  if (cap != NULL) {
+    capture_shard(cap, shard, nshards);
+  }
+  if ((pin_runners || spread_cmds) && topo_place_init() == 0) {
+    syslog(LOG_WARNING, "[cmds] Can't read the CPUs of shard %u: %s", shard,
+           strerror(errno));
+  }
+}
+
+void daemon_main(pid_t starter_pid) {
+  start_shards(starter_pid);
+
+  exec_slots = EXEC_SLOTS;
+  if (exec_slots == 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    exec_slots = cpus > 0 ? (size_t)cpus / nshards : 1;
+    exec_slots = exec_slots < 1               ? 1
+                 : exec_slots > CAPACITY - 1 ? CAPACITY - 1
+                                             : exec_slots;
+  }
+  exec_runq = runq_init(exec_slots);
+  if (exec_runq == NULL) {
+    if (shard == 0 && kill(starter_pid, SIG_FAILURE) == -1) {
+      quit("kill");
+    }
+    quit("runq_init");
+  }
+
+  // commands are still run without history, only their ordering suffers
+  char hist_path[PATH_MAX];
+  if (shard == 0) {
+    snprintf(hist_path, sizeof(hist_path), "%s", HISTORY_FILE);
+  } else {
+    snprintf(hist_path, sizeof(hist_path), "%s.%u", HISTORY_FILE, shard);
+  }
+  hist = history_open(hist_path);
+  if (hist == NULL) {
+    syslog(LOG_WARNING, "[cmds] Can't open history [%s]: %s", hist_path,
+           strerror(errno));
+  }
+
+  // without prewarm nothing is counted: commands don't pay for resolving
+  // their binaries
+  char pw_path[PATH_MAX];
+  if (shard == 0) {
+    snprintf(pw_path, sizeof(pw_path), "%s", PREWARM_FILE);
+  } else {
+    snprintf(pw_path, sizeof(pw_path), "%s.%u", PREWARM_FILE, shard);
+  }
+  if (prewarm_on && (pw = prewarm_open(pw_path)) == NULL) {
+    syslog(LOG_WARNING, "[cmds] Can't open prewarm counts [%s]: %s", pw_path,
+           strerror(errno));
+  } else if (prewarm_on &&
+             prewarm_start(pw, PREWARM_INTERVAL_MS, prewarm_lock) == -1) {
+    syslog(LOG_WARNING, "[cmds] prewarm_start: %s", strerror(errno));
+  }
+
+  // a drain wakes the runners through the pipe, left readable
+  if (pipe2(drain_pipe, O_CLOEXEC | O_NONBLOCK) == -1) {
+    if (shard == 0 && kill(starter_pid, SIG_FAILURE) == -1) {
+      quit("kill");
+    }
+    quit("pipe2");
+  }
+  struct sigaction action;
+  action.sa_sigaction = drain_handler;
+  action.sa_flags = SA_SIGINFO;
+  sigset_t drain_set;
+  sigfillset(&action.sa_mask);
+  sigemptyset(&drain_set);
+  sigaddset(&drain_set, SIG_DRAIN);
+  sigaddset(&drain_set, SIG_HANDOVER);
+  if (sigaction(SIG_DRAIN, &action, NULL) == -1 ||
+      sigaction(SIG_HANDOVER, &action, NULL) == -1 ||
+      pthread_sigmask(SIG_UNBLOCK, &drain_set, NULL) != 0) {
+    if (shard == 0 && kill(starter_pid, SIG_FAILURE) == -1) {
+      quit("kill");
+    }
+    quit("sigaction");
   }
 
   struct runner rnrs[CAPACITY];
   runner_pool = rnrs;
 
   for (size_t i = 0; i < CAPACITY; i++) {
-    rnrs[i].id = i;
+    // ids are unique among the shards and the daemons, naming their resume
+    // pipes
+    rnrs[i].id = id_base + i;
     rnrs[i].clt.pid = 0;
     rnrs[i].running = false;
+    rnrs[i].rg = NULL;
+    rnrs[i].sl = NULL;
+    rnrs[i].parked = false;
+    rnrs[i].cap_id = 0;
+    rnrs[i].cg_fd = -1;
+  }
+
+  // the cgroups are ready before any command, spawn only joins one
+  for (size_t i = 0; use_cgroups && i < CAPACITY; i++) {
+    rnrs[i].cg_fd = cgroup_create(cg_base, rnrs[i].id, &cg_limits);
+    if (rnrs[i].cg_fd == -1) {
+      syslog(LOG_ERR, "[cmds] [%zu] cgroup_create: %s", rnrs[i].id,
+             strerror(errno));
+      if (shard == 0 && kill(starter_pid, SIG_FAILURE) == -1) {
+        quit("kill");
+      }
+      quit("cgroup_create");
+    }
+  }
+
+  if (handover_sock != -1) {
+    pthread_t th;
+    create_th(&th, handover_routine, NULL);
+  }
+  // the clients of the daemon replaced now find this one, which takes its
+  // sessions over
+  if (shard == 0 && old_daemon != 0) {
+    union sigval deadline = {.sival_int = DRAIN_TIMEOUT_MS};
+    if (store_dpid() == -1) {
+      if (kill(starter_pid, SIG_FAILURE) == -1) {
+        quit("kill");
+      }
+      quit("store_dpid");
+    }
+    if (sigqueue(old_daemon, SIG_HANDOVER, deadline) == -1) {
+      syslog(LOG_ERR, "[cmds] Can't signal the daemon replaced [%d]: %s",
+             old_daemon, strerror(errno));
+    }
   }
 
   // Tell starter process the daemon started successfully
-  if (kill(starter_pid, SIG_SUCCESS) == -1) {
+  if (shard == 0 && kill(starter_pid, SIG_SUCCESS) == -1) {
     quit("kill");
   }
 
   client c;
-  while (linker_pop(lin, &c) == 0) {
-    syslog(LOG_INFO, "[cmds] Popped request from [%d] working at [%s]", c.pid, c.working_dir);
+  int lane;
+  while (drain_mode == DRAIN_NONE) {
+    if ((lane = linker_timedpop(lin, &c, policy, POP_CHECK_MS)) == -1) {
+      if (errno == ETIMEDOUT || errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    lane_stats st;
+    if (linker_stats(lin, (unsigned)lane, &st) == -1) {
+      quit("linker_stats");
+    }
+    syslog(LOG_INFO,
+           "[cmds] Popped request from [%d] on lane[%d] (%zu still queued)",
+           c.pid, lane, st.depth);
 
     bool found = false;
+    uint32_t cap_id = capture_arrival(&c, lane);
 
-    for (size_t i = 0; i < CAPACITY; i++) {
+    // the sessions a replaced daemon didn't hand over yet count too
+    unsigned busy;
+    linker_load(lin, &busy);
+    pthread_mutex_lock(&pool_mutex);
+    for (size_t i = 0; busy < CAPACITY && i < CAPACITY; i++) {
       if (runner_pool[i].running == false) {
         found = true;
+        runner_pool[i].cap_id = cap_id;
         start_th(i, c);
         break;
       }
     }
+    pthread_mutex_unlock(&pool_mutex);
 
     if (!found) {
-      if (kill(c.pid, SIG_FAILURE) == -1) {
-        quit("kill");
+      cancel(&c, NULL);
+    }
+  }
+  if (drain_mode != DRAIN_NONE) {
+    drain_runners();
+    syslog(LOG_INFO, "[cmds] Daemon Stopped");
+    cleanup();
+    exit(EXIT_SUCCESS);
+  }
+  // the pool goes with the stack of daemon_main
+  runner_pool = NULL;
+}
+
+void drain_runners(void) {
+  syslog(LOG_INFO, "[cmds] Draining: %s, commands left %dms",
+         drain_mode == DRAIN_HANDOVER ? "handing sessions over" : "stopping",
+         (int)drain_ms);
+  struct timespec start, now;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (;;) {
+    bool busy = false;
+    for (size_t i = 0; i < CAPACITY; i++) {
+      busy = busy || runner_pool[i].running;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (!busy || diff_ms(&start, &now) >= drain_ms) {
+      break;
+    }
+    if (drain_mode == DRAIN_STOP) {
+      // clients arriving meanwhile are refused at once
+      client c;
+      if (linker_timedpop(lin, &c, policy, DRAIN_POLL_MS) >= 0) {
+        cancel(&c, NULL);
       }
+    } else {
+      // clients arriving meanwhile are left to the next daemon
+      struct timespec pause = {.tv_sec = 0,
+                               .tv_nsec = DRAIN_POLL_MS * 1000000L};
+      nanosleep(&pause, NULL);
     }
   }
+  client c;
+  while (drain_mode == DRAIN_STOP &&
+         linker_timedpop(lin, &c, policy, 0) >= 0) {
+    cancel(&c, NULL);
+  }
 }
 
-void start_th(size_t i, client c) {
-  memcpy(&runner_pool[i].clt, &c, sizeof(client));
-  runner_pool[i].running = true;
+void cancel(const client *c, struct runner *r) {
+  if (!(c->flags & CLIENT_NOSIG)) {
+    kill(c->pid, SIG_FAILURE);
+    return;
+  }
+  completion rec = {.exit_code = -1,
+                    .signal = 0,
+                    .queued_ms = 0,
+                    .run_ms = 0,
+                    .first_ms = -1,
+                    .bytes = 0,
+                    .cpu = -1,
+                    .majflt = -1};
+  // the runner was stopped, a reader of its ring must be let go
+  if (r != NULL && r->rg != NULL) {
+    ring_end(r->rg);
+  }
+  if (r != NULL && r->sl != NULL) {
+    slot_post(r->sl, &rec);
+    return;
+  }
+  char name[PIPE_LEN];
+  snprintf(name, sizeof(name), SLOT_SHM, c->pid, c->sid);
+  slot *sl = slot_open(name);
+  if (sl == NULL) {
+    syslog(LOG_ERR, "[cmds] slot_open: %s", strerror(errno));
+    return;
+  }
+  slot_post(sl, &rec);
+  slot_close(&sl, NULL);
+}
+
+void forget_client(const client *c) {
+  if (kill(c->pid, 0) == 0 || errno != ESRCH) {
+    return;
+  }
+  char name[PIPE_LEN];
+  snprintf(name, sizeof(name), SLOT_SHM, c->pid, c->sid);
+  shm_unlink(name);
+  snprintf(name, sizeof(name), RING_SHM, c->pid, c->sid);
+  shm_unlink(name);
+}
+
+uint32_t capture_arrival(const client *c, int lane) {
+  if (cap == NULL) {
+    return 0;
+  }
+  // the directory of a refused client is recorded too, runners opening it
+  // only once they start
+  char path[PIPE_LEN];
+  snprintf(path, sizeof(path), "/proc/%d/cwd", c->pid);
+  char wd[PATH_MAX];
+  ssize_t n = readlink(path, wd, sizeof(wd) - 1);
+  wd[n == -1 ? 0 : n] = 0;
+  uint32_t id = capture_session(cap, (unsigned)lane, c->flags, wd);
+  if (id == 0) {
+    syslog(LOG_WARNING, "[cmds] capture_session: %s", strerror(errno));
+  }
+  return id;
+}
+
+void create_th(pthread_t *th, void *(*routine)(void *), void *arg) {
   pthread_attr_t attr;
   int r;
   if ((r = pthread_attr_init(&attr)) != 0) {
@@ -483,13 +1734,33 @@ void start_th(size_t i, client c) {
   if ((r = pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED)) != 0) {
     quit("pthread_attr_setdetachstate: %s", strerror(r));
   }
-  if ((r = pthread_create(&runner_pool[i].th, &attr,
-                          (void *(*)(void *))runner_routine,
-                          &runner_pool[i])) != 0) {
+  // the thread inherits the mask, the main thread must get the drain signals
+  // to stop waiting for clients
+  sigset_t drain_set, mask;
+  sigemptyset(&drain_set);
+  sigaddset(&drain_set, SIG_DRAIN);
+  sigaddset(&drain_set, SIG_HANDOVER);
+  pthread_sigmask(SIG_BLOCK, &drain_set, &mask);
+  r = pthread_create(th, &attr, routine, arg);
+  pthread_sigmask(SIG_SETMASK, &mask, NULL);
+  if (r != 0) {
     quit("pthread_create: %s", strerror(r));
   }
 }
 
+void start_th(size_t i, client c) {
+  memcpy(&runner_pool[i].clt, &c, sizeof(client));
+  // an adopted session may have left its own id
+  runner_pool[i].id = id_base + i;
+  runner_pool[i].rg = NULL;
+  runner_pool[i].sl = NULL;
+  runner_pool[i].parked = false;
+  runner_pool[i].running = true;
+  linker_busy(lin, 1);
+  create_th(&runner_pool[i].th, (void *(*)(void *))runner_routine,
+            &runner_pool[i]);
+}
+
 void *runner_routine(struct runner *r) {
   errno = 0;
   if (clock_gettime(CLOCK_REALTIME, &r->start_t) == -1) {
@@ -501,120 +1772,196 @@ void *runner_routine(struct runner *r) {
   syslog(LOG_INFO, "[cmds] + Started client[%d] on thread[%zu]", r->clt.pid,
          r->id);
   char pipe_in[PIPE_LEN] = {0};
-  snprintf(pipe_in, sizeof(pipe_in), "/tmp/%d_in", r->clt.pid);
-  char pipe_out[PIPE_LEN] = {0};
-  snprintf(pipe_out, sizeof(pipe_out), "/tmp/%d_out", r->clt.pid);
-
-
-  int fd_in = open(pipe_in, O_RDONLY);
-  if (fd_in == -1) {
-    syslog(LOG_ERR, "[cmds] [%zu] open: %s", r->id, strerror(errno));
+  snprintf(pipe_in, sizeof(pipe_in), PIPE_IN, r->clt.pid, r->clt.sid);
+  snprintf(r->pipe_out, sizeof(r->pipe_out), PIPE_OUT, r->clt.pid,
+           r->clt.sid);
+
+  place_runner(r);
+  r->fd_out = -1;
+  r->reading = false;
+  r->rg = NULL;
+  r->env = NULL;
+  r->lost = false;
+  r->held = NULL;
+  r->parked = false;
+  if ((r->wd_fd = open_wd(r)) == -1) {
+    syslog(LOG_ERR, "[cmds] [%zu] open_wd: %s", r->id, strerror(errno));
+    cancel(&r->clt, NULL);
+    linker_busy(lin, -1);
     r->running = false;
-    exit(EXIT_FAILURE);
+    return NULL;
   }
-  struct stat st;
-  if (fstat(fd_in, &st) == -1) {
-    syslog(LOG_ERR, "[cmds] [%zu] fstat: %s", r->id, strerror(errno));
-    r->running = false;
-    exit(EXIT_FAILURE);
+  char name[PIPE_LEN];
+  snprintf(name, sizeof(name), SLOT_SHM, r->clt.pid, r->clt.sid);
+  r->sl = slot_open(name);
+  if (r->sl != NULL && (r->clt.flags & CLIENT_RING)) {
+    snprintf(name, sizeof(name), RING_SHM, r->clt.pid, r->clt.sid);
+    r->rg = ring_open(name);
   }
-  ssize_t blksize_pipe_in = st.st_blksize;
-
-  char buf_in[blksize_pipe_in];
-
-  ssize_t r_in;
-  while ((r_in = read(fd_in, buf_in, (size_t)blksize_pipe_in)) > 0) {
-    // Removing line break at the end of input
-    if (buf_in[strlen(buf_in) - 1] == '\n') {
-      buf_in[strlen(buf_in) - 1] = 0;
+  // the token is in the slot before the client connects
+  int fd_resume = -1;
+  if (r->sl != NULL &&
+      getrandom(&r->token, sizeof(r->token), 0) == sizeof(r->token)) {
+    slot_set_session(r->sl, r->id, r->token);
+    if ((fd_resume = open_resume(r)) == -1) {
+      syslog(LOG_WARNING, "[cmds] [%zu] open_resume: %s", r->id,
+             strerror(errno));
     }
-    syslog(LOG_INFO, "[cmds] [%zu] received cmd:%s from [%d]", r->id, buf_in,
-           r->clt.pid);
-    char *argv[count_args(buf_in) + 1];
-    char fmt_buf[strlen(buf_in) + 1];
-    int status, fd_out;
-    struct timespec start;
-    if (clock_gettime(CLOCK_REALTIME, &start) == -1) {
-      syslog(LOG_ERR, "[cmds] [%zu] clock_gettime: %s", r->id, strerror(errno));
-      r->running = false;
-      exit(EXIT_FAILURE);
+  }
+  // not waiting for the client here lets it be woken through its slot
+  int fd_in = -1;
+  if (r->sl == NULL || ((r->clt.flags & CLIENT_RING) && r->rg == NULL) ||
+      (fd_in = open(pipe_in, O_RDONLY | O_NONBLOCK | O_CLOEXEC)) == -1) {
+    syslog(LOG_ERR, "[cmds] [%zu] open: %s", r->id, strerror(errno));
+    cancel(&r->clt, r);
+    slot_close(&r->sl, NULL);
+    ring_close(&r->rg, NULL);
+    close(r->wd_fd);
+    if (fd_resume != -1) {
+      close(fd_resume);
+      snprintf(name, sizeof(name), RESUME_PIPE, r->id);
+      unlink(name);
     }
+    linker_busy(lin, -1);
+    r->running = false;
+    return NULL;
+  }
 
-    // Fork / Exec
-    switch (fork()) {
-    case -1:
-      syslog(LOG_ERR, "[cmds] [%zu] fork: %s", r->id, strerror(errno));
-      r->running = false;
-      exit(EXIT_FAILURE);
-    case 0:
-      if (chdir(r->clt.working_dir) == -1) {
-        syslog(LOG_ERR, "[cmds] [%zu] chdir: %s", r->id, strerror(errno));
-        r->running = false;
-        exit(EXIT_FAILURE);
-      }
-      fd_out = open(pipe_out, O_WRONLY);
-      if (fd_out == -1) {
-        syslog(LOG_ERR, "[cmds] [%zu] open: %s", r->id, strerror(errno));
-        r->running = false;
-        exit(EXIT_FAILURE);
-      }
-      if (dup2(fd_out, STDOUT_FILENO) == -1) {
-        syslog(LOG_ERR, "[cmds] [%zu] dup2: %s", r->id, strerror(errno));
-        r->running = false;
-        exit(EXIT_FAILURE);
-      }
-      if (close(fd_out) == -1) {
-        syslog(LOG_ERR, "[cmds] [%zu] close: %s", r->id, strerror(errno));
-        r->running = false;
-        exit(EXIT_FAILURE);
-      }
+  slot_notify(r->sl);
+  if (wait_client(fd_in) == -1) {
+    syslog(LOG_ERR, "[cmds] [%zu] wait_client: %s", r->id, strerror(errno));
+  }
+  serve_session(r, fd_in, fd_resume);
+  return NULL;
+}
 
-      fmt_args(buf_in, argv, fmt_buf);
+void place_runner(struct runner *r) {
+  // the commands of the runner inherit its placement
+  if (pin_runners && topo_pin((unsigned)r->id) == -1) {
+    syslog(LOG_WARNING, "[cmds] [%zu] topo_pin: %s", r->id, strerror(errno));
+  }
+  if (bind_memory && topo_bind_memory() == -1) {
+    syslog(LOG_WARNING, "[cmds] [%zu] topo_bind_memory: %s", r->id,
+           strerror(errno));
+  }
+}
 
-      execvp(argv[0], argv);
+void *adopt_routine(struct runner *r) {
+  syslog(LOG_INFO, "[cmds] + Took over client[%d] on thread[%zu]",
+         r->clt.pid, r->id);
+  snprintf(r->pipe_out, sizeof(r->pipe_out), PIPE_OUT, r->clt.pid,
+           r->clt.sid);
+  place_runner(r);
+  r->fd_out = -1;
+  r->reading = false;
+  r->lost = false;
+  serve_session(r, r->fd_in, r->fd_resume);
+  return NULL;
+}
 
-      syslog(LOG_ERR, "[cmds] [%zu] execvp: %s", r->id, strerror(errno));
-      r->running = false;
-      exit(EXIT_FAILURE);
-    default:
-      wait(&status);
-      break;
+void serve_session(struct runner *r, int fd_in, int fd_resume) {
+  char name[PIPE_LEN];
+  request req;
+  char *payload;
+  bool bye = false;
+  int fd = -1;
+  while (!bye && (fd = wait_request(r, &fd_in, &fd_resume)) >= 0) {
+    if (fd == fd_resume) {
+      // a writer leaving without resuming leaves the pipe hung up, and what
+      // a bad one wrote goes with the pipe
+      resume rs;
+      if (recv_resume(fd_resume, &rs) != 1 ||
+          !resume_session(r, &fd_in, &fd_resume, &rs)) {
+        close(fd_resume);
+        fd_resume = open_resume(r);
+      }
+      continue;
     }
-
-    // Checking if exec was successful
-    if (WEXITSTATUS(status) == EXIT_FAILURE) {
-      syslog(LOG_ERR, "[cmds] [%zu] Failed to execute cmd: [%s]", r->id,
-             buf_in);
-      if (kill(r->clt.pid, SIG_FAILURE)) {
-        syslog(LOG_ERR, "[cmds] [%zu] clock_gettime: %s", r->id,
+    int rc = proto_recv(fd, &req, &payload);
+    if (rc <= 0) {
+      if (rc == -1) {
+        syslog(LOG_ERR, "[cmds] [%zu] proto_recv: %s", r->id,
                strerror(errno));
-        r->running = false;
-        exit(EXIT_FAILURE);
       }
-      break;
-    } else {
-      struct timespec end;
-      if (clock_gettime(CLOCK_REALTIME, &end) == -1) {
-        syslog(LOG_ERR, "[cmds] [%zu] clock_gettime: %s", r->id,
+      // wait_request parks the session
+      close(fd_in);
+      fd_in = -1;
+      continue;
+    }
+    if (req.type == REQ_CMD || req.type == REQ_FANOUT) {
+      // the client is here: what a previous one lost is not claimed
+      r->lost = false;
+      spool_dispose(&r->held);
+    }
+    bool ok;
+    switch (req.type) {
+    case REQ_CMD:
+      if (r->cap_id != 0 && capture_command(cap, r->cap_id, payload) == -1) {
+        syslog(LOG_WARNING, "[cmds] [%zu] capture_command: %s", r->id,
                strerror(errno));
-        r->running = false;
-        exit(EXIT_FAILURE);
       }
-      if (end.tv_nsec < start.tv_nsec) {
-        --end.tv_sec;
-        end.tv_nsec += 1000000000;
+      ok = run_cmd(r, payload);
+      break;
+    case REQ_FANOUT:
+      ok = run_fanout(r, payload, req.len);
+      break;
+    case REQ_ENV:
+      if (r->env == NULL) {
+        r->env = env_create();
       }
-      time_t sec = end.tv_sec - start.tv_sec;
-      long nsec = end.tv_nsec - start.tv_nsec;
-
-      long diff_ms = sec * 1000 + nsec / 1000000;
-      syslog(
-          LOG_INFO,
-          "[cmds] [%zu] Finnished executing cmd: [%s] for client[%d] in %ldms",
-          r->id, buf_in, r->clt.pid, diff_ms);
-      for (int i = 0; i < blksize_pipe_in; i++)
-        buf_in[i] = 0;
+      ok = r->env != NULL && env_apply(r->env, payload, req.len) == 0;
+      if (!ok) {
+        syslog(LOG_ERR, "[cmds] [%zu] env_apply: %s", r->id, strerror(errno));
+      }
+      break;
+    case REQ_BYE:
+      ok = bye = true;
+      break;
+    default:
+      syslog(LOG_ERR, "[cmds] [%zu] unknown request type [%u] from [%d]",
+             r->id, req.type, r->clt.pid);
+      ok = false;
+    }
+    free(payload);
+    if (!ok) {
+      break;
+    }
+  }
+  // a session ended by a drain is idle, its client finds it gone at its
+  // next request
+  if (fd == WAIT_DRAIN && drain_mode == DRAIN_HANDOVER &&
+      hand_over(r, fd_in, fd_resume)) {
+    // the pipes and the shms of the session now belong to the next daemon
+    if (fd_in != -1) {
+      close(fd_in);
+      fd_in = -1;
+    }
+    if (fd_resume != -1) {
+      close(fd_resume);
+      fd_resume = -1;
     }
+    r->parked = false;
+  }
+  if (fd_in != -1) {
+    close(fd_in);
+  }
+  if (fd_resume != -1) {
+    snprintf(name, sizeof(name), RESUME_PIPE, r->id);
+    unlink(name);
+    refuse_resume(r, fd_resume);
+    close(fd_resume);
+  }
+  close(r->wd_fd);
+  env_dispose(&r->env);
+  spool_dispose(&r->held);
+  ring_close(&r->rg, NULL);
+  slot_close(&r->sl, NULL);
+  if (r->parked) {
+    forget_client(&r->clt);
+    r->parked = false;
+  }
+  if (r->cap_id != 0) {
+    capture_end(cap, r->cap_id);
   }
 
   struct timespec end;
@@ -623,60 +1970,1631 @@ void *runner_routine(struct runner *r) {
     r->running = false;
     exit(EXIT_FAILURE);
   }
-  if (end.tv_nsec < r->start_t.tv_nsec) {
-    --end.tv_sec;
-    end.tv_nsec += 1000000000;
-  }
-  time_t sec = end.tv_sec - r->start_t.tv_sec;
-  long nsec = end.tv_nsec - r->start_t.tv_nsec;
-
-  long diff_ms = sec * 1000 + nsec / 1000000;
   syslog(LOG_INFO,
          "[cmds] - Stopped client[%d] on thread[%zu] connection lasted: %ldms",
-         r->clt.pid, r->id, diff_ms);
+         r->clt.pid, r->id, diff_ms(&r->start_t, &end));
+  linker_busy(lin, -1);
   r->running = false;
+}
 
-  return NULL;
+int wait_client(int fd_in) {
+  // a pipe no writer opened yet is neither readable nor hung up
+  struct pollfd pfd = {.fd = fd_in, .events = POLLIN};
+  while (poll(&pfd, 1, -1) == -1) {
+    if (errno != EINTR) {
+      return -1;
+    }
+  }
+  int fl = fcntl(fd_in, F_GETFL);
+  if (fl == -1 || fcntl(fd_in, F_SETFL, fl & ~O_NONBLOCK) == -1) {
+    return -1;
+  }
+  return 0;
+}
+
+int open_resume(struct runner *r) {
+  char name[PIPE_LEN];
+  snprintf(name, sizeof(name), RESUME_PIPE, r->id);
+  unlink(name);
+  // only the clients of the user of the daemon reach it, as its shms
+  if (mkfifo(name, S_IRUSR | S_IWUSR) == -1) {
+    return -1;
+  }
+  // left non-blocking, a writer stalling can't hold the runner
+  int fd = open(name, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  if (fd == -1) {
+    unlink(name);
+    return -1;
+  }
+  return fd;
 }
 
-size_t count_args(const char *str) {
-  size_t i = 0;
-  size_t count = 0;
-  bool inw = true;
-  for (i = 0; str[i]; i++) {
-    if (str[i] == ' ' && inw) {
-      count++;
-      inw = false;
-    } else if (str[i] != ' ') {
-      inw = true;
+int recv_resume(int fd, resume *rs) {
+  char msg[sizeof(request) + sizeof(resume)];
+  size_t done = 0;
+  struct timespec start, now;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  while (done < sizeof(msg)) {
+    ssize_t n = read(fd, msg + done, sizeof(msg) - done);
+    if (n > 0) {
+      done += (size_t)n;
+      continue;
+    }
+    if (n == 0) {
+      return done == 0 ? 0 : -1;
+    }
+    if (errno == EINTR) {
+      continue;
     }
+    if (errno != EAGAIN) {
+      return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long left = RESUME_READ_MS - diff_ms(&start, &now);
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    if (left <= 0 || (poll(&pfd, 1, (int)left) == -1 && errno != EINTR)) {
+      return -1;
+    }
+  }
+  request req;
+  memcpy(&req, msg, sizeof(req));
+  if (req.type != REQ_RESUME || req.len != sizeof(resume)) {
+    return -1;
   }
-  if (i > 0)
-    count++;
-  return count;
+  memcpy(rs, msg + sizeof(req), sizeof(*rs));
+  return 1;
 }
 
-void fmt_args(const char *str, char *argv[], char *buf) {
-  memcpy(buf, str, strlen(str) + 1);
+int wait_request(struct runner *r, int *fd_in, int *fd_resume) {
+  for (;;) {
+    int timeout = -1;
+    if (*fd_in == -1) {
+      if (*fd_resume == -1) {
+        return -1;
+      }
+      if (!r->parked) {
+        r->parked = true;
+        clock_gettime(CLOCK_MONOTONIC, &r->lost_t);
+        syslog(LOG_INFO, "[cmds] [%zu] client[%d] lost, session kept %dms",
+               r->id, r->clt.pid, RESUME_GRACE_MS);
+      }
+      struct timespec now;
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      long left = RESUME_GRACE_MS - diff_ms(&r->lost_t, &now);
+      if (left <= 0) {
+        syslog(LOG_INFO, "[cmds] [%zu] session of client[%d] expired", r->id,
+               r->clt.pid);
+        return -1;
+      }
+      timeout = (int)left;
+    }
+    struct pollfd fds[3] = {{.fd = *fd_in, .events = POLLIN},
+                            {.fd = *fd_resume, .events = POLLIN},
+                            {.fd = drain_pipe[0], .events = POLLIN}};
+    if (poll(fds, 3, timeout) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      syslog(LOG_ERR, "[cmds] [%zu] poll: %s", r->id, strerror(errno));
+      return -1;
+    }
+    // a session handed over takes the requests left in its pipe along
+    bool draining = fds[2].revents != 0;
+    if (draining && drain_mode == DRAIN_HANDOVER) {
+      return WAIT_DRAIN;
+    }
+    // the requests of the client come first, its REQ_BYE included
+    if (fds[0].revents & POLLIN) {
+      return *fd_in;
+    }
+    if (draining) {
+      return WAIT_DRAIN;
+    }
+    if (fds[1].revents != 0) {
+      return *fd_resume;
+    }
+    if (fds[0].revents != 0) {
+      // the client left without REQ_BYE
+      close(*fd_in);
+      *fd_in = -1;
+    }
+  }
+}
 
-  size_t i = 0, j = 0;
+bool hand_over(struct runner *r, int fd_in, int fd_resume) {
+  char path[PIPE_LEN];
+  snprintf(path, sizeof(path), HANDOVER_SOCK, shard);
+  int sock = handover_connect(path);
+  if (sock == -1) {
+    syslog(LOG_ERR, "[cmds] [%zu] handover_connect: %s", r->id,
+           strerror(errno));
+    return false;
+  }
+  struct handed h = {.clt = r->clt,
+                     .id = r->id,
+                     .token = r->token,
+                     .last = r->last,
+                     .start_t = r->start_t,
+                     .lost_t = r->lost_t,
+                     .parked = r->parked,
+                     .held = r->held != NULL,
+                     .has_env = r->env != NULL,
+                     .has_in = fd_in != -1,
+                     .has_resume = fd_resume != -1};
+  // the environment follows as the entries of a REQ_ENV
+  char *const *vars = r->env != NULL ? env_envp(r->env) : NULL;
+  size_t len = sizeof(h);
+  for (size_t i = 0; vars != NULL && vars[i] != NULL; i++) {
+    len += strlen(vars[i]) + 1;
+  }
+  char *msg = malloc(len);
+  if (msg == NULL) {
+    syslog(LOG_ERR, "[cmds] [%zu] malloc: %s", r->id, strerror(errno));
+    close(sock);
+    return false;
+  }
+  memcpy(msg, &h, sizeof(h));
+  size_t off = sizeof(h);
+  for (size_t i = 0; vars != NULL && vars[i] != NULL; i++) {
+    size_t n = strlen(vars[i]) + 1;
+    memcpy(msg + off, vars[i], n);
+    off += n;
+  }
+  int fds[3] = {r->wd_fd};
+  size_t nfds = 1;
+  if (fd_in != -1) {
+    fds[nfds++] = fd_in;
+  }
+  if (fd_resume != -1) {
+    fds[nfds++] = fd_resume;
+  }
+  int rc = handover_send(sock, msg, len, fds, nfds);
+  free(msg);
+  close(sock);
+  if (rc == -1) {
+    syslog(LOG_ERR, "[cmds] [%zu] handover_send: %s", r->id, strerror(errno));
+    return false;
+  }
+  syslog(LOG_INFO, "[cmds] [%zu] session of client[%d] handed over", r->id,
+         r->clt.pid);
+  return true;
+}
 
-  argv[j++] = buf;
+void *handover_routine(void *arg) {
+  (void)arg;
+  for (;;) {
+    int conn = handover_accept(handover_sock);
+    if (conn == -1) {
+      syslog(LOG_WARNING, "[cmds] handover_accept: %s", strerror(errno));
+      if (errno == EPERM || errno == ECONNABORTED) {
+        continue;
+      }
+      return NULL;
+    }
+    char *msg;
+    size_t len;
+    int fds[HANDOVER_FDS];
+    size_t nfds;
+    while (handover_recv(conn, &msg, &len, fds, &nfds) == 1) {
+      struct handed h;
+      bool ok = len >= sizeof(h);
+      if (ok) {
+        memcpy(&h, msg, sizeof(h));
+        ok = adopt(&h, msg + sizeof(h), len - sizeof(h), fds, nfds);
+      }
+      if (!ok) {
+        for (size_t i = 0; i < nfds; i++) {
+          close(fds[i]);
+        }
+      }
+      free(msg);
+      handover_reply(conn, ok);
+    }
+    close(conn);
+  }
+}
 
-  while (j < count_args(str)) {
-    if (str[i] == ' ') {
-      buf[i] = 0;
-      argv[j++] = buf + i + 1;
+bool adopt(const struct handed *h, const char *vars, size_t vars_len,
+           const int *fds, size_t nfds) {
+  if (nfds != 1 + (size_t)h->has_in + (size_t)h->has_resume) {
+    syslog(LOG_ERR, "[cmds] malformed session handed over");
+    return false;
+  }
+  struct runner *r = NULL;
+  pthread_mutex_lock(&pool_mutex);
+  for (size_t i = 0; i < CAPACITY; i++) {
+    if (runner_pool[i].running == false) {
+      r = &runner_pool[i];
+      r->running = true;
+      break;
     }
-    i++;
+  }
+  pthread_mutex_unlock(&pool_mutex);
+  if (r == NULL) {
+    syslog(LOG_ERR, "[cmds] no runner left for the session of client[%d]",
+           h->clt.pid);
+    return false;
   }
 
-  argv[j] = NULL;
+  char name[PIPE_LEN];
+  snprintf(name, sizeof(name), SLOT_SHM, h->clt.pid, h->clt.sid);
+  r->sl = slot_open(name);
+  r->rg = NULL;
+  if (r->sl != NULL && (h->clt.flags & CLIENT_RING)) {
+    snprintf(name, sizeof(name), RING_SHM, h->clt.pid, h->clt.sid);
+    r->rg = ring_open(name);
+  }
+  r->env = NULL;
+  if (h->has_env &&
+      ((r->env = env_create()) == NULL ||
+       env_apply(r->env, vars, vars_len) == -1)) {
+    env_dispose(&r->env);
+  }
+  r->held = h->held ? spool_init(SPOOL_MEM) : NULL;
+  if (r->sl == NULL || ((h->clt.flags & CLIENT_RING) && r->rg == NULL) ||
+      (h->has_env && r->env == NULL) || (h->held && r->held == NULL)) {
+    syslog(LOG_ERR, "[cmds] can't take the session of client[%d] over: %s",
+           h->clt.pid, strerror(errno));
+    slot_close(&r->sl, NULL);
+    ring_close(&r->rg, NULL);
+    env_dispose(&r->env);
+    spool_dispose(&r->held);
+    r->running = false;
+    return false;
+  }
+
+  r->id = h->id;
+  r->clt = h->clt;
+  r->token = h->token;
+  r->last = h->last;
+  r->start_t = h->start_t;
+  r->lost_t = h->lost_t;
+  r->parked = h->parked;
+  r->cap_id = 0;
+  r->wd_fd = fds[0];
+  r->fd_in = h->has_in ? fds[1] : -1;
+  r->fd_resume = h->has_resume ? fds[nfds - 1] : -1;
+  linker_busy(lin, 1);
+  create_th(&r->th, (void *(*)(void *))adopt_routine, r);
+  return true;
 }
 
-void handler(int signum) {
-  if (signum == SIGTERM) {
-    syslog(LOG_INFO, "[cmds] Daemon Stopped");
+void refuse_resume(struct runner *r, int fd_resume) {
+  struct pollfd pfd = {.fd = fd_resume, .events = POLLIN};
+  resume rs;
+  if (poll(&pfd, 1, 0) != 1 || !(pfd.revents & POLLIN) ||
+      recv_resume(fd_resume, &rs) != 1) {
+    return;
+  }
+  // the client is only named by a request holding the token
+  if (rs.token == r->token) {
+    cancel(&rs.clt, NULL);
+  }
+}
+
+bool resume_session(struct runner *r, int *fd_in, int *fd_resume,
+                    const resume *rs_p) {
+  if (rs_p->token != r->token) {
+    syslog(LOG_WARNING, "[cmds] [%zu] resume with a wrong token dropped",
+           r->id);
+    return false;
+  }
+  resume rs = *rs_p;
+
+  char name[PIPE_LEN];
+  snprintf(name, sizeof(name), SLOT_SHM, rs.clt.pid, rs.clt.sid);
+  slot *sl = slot_open(name);
+  ring *rg = NULL;
+  if (sl != NULL && (rs.clt.flags & CLIENT_RING)) {
+    snprintf(name, sizeof(name), RING_SHM, rs.clt.pid, rs.clt.sid);
+    rg = ring_open(name);
+  }
+  if (sl == NULL || ((rs.clt.flags & CLIENT_RING) && rg == NULL)) {
+    syslog(LOG_ERR, "[cmds] [%zu] shm_open: %s", r->id, strerror(errno));
+    slot_close(&sl, NULL);
+    cancel(&rs.clt, NULL);
+    return false;
+  }
+
+  // the result of the last request is lost if the client never read it
+  bool pending = r->held != NULL || slot_unread(r->sl);
+  syslog(LOG_INFO, "[cmds] [%zu] client[%d] resumed the session of client[%d]",
+         r->id, rs.clt.pid, r->clt.pid);
+  ring_close(&r->rg, NULL);
+  slot_close(&r->sl, NULL);
+  forget_client(&r->clt);
+  r->clt = rs.clt;
+  r->sl = sl;
+  r->rg = rg;
+  snprintf(r->pipe_out, sizeof(r->pipe_out), PIPE_OUT, r->clt.pid,
+           r->clt.sid);
+  slot_set_session(r->sl, r->id, r->token);
+  r->parked = false;
+
+  // the client keeps the resume pipe as its request pipe, a new one waits
+  // for the next resume
+  if (*fd_in != -1) {
+    close(*fd_in);
+  }
+  // polled before each read, it is read as a blocking pipe
+  int fl = fcntl(*fd_resume, F_GETFL);
+  if (fl != -1) {
+    fcntl(*fd_resume, F_SETFL, fl & ~O_NONBLOCK);
+  }
+  *fd_in = *fd_resume;
+  *fd_resume = open_resume(r);
+  if (*fd_resume == -1) {
+    syslog(LOG_WARNING, "[cmds] [%zu] open_resume: %s", r->id,
+           strerror(errno));
+  }
+
+  completion rec = {.exit_code = 0,
+                    .signal = 0,
+                    .queued_ms = -1,
+                    .run_ms = 0,
+                    .first_ms = -1,
+                    .bytes = 0,
+                    .cpu = -1,
+                    .majflt = -1};
+  if (pending) {
+    rec = r->last;
+  }
+  spool *sp = r->held != NULL ? r->held : spool_init(SPOOL_MEM);
+  r->held = NULL;
+  r->lost = false;
+  if (sp == NULL || open_output(r) == -1) {
+    syslog(LOG_ERR, "[cmds] [%zu] open_output: %s", r->id, strerror(errno));
+  } else {
+    drain(r, sp);
+  }
+  spool_dispose(&sp);
+  slot_post(r->sl, &rec);
+  return true;
+}
+
+bool run_cmd(struct runner *r, char *cmd) {
+  // Removing line break at the end of input
+  size_t len = strlen(cmd);
+  if (len > 0 && cmd[len - 1] == '\n') {
+    cmd[len - 1] = 0;
+  }
+  syslog(LOG_INFO, "[cmds] [%zu] received cmd:%s from [%d]", r->id, cmd,
+         r->clt.pid);
+
+  // receipt, start and end of the command
+  struct timespec times[3];
+  if (clock_gettime(CLOCK_REALTIME, &times[0]) == -1) {
+    syslog(LOG_ERR, "[cmds] [%zu] clock_gettime: %s", r->id, strerror(errno));
+    r->running = false;
+    exit(EXIT_FAILURE);
+  }
+  r->out_bytes = 0;
+  r->cpu = -1;
+  r->majflt = -1;
+
+  int status = CMD_ERROR << 8;
+  cmdline cl;
+  if (cmdline_parse(cmd, &cl) == -1) {
+    syslog(LOG_ERR, "[cmds] [%zu] cmdline_parse: %s", r->id, strerror(errno));
+    reply(r, "cmds: syntax error\n");
+    complete(r, status, NULL);
+    return true;
+  }
+
+  // redirections are opened by the daemon, relative to the client directory,
+  // before anything is started
+  int redir[cl.nstages][2];
+  off_t redir_size[cl.nstages][2];
+  for (size_t i = 0; i < cl.nstages; i++) {
+    redir[i][0] = redir[i][1] = -1;
+  }
+  for (size_t i = 0; i < cl.nstages; i++) {
+    stage *st = &cl.stages[i];
+    const char *bad = NULL;
+    if (st->out != NULL &&
+        (redir[i][0] = open_redirect(r, st->out, st->out_append,
+                                     &redir_size[i][0])) == -1) {
+      bad = st->out;
+    } else if (st->err != NULL &&
+               (redir[i][1] = open_redirect(r, st->err, st->err_append,
+                                            &redir_size[i][1])) == -1) {
+      bad = st->err;
+    }
+    if (bad != NULL) {
+      reply(r, "cmds: %s: %s\n", bad, strerror(errno));
+      complete(r, status, NULL);
+      close_redirects(cl.nstages, redir);
+      cmdline_free(&cl);
+      return true;
+    }
+  }
+
+  // a pipeline lasts about as long as its slowest command
+  double expected_ms = 0;
+  for (size_t i = 0; i < cl.nstages; i++) {
+    double ms = history_predict(hist, cl.stages[i].argv);
+    expected_ms = ms > expected_ms ? ms : expected_ms;
+  }
+
+  // wait for an execution slot, shortest expected command first
+  if (runq_acquire(exec_runq, expected_ms) == -1) {
+    syslog(LOG_ERR, "[cmds] [%zu] runq_acquire: %s", r->id, strerror(errno));
+    r->running = false;
+    exit(EXIT_FAILURE);
+  }
+
+  if (clock_gettime(CLOCK_REALTIME, &times[1]) == -1) {
+    syslog(LOG_ERR, "[cmds] [%zu] clock_gettime: %s", r->id, strerror(errno));
+    r->running = false;
+    exit(EXIT_FAILURE);
+  }
+
+  // the output of the last command and the errors of every command go
+  // through the runner, which spools them when the client reads slower than
+  // the commands write
+  bool out_to_client = redir[cl.nstages - 1][0] == -1;
+  bool err_to_client = false;
+  for (size_t i = 0; i < cl.nstages; i++) {
+    err_to_client = err_to_client || redir[i][1] == -1;
+  }
+  int out_pipe[2] = {-1, -1};
+  int err_pipe[2] = {-1, -1};
+  spool *sp = NULL;
+  if (out_to_client || err_to_client) {
+    if (open_output(r) == -1) {
+      syslog(LOG_ERR, "[cmds] [%zu] open_output: %s", r->id, strerror(errno));
+    }
+    if ((out_to_client && open_stdout(r, out_pipe) == -1) ||
+        (err_to_client && pipe2(err_pipe, O_CLOEXEC) == -1) ||
+        (sp = spool_init(SPOOL_MEM)) == NULL) {
+      syslog(LOG_ERR, "[cmds] [%zu] output: %s", r->id, strerror(errno));
+      r->running = false;
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  // Fork / Exec each command, stdout of one connected to stdin of the next
+  // one
+  pid_t pids[cl.nstages];
+  size_t started = 0;
+  int prev = -1;
+  for (; started < cl.nstages; started++) {
+    bool last = started + 1 == cl.nstages;
+    // only the output of the last command reaches the client, the others
+    // don't need a terminal
+    int p[2] = {-1, out_pipe[1]};
+    if (!last && pipe2(p, O_CLOEXEC) == -1) {
+      syslog(LOG_ERR, "[cmds] [%zu] pipe2: %s", r->id, strerror(errno));
+      break;
+    }
+    int out = redir[started][0] != -1 ? redir[started][0] : p[1];
+    int err = redir[started][1] != -1 ? redir[started][1] : err_pipe[1];
+    pids[started] = spawn(r, cl.stages[started].argv, prev, out, err);
+    if (prev != -1) {
+      close(prev);
+    }
+    if (!last) {
+      close(p[1]);
+      prev = p[0];
+    }
+    if (pids[started] == -1) {
+      break;
+    }
+  }
+  if (started < cl.nstages && prev != -1) {
+    close(prev);
+  }
+  if (out_pipe[1] != -1) {
+    close(out_pipe[1]);
+  }
+  if (err_pipe[1] != -1) {
+    close(err_pipe[1]);
+  }
+
+  // move the outputs to the client, in the order they come, until the
+  // commands close them
+  int *ins[2] = {&out_pipe[0], &err_pipe[0]};
+  while (out_pipe[0] != -1 || err_pipe[0] != -1) {
+    bool pending = r->reading && spool_pending(sp) > 0;
+    struct pollfd fds[3] = {
+        {.fd = out_pipe[0], .events = POLLIN},
+        {.fd = err_pipe[0], .events = POLLIN},
+        {.fd = pending && r->rg == NULL ? r->fd_out : -1, .events = POLLOUT}};
+    // nothing to poll on a ring: check for space now and then
+    int timeout = pending && r->rg != NULL ? RING_RETRY_MS : -1;
+    if (poll(fds, 3, timeout) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      syslog(LOG_ERR, "[cmds] [%zu] poll: %s", r->id, strerror(errno));
+      break;
+    }
+    if (pending && (r->rg != NULL || fds[2].revents != 0)) {
+      forward(r, sp);
+    }
+    for (int i = 0; i < 2; i++) {
+      if (fds[i].revents != 0 &&
+          pump(r, sp, *ins[i], (uint32_t)(STREAM_OUT + i)) <= 0) {
+        close(*ins[i]);
+        *ins[i] = -1;
+      }
+    }
+  }
+  for (int i = 0; i < 2; i++) {
+    if (*ins[i] != -1) {
+      close(*ins[i]);
+    }
+  }
+
+  long majflt[cl.nstages];
+  for (size_t i = 0; i < cl.nstages; i++) {
+    majflt[i] = -1;
+  }
+  for (size_t i = 0; i < started; i++) {
+    // the CPU of a command can only be read before it is reaped
+    siginfo_t info;
+    if (i + 1 == cl.nstages &&
+        waitid(P_PID, (id_t)pids[i], &info, WEXITED | WNOWAIT) == 0) {
+      r->cpu = topo_last_cpu(pids[i]);
+    }
+    int st;
+    struct rusage ru;
+    if (wait4(pids[i], &st, 0, &ru) == -1) {
+      syslog(LOG_ERR, "[cmds] [%zu] wait4: %s", r->id, strerror(errno));
+    } else {
+      majflt[i] = ru.ru_majflt;
+      r->majflt = (r->majflt == -1 ? 0 : r->majflt) + majflt[i];
+    }
+    // the status of a pipeline is the one of its last command
+    if (i + 1 == cl.nstages) {
+      status = st;
+    }
+  }
+  if (runq_release(exec_runq) == -1) {
+    syslog(LOG_ERR, "[cmds] [%zu] runq_release: %s", r->id, strerror(errno));
+  }
+
+  // only the status and the byte counts go back for redirected output
+  char *summary = NULL;
+  size_t summary_len;
+  FILE *sf = open_memstream(&summary, &summary_len);
+  if (sf != NULL) {
+    if (WIFSIGNALED(status)) {
+      fprintf(sf, "[signal %d]", WTERMSIG(status));
+    } else {
+      fprintf(sf, "[exit %d]", WEXITSTATUS(status));
+    }
+    for (size_t i = 0; i < cl.nstages; i++) {
+      for (int f = 0; f < 2; f++) {
+        struct stat st;
+        if (redir[i][f] == -1 || fstat(redir[i][f], &st) == -1) {
+          continue;
+        }
+        fprintf(sf, " %s%s %s: %lld bytes", f == 0 ? "" : "2",
+                (f == 0 ? cl.stages[i].out_append : cl.stages[i].err_append)
+                    ? ">>"
+                    : ">",
+                f == 0 ? cl.stages[i].out : cl.stages[i].err,
+                (long long)(st.st_size - redir_size[i][f]));
+      }
+    }
+    fclose(sf);
+    syslog(LOG_INFO, "[cmds] [%zu] %s", r->id, summary);
+    if (!out_to_client && sp != NULL) {
+      // the null char ending the summary leaves room for its line break
+      summary[summary_len] = '\n';
+      put_frame(sp, STREAM_OUT, summary, summary_len + 1);
+    } else if (!out_to_client) {
+      reply(r, "%s\n", summary);
+    }
+    free(summary);
+  } else {
+    syslog(LOG_ERR, "[cmds] [%zu] open_memstream: %s", r->id,
+           strerror(errno));
+    // a client whose output is redirected waits for the summary, it gets
+    // the failure instead
+    if (!out_to_client) {
+      status = CMD_ERROR << 8;
+    }
+    if (!out_to_client && sp != NULL) {
+      const char msg[] = "cmds: can't report the redirections\n";
+      put_frame(sp, STREAM_OUT, msg, sizeof(msg) - 1);
+    } else if (!out_to_client) {
+      reply(r, "cmds: %s\n", strerror(errno));
+    }
+  }
+  close_redirects(cl.nstages, redir);
+
+  // the commands are done and their slot given back, the client reads the
+  // rest at its own pace
+  if (sp != NULL) {
+    drain(r, sp);
+    if (r->lost) {
+      // kept for a client resuming the session
+      spool_dispose(&r->held);
+      r->held = sp;
+      sp = NULL;
+    }
+    spool_dispose(&sp);
+  }
+
+  if (clock_gettime(CLOCK_REALTIME, &times[2]) == -1) {
+    syslog(LOG_ERR, "[cmds] [%zu] clock_gettime: %s", r->id, strerror(errno));
+    r->running = false;
+    exit(EXIT_FAILURE);
+  }
+  complete(r, status, times);
+  long ms = diff_ms(&times[1], &times[2]);
+  if (cl.nstages == 1 && WIFEXITED(status)) {
+    history_record(hist, cl.stages[0].argv, ms);
+  }
+  record_binaries(r, &cl, majflt, ms);
+  syslog(LOG_INFO,
+         "[cmds] [%zu] Finnished executing cmd: [%s] for client[%d] in "
+         "%ldms (expected %.0fms)",
+         r->id, cmd, r->clt.pid, ms, expected_ms);
+  cmdline_free(&cl);
+  return true;
+}
+
+void record_binaries(struct runner *r, const cmdline *cl, const long *majflt,
+                     long ms) {
+  if (!prewarm_on || pw == NULL) {
+    return;
+  }
+  for (size_t i = 0; i < cl->nstages; i++) {
+    char bin[PREWARM_PATH_LEN];
+    if (env_resolve(r->env, cl->stages[i].argv[0], bin, sizeof(bin)) == 0) {
+      prewarm_record(pw, bin, cl->nstages == 1 ? ms : -1, majflt[i]);
+    }
+  }
+}
+
+void complete(struct runner *r, int status, const struct timespec *times) {
+  completion rec = {.exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : -1,
+                    .signal = WIFSIGNALED(status) ? WTERMSIG(status) : 0,
+                    .queued_ms = 0,
+                    .run_ms = 0,
+                    .first_ms = -1,
+                    .bytes = r->out_bytes,
+                    .cpu = r->cpu,
+                    .majflt = (int32_t)r->majflt};
+  if (times != NULL) {
+    rec.queued_ms = diff_ms(&times[0], &times[1]);
+    rec.run_ms = diff_ms(&times[1], &times[2]);
+    if (r->out_bytes > 0) {
+      rec.first_ms = diff_ms(&times[1], &r->first_t);
+    }
+  }
+  syslog(LOG_INFO,
+         "[cmds] [%zu] completed: exit %d signal %d, queued %ldms, first "
+         "byte after %ldms, %zu bytes in %ldms on cpu %d, %d major faults",
+         r->id, rec.exit_code, rec.signal, (long)rec.queued_ms,
+         (long)rec.first_ms, r->out_bytes, (long)rec.run_ms, rec.cpu,
+         rec.majflt);
+  r->last = rec;
+  slot_post(r->sl, &rec);
+}
+
+int open_redirect(struct runner *r, const char *path, bool append,
+                  off_t *size) {
+  // absolute paths are opened as is by openat
+  int fd = openat(
+      r->wd_fd, path,
+      O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC),
+      S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  if (fd == -1) {
+    return -1;
+  }
+  struct stat st;
+  *size = fstat(fd, &st) == -1 ? 0 : st.st_size;
+  return fd;
+}
+
+void close_redirects(size_t n, int redir[][2]) {
+  for (size_t i = 0; i < n; i++) {
+    for (int f = 0; f < 2; f++) {
+      if (redir[i][f] != -1) {
+        close(redir[i][f]);
+        redir[i][f] = -1;
+      }
+    }
+  }
+}
+
+/**
+ * @function  open_pty
+ * @abstract  Open a pseudo terminal in raw mode, the master end then the
+ *            slave end
+ */
+static int open_pty(int fds[2]) {
+  int master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+  if (master == -1) {
+    return -1;
+  }
+  char name[PATH_MAX];
+  int slave = -1;
+  if (grantpt(master) == -1 || unlockpt(master) == -1 ||
+      ptsname_r(master, name, sizeof(name)) != 0 ||
+      (slave = open(name, O_RDWR | O_NOCTTY | O_CLOEXEC)) == -1) {
+    close(master);
+    return -1;
+  }
+  // raw: the output goes through unchanged, no \r added before each \n
+  struct termios tio;
+  if (tcgetattr(slave, &tio) == 0) {
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+  }
+  fds[0] = master;
+  fds[1] = slave;
+  return 0;
+}
+
+int open_stdout(struct runner *r, int fds[2]) {
+  if (r->clt.flags & CLIENT_PTY) {
+    if (open_pty(fds) == 0) {
+      return 0;
+    }
+    // no terminal left: the output still goes through, only later
+    syslog(LOG_WARNING, "[cmds] [%zu] open_pty: %s", r->id, strerror(errno));
+  }
+  return pipe2(fds, O_CLOEXEC);
+}
+
+int open_output(struct runner *r) {
+  if (r->rg == NULL) {
+    // a fifo can't be opened for writing without blocking before its reader
+    r->fd_out = open(r->pipe_out, O_WRONLY | O_CLOEXEC);
+    if (r->fd_out == -1) {
+      return -1;
+    }
+    int flags = fcntl(r->fd_out, F_GETFL);
+    if (flags == -1 || fcntl(r->fd_out, F_SETFL, flags | O_NONBLOCK) == -1) {
+      close(r->fd_out);
+      r->fd_out = -1;
+      return -1;
+    }
+  }
+  r->reading = true;
+  return 0;
+}
+
+/**
+ * @function  close_output
+ * @abstract  Tell the client the output ended
+ */
+static void close_output(struct runner *r) {
+  if (r->fd_out != -1) {
+    close(r->fd_out);
+    r->fd_out = -1;
+  }
+  if (r->rg != NULL) {
+    ring_end(r->rg);
+  }
+  r->reading = false;
+}
+
+/**
+ * @function  client_left
+ * @abstract  Stop sending output to a client that stopped reading it
+ */
+static void client_left(struct runner *r) {
+  syslog(LOG_INFO, "[cmds] [%zu] client[%d] stopped reading: %s", r->id,
+         r->clt.pid, strerror(errno));
+  close_output(r);
+  // the rest of the output is held for a resume
+  r->lost = true;
+}
+
+ssize_t pump(struct runner *r, spool *sp, int in, uint32_t stream) {
+  char buf[SPOOL_CHUNK];
+  // a frame carries what the command already wrote, so that its bytes can be
+  // moved without waiting for more
+  int avail;
+  if (ioctl(in, FIONREAD, &avail) == -1 || avail <= 0) {
+    // end of file, or a channel that can't tell: read says
+    ssize_t n = read(in, buf, sizeof(buf));
+    if (n == -1 && (errno == EINTR || errno == EAGAIN)) {
+      return 1;
+    }
+    // a terminal reports its last writer leaving as an error
+    if (n == -1 && errno == EIO) {
+      return 0;
+    }
+    if (n > 0) {
+      count_output(r, (size_t)n);
+    }
+    if (n > 0 && (r->reading || r->lost)) {
+      if (put_frame(sp, stream, buf, (size_t)n) == -1) {
+        syslog(LOG_ERR, "[cmds] [%zu] spool_write: %s", r->id,
+               strerror(errno));
+        return -1;
+      }
+      forward(r, sp);
+    }
+    return n;
+  }
+
+  size_t len = (size_t)avail < sizeof(buf) ? (size_t)avail : sizeof(buf);
+  frame hdr = {.stream = stream, .len = (uint32_t)len};
+  size_t hdr_sent = 0;
+  size_t data_sent = 0;
+  // nothing spooled: move the bytes to the client without an extra copy,
+  // from pipe to pipe or straight into the ring
+  if (r->reading && spool_pending(sp) == 0) {
+    if (r->rg != NULL && ring_space(r->rg) >= sizeof(hdr) + len) {
+      hdr_sent = ring_write(r->rg, &hdr, sizeof(hdr));
+      while (data_sent < len) {
+        char *space;
+        size_t n = ring_reserve(r->rg, &space);
+        n = n < len - data_sent ? n : len - data_sent;
+        ssize_t got = read(in, space, n);
+        if (got <= 0) {
+          break;
+        }
+        ring_commit(r->rg, (size_t)got);
+        data_sent += (size_t)got;
+      }
+    } else if (r->rg == NULL) {
+      ssize_t w = write(r->fd_out, &hdr, sizeof(hdr));
+      if (w == -1 && errno == EPIPE) {
+        client_left(r);
+      }
+      hdr_sent = w > 0 ? (size_t)w : 0;
+      if (hdr_sent == sizeof(hdr)) {
+        ssize_t m = splice(in, NULL, r->fd_out, NULL, len,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (m == -1 && errno == EPIPE) {
+          client_left(r);
+        }
+        data_sent = m > 0 ? (size_t)m : 0;
+      }
+    }
+  }
+
+  // the rest of the frame waits in the spool
+  ssize_t n = proto_read_full(in, buf, len - data_sent);
+  if (n == -1) {
+    return -1;
+  }
+  count_output(r, len);
+  if ((r->reading || r->lost) &&
+      (spool_write(sp, (char *)&hdr + hdr_sent, sizeof(hdr) - hdr_sent) ==
+           -1 ||
+       spool_write(sp, buf, (size_t)n) == -1)) {
+    syslog(LOG_ERR, "[cmds] [%zu] spool_write: %s", r->id, strerror(errno));
+    return -1;
+  }
+  forward(r, sp);
+  return (ssize_t)len;
+}
+
+int put_frame(spool *sp, uint32_t stream, const void *data, size_t len) {
+  frame hdr = {.stream = stream, .len = (uint32_t)len};
+  if (spool_write(sp, &hdr, sizeof(hdr)) == -1) {
+    return -1;
+  }
+  return data == NULL ? 0 : spool_write(sp, data, len);
+}
+
+void count_output(struct runner *r, size_t n) {
+  if (n > 0 && r->out_bytes == 0) {
+    clock_gettime(CLOCK_REALTIME, &r->first_t);
+  }
+  r->out_bytes += n;
+}
+
+void forward(struct runner *r, spool *sp) {
+  if (!r->reading) {
+    return;
+  }
+  if (r->rg == NULL) {
+    if (spool_flush(sp, r->fd_out) == -1) {
+      client_left(r);
+    }
+    return;
+  }
+  const char *data;
+  size_t len;
+  while ((len = spool_peek(sp, &data)) > 0) {
+    size_t n = ring_write(r->rg, data, len);
+    spool_consume(sp, n);
+    if (n < len) {
+      break;
+    }
+  }
+}
+
+void drain(struct runner *r, spool *sp) {
+  if (!r->reading) {
+    return;
+  }
+  if (r->rg == NULL) {
+    int flags = fcntl(r->fd_out, F_GETFL);
+    if (flags != -1) {
+      fcntl(r->fd_out, F_SETFL, flags & ~O_NONBLOCK);
+    }
+  }
+  forward(r, sp);
+  while (r->reading && spool_pending(sp) > 0) {
+    // a ring has no reader to lose: check the client is still alive while
+    // waiting for it to make room
+    if (r->rg != NULL && ring_wait_space(r->rg, RING_RETRY_MS) == -1 &&
+        kill(r->clt.pid, 0) == -1 && errno == ESRCH) {
+      client_left(r);
+    }
+    forward(r, sp);
+  }
+  if (r->reading) {
+    close_output(r);
+  }
+}
+
+void reply(struct runner *r, const char *fmt, ...) {
+  char *msg = NULL;
+  va_list args_list;
+  va_start(args_list, fmt);
+  int len = vasprintf(&msg, fmt, args_list);
+  va_end(args_list);
+  spool *sp = spool_init(SPOOL_MEM);
+  if (open_output(r) == -1) {
+    syslog(LOG_ERR, "[cmds] [%zu] reply: %s", r->id, strerror(errno));
+  } else if (len == -1 || sp == NULL ||
+             put_frame(sp, STREAM_OUT, msg, (size_t)len) == -1) {
+    // without its message, the client still sees its output end
+    syslog(LOG_ERR, "[cmds] [%zu] reply: %s", r->id, strerror(errno));
+    close_output(r);
+  } else {
+    drain(r, sp);
+  }
+  spool_dispose(&sp);
+  free(len == -1 ? NULL : msg);
+}
+
+int open_wd(struct runner *r) {
+  char path[PIPE_LEN];
+  snprintf(path, sizeof(path), "/proc/%d/cwd", r->clt.pid);
+  int fd = open(path, O_PATH | O_DIRECTORY | O_CLOEXEC);
+  if (fd == -1) {
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    close(fd);
+    return -1;
+  }
+  // the client may have moved, or its pid may have been reused
+  if ((uint64_t)st.st_dev != r->clt.wd_dev ||
+      (uint64_t)st.st_ino != r->clt.wd_ino) {
+    close(fd);
+    errno = ESTALE;
+    return -1;
+  }
+  return fd;
+}
+
+pid_t spawn(struct runner *r, char *argv[], int fd_in, int fd_out,
+            int fd_err) {
+  unsigned cpu_index = spread_cmds ? atomic_fetch_add(&spread_next, 1) : 0;
+  pid_t pid = fork();
+  if (pid == -1) {
+    syslog(LOG_ERR, "[cmds] [%zu] fork: %s", r->id, strerror(errno));
+    return -1;
+  }
+  if (pid > 0) {
+    return pid;
+  }
+
+  if (spread_cmds && topo_pin(cpu_index) == -1) {
+    syslog(LOG_WARNING, "[cmds] [%zu] topo_pin: %s", r->id, strerror(errno));
+  }
+  // the command is limited with its session, not with the daemon
+  if (r->cg_fd != -1 && write(r->cg_fd, "0", 1) == -1) {
+    syslog(LOG_ERR, "[cmds] [%zu] cgroup.procs: %s", r->id, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  if (fchdir(r->wd_fd) == -1) {
+    syslog(LOG_ERR, "[cmds] [%zu] fchdir: %s", r->id, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  if (fd_in != -1 && dup2(fd_in, STDIN_FILENO) == -1) {
+    syslog(LOG_ERR, "[cmds] [%zu] dup2: %s", r->id, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  if (fd_out != -1 && dup2(fd_out, STDOUT_FILENO) == -1) {
+    syslog(LOG_ERR, "[cmds] [%zu] dup2: %s", r->id, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  if (fd_err != -1 && dup2(fd_err, STDERR_FILENO) == -1) {
+    syslog(LOG_ERR, "[cmds] [%zu] dup2: %s", r->id, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  if (r->env != NULL) {
+    env_exec(r->env, argv);
+  } else {
+    execvp(argv[0], argv);
+  }
+
+  syslog(LOG_ERR, "[cmds] [%zu] exec %s: %s", r->id, argv[0],
+         strerror(errno));
+  exit(EXEC_ERROR);
+}
+
+/**
+ * @struct    fan_stream
+ * @abstract  an output of a fan-out command
+ *
+ * @field     fd        read end of the output, -1 once closed
+ * @field     buf       output not yet sent to the client
+ * @field     len       length of buf
+ * @field     cap       allocated size of buf
+ */
+struct fan_stream {
+  int fd;
+  char *buf;
+  size_t len;
+  size_t cap;
+};
+
+/**
+ * @struct    fan_job
+ * @abstract  an input of a fan-out request and the command run for it
+ *
+ * @field     input     the input
+ * @field     argv      the template expanded with the input
+ * @field     pid       the child process
+ * @field     st        the child stdout then stderr
+ * @field     done      has the child been reaped?
+ * @field     lost      was some of its output dropped for lack of memory?
+ * @field     expected  expected runtime of the command
+ * @field     start     time the child was started
+ */
+struct fan_job {
+  const char *input;
+  char **argv;
+  pid_t pid;
+  struct fan_stream st[2];
+  bool done;
+  bool lost;
+  double expected;
+  struct timespec start;
+};
+
+/**
+ * @function  fan_free_argv
+ * @abstract  free an argv allocated by fan_expand
+ */
+static void fan_free_argv(char **argv) {
+  if (argv == NULL) {
+    return;
+  }
+  for (size_t i = 0; argv[i] != NULL; i++) {
+    free(argv[i]);
+  }
+  free(argv);
+}
+
+/**
+ * @function  fan_expand
+ * @abstract  expand the template argv with an input, the strings containing
+ *            the input are allocated, argv is allocated
+ */
+static char **fan_expand(char *tmpl[], size_t tmpl_argc, const char *input) {
+  char **argv = calloc(tmpl_argc + 2, sizeof(char *));
+  if (argv == NULL) {
+    return NULL;
+  }
+  bool used = false;
+  for (size_t i = 0; i < tmpl_argc; i++) {
+    const char *mark = strstr(tmpl[i], FANOUT_MARK);
+    if (mark == NULL) {
+      argv[i] = strdup(tmpl[i]);
+    } else {
+      used = true;
+      size_t pre = (size_t)(mark - tmpl[i]);
+      const char *post = mark + strlen(FANOUT_MARK);
+      size_t len = pre + strlen(input) + strlen(post) + 1;
+      if ((argv[i] = malloc(len)) != NULL) {
+        snprintf(argv[i], len, "%.*s%s%s", (int)pre, tmpl[i], input, post);
+      }
+    }
+    if (argv[i] == NULL) {
+      fan_free_argv(argv);
+      return NULL;
+    }
+  }
+  if (!used && (argv[tmpl_argc] = strdup(input)) == NULL) {
+    fan_free_argv(argv);
+    return NULL;
+  }
+  return argv;
+}
+
+/**
+ * @function  fan_spawn
+ * @abstract  start the command of a job with its stdout in a new pipe
+ */
+static bool fan_spawn(struct runner *r, struct fan_job *job) {
+  int out[2];
+  int err[2];
+  if (open_stdout(r, out) == -1) {
+    syslog(LOG_ERR, "[cmds] [%zu] open_stdout: %s", r->id, strerror(errno));
+    return false;
+  }
+  if (pipe2(err, O_CLOEXEC) == -1) {
+    syslog(LOG_ERR, "[cmds] [%zu] pipe2: %s", r->id, strerror(errno));
+    close(out[0]);
+    close(out[1]);
+    return false;
+  }
+  if (clock_gettime(CLOCK_REALTIME, &job->start) == -1) {
+    syslog(LOG_ERR, "[cmds] [%zu] clock_gettime: %s", r->id, strerror(errno));
+  }
+  job->pid = spawn(r, job->argv, -1, out[1], err[1]);
+  close(out[1]);
+  close(err[1]);
+  if (job->pid == -1) {
+    close(out[0]);
+    close(err[0]);
+    return false;
+  }
+  job->st[0].fd = out[0];
+  job->st[1].fd = err[0];
+  return true;
+}
+
+/**
+ * @function  fan_flush
+ * @abstract  spool an output of a job for the client. Tagged output is
+ *            spooled by whole lines prefixed by the input, the last partial
+ *            line only once the output is closed.
+ * @param   i     0 for the stdout of the job, 1 for its stderr
+ */
+static int fan_flush(spool *sp, struct fan_job *job, int i, bool tagged) {
+  struct fan_stream *st = &job->st[i];
+  uint32_t stream = (uint32_t)(STREAM_OUT + i);
+  if (!tagged) {
+    int rc = st->len == 0 ? 0 : put_frame(sp, stream, st->buf, st->len);
+    st->len = 0;
+    return rc;
+  }
+  size_t sent = 0;
+  size_t tag = strlen(job->input);
+  for (;;) {
+    char *nl = memchr(st->buf + sent, '\n', st->len - sent);
+    size_t line;
+    if (nl != NULL) {
+      line = (size_t)(nl - (st->buf + sent)) + 1;
+    } else if (st->fd == -1 && sent < st->len) {
+      line = st->len - sent;
+    } else {
+      break;
+    }
+    if (put_frame(sp, stream, NULL, tag + 1 + line + (nl == NULL)) == -1 ||
+        spool_write(sp, job->input, tag) == -1 ||
+        spool_write(sp, "\t", 1) == -1 ||
+        spool_write(sp, st->buf + sent, line) == -1 ||
+        (nl == NULL && spool_write(sp, "\n", 1) == -1)) {
+      st->len = 0;
+      return -1;
+    }
+    sent += line;
+  }
+  memmove(st->buf, st->buf + sent, st->len - sent);
+  st->len -= sent;
+  return 0;
+}
+
+/**
+ * @function  fan_read
+ * @abstract  read what is available on an output of a job
+ * @param   i     0 for the stdout of the job, 1 for its stderr
+ * @result  bool  is the output closed?
+ */
+static bool fan_read(struct runner *r, struct fan_job *job, int i) {
+  struct fan_stream *st = &job->st[i];
+  if (st->cap - st->len < FANOUT_CHUNK) {
+    char *buf = realloc(st->buf, st->cap + FANOUT_CHUNK);
+    if (buf == NULL) {
+      // the child must still be drained, its input fails
+      syslog(LOG_ERR, "[cmds] [%zu] realloc: %s", r->id, strerror(errno));
+      job->lost = true;
+      st->len = 0;
+    } else {
+      st->buf = buf;
+      st->cap += FANOUT_CHUNK;
+    }
+  }
+  char scratch[FANOUT_CHUNK];
+  bool room = st->cap > st->len;
+  ssize_t n = room ? read(st->fd, st->buf + st->len, st->cap - st->len)
+                   : read(st->fd, scratch, sizeof(scratch));
+  if (n > 0) {
+    st->len += room ? (size_t)n : 0;
+    count_output(r, (size_t)n);
+    return false;
+  }
+  if (n == -1 && errno == EINTR) {
+    return false;
+  }
+  close(st->fd);
+  st->fd = -1;
+  return true;
+}
+
+bool run_fanout(struct runner *r, char *payload, size_t len) {
+  // receipt, start and end of the fan-out
+  struct timespec times[3];
+  if (clock_gettime(CLOCK_REALTIME, &times[0]) == -1) {
+    syslog(LOG_ERR, "[cmds] [%zu] clock_gettime: %s", r->id, strerror(errno));
+  }
+  r->out_bytes = 0;
+  r->cpu = -1;
+  r->majflt = 0;
+
+  fanout fo;
+  if (len < sizeof(fo)) {
+    syslog(LOG_ERR, "[cmds] [%zu] fan-out request too short", r->id);
+    reply(r, "cmds: invalid fan-out request\n");
+    complete(r, CMD_ERROR << 8, NULL);
+    return true;
+  }
+  memcpy(&fo, payload, sizeof(fo));
+  // each input takes at least its terminating null byte
+  if (fo.ninputs > len - sizeof(fo)) {
+    syslog(LOG_ERR, "[cmds] [%zu] fan-out request truncated", r->id);
+    reply(r, "cmds: invalid fan-out request\n");
+    complete(r, CMD_ERROR << 8, NULL);
+    return true;
+  }
+
+  // the template then the inputs, each null terminated
+  char *tmpl = payload + sizeof(fo);
+  char *end = payload + len;
+  struct fan_job *jobs = calloc(fo.ninputs, sizeof(struct fan_job));
+  if (jobs == NULL && fo.ninputs > 0) {
+    syslog(LOG_ERR, "[cmds] [%zu] calloc: %s", r->id, strerror(errno));
+    reply(r, "cmds: %s\n", strerror(errno));
+    complete(r, CMD_ERROR << 8, NULL);
+    return true;
+  }
+  char *p = tmpl + strnlen(tmpl, (size_t)(end - tmpl)) + 1;
+  for (size_t i = 0; i < fo.ninputs; i++) {
+    if (p >= end) {
+      syslog(LOG_ERR, "[cmds] [%zu] fan-out request truncated", r->id);
+      reply(r, "cmds: invalid fan-out request\n");
+      complete(r, CMD_ERROR << 8, NULL);
+      free(jobs);
+      return true;
+    }
+    jobs[i].input = p;
+    jobs[i].st[0].fd = jobs[i].st[1].fd = -1;
+    p += strnlen(p, (size_t)(end - p)) + 1;
+  }
+  syslog(LOG_INFO, "[cmds] [%zu] received fan-out:%s over %u inputs from [%d]",
+         r->id, tmpl, fo.ninputs, r->clt.pid);
+
+  cmdline cl;
+  if (cmdline_parse(tmpl, &cl) == -1 || cl.nstages != 1) {
+    syslog(LOG_ERR, "[cmds] [%zu] invalid fan-out template: [%s]", r->id,
+           tmpl);
+    reply(r, "cmds: invalid fan-out template\n");
+    complete(r, CMD_ERROR << 8, NULL);
+    cmdline_free(&cl);
+    free(jobs);
+    return true;
+  }
+
+  // the client's parallelism sizes the poll arrays below: no more than the
+  // pool nor the inputs
+  size_t parallel = exec_slots;
+  if (fo.parallel > 0 && fo.parallel < parallel) {
+    parallel = fo.parallel;
+  }
+  if (fo.ninputs < parallel) {
+    parallel = fo.ninputs > 0 ? fo.ninputs : 1;
+  }
+  bool tagged = !fo.ordered;
+  spool *sp = spool_init(SPOOL_MEM);
+  if (sp == NULL || open_output(r) == -1) {
+    syslog(LOG_ERR, "[cmds] [%zu] open_output: %s", r->id, strerror(errno));
+    spool_dispose(&sp);
+    complete(r, CMD_ERROR << 8, NULL);
+    cmdline_free(&cl);
+    free(jobs);
+    return true;
+  }
+
+  size_t next = 0, active = 0, emit = 0, failed = 0;
+  struct pollfd fds[2 * parallel + 1];
+  size_t fd_job[2 * parallel];
+  int fd_stream[2 * parallel];
+  if (clock_gettime(CLOCK_REALTIME, &times[1]) == -1) {
+    syslog(LOG_ERR, "[cmds] [%zu] clock_gettime: %s", r->id, strerror(errno));
+  }
+
+  while (next < fo.ninputs || active > 0) {
+    // start as many inputs as the parallelism and the pool allow, waiting
+    // for a slot only when none of our commands can free one
+    while (next < fo.ninputs && active < parallel) {
+      struct fan_job *job = &jobs[next];
+      // a job left waiting for a slot keeps its argv for the next try
+      if (job->argv == NULL) {
+        job->argv =
+            fan_expand(cl.stages[0].argv, cl.stages[0].argc, job->input);
+        if (job->argv == NULL) {
+          syslog(LOG_ERR, "[cmds] [%zu] fan_expand: %s", r->id,
+                 strerror(errno));
+          job->done = true;
+          failed++;
+          next++;
+          continue;
+        }
+        job->expected = history_predict(hist, job->argv);
+      }
+      if (active > 0 && !runq_try_acquire(exec_runq)) {
+        break;
+      }
+      if (active == 0 && runq_acquire(exec_runq, job->expected) == -1) {
+        syslog(LOG_ERR, "[cmds] [%zu] runq_acquire: %s", r->id,
+               strerror(errno));
+        r->running = false;
+        exit(EXIT_FAILURE);
+      }
+      if (!fan_spawn(r, job)) {
+        runq_release(exec_runq);
+        job->done = true;
+        failed++;
+      } else {
+        active++;
+      }
+      next++;
+    }
+
+    nfds_t nfds = 0;
+    for (size_t i = emit; i < next; i++) {
+      for (int k = 0; k < 2; k++) {
+        if (jobs[i].st[k].fd != -1) {
+          fds[nfds].fd = jobs[i].st[k].fd;
+          fds[nfds].events = POLLIN;
+          fd_stream[nfds] = k;
+          fd_job[nfds++] = i;
+        }
+      }
+    }
+    nfds_t njobs = nfds;
+    bool pending = r->reading && spool_pending(sp) > 0;
+    if (pending && r->rg == NULL) {
+      fds[nfds].fd = r->fd_out;
+      fds[nfds++].events = POLLOUT;
+    }
+    // retry soon to get a slot freed by another session, or room in a ring
+    int timeout = next < fo.ninputs && active < parallel ? FANOUT_RETRY_MS
+                  : pending && r->rg != NULL               ? RING_RETRY_MS
+                                                           : -1;
+    if (njobs > 0 && poll(fds, nfds, timeout) == -1 && errno != EINTR) {
+      syslog(LOG_ERR, "[cmds] [%zu] poll: %s", r->id, strerror(errno));
+      break;
+    }
+
+    for (nfds_t i = 0; i < njobs; i++) {
+      if (fds[i].revents == 0) {
+        continue;
+      }
+      struct fan_job *job = &jobs[fd_job[i]];
+      int k = fd_stream[i];
+      fan_read(r, job, k);
+      if (!r->reading) {
+        // the client left, keep reaping the children
+        job->st[k].len = 0;
+      }
+      if (job->st[0].fd == -1 && job->st[1].fd == -1) {
+        int status;
+        struct rusage ru;
+        long job_majflt = -1;
+        if (wait4(job->pid, &status, 0, &ru) != -1) {
+          job_majflt = ru.ru_majflt;
+          r->majflt += job_majflt;
+        }
+        runq_release(exec_runq);
+        active--;
+        job->done = true;
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        long job_ms = diff_ms(&job->start, &now);
+        char bin[PREWARM_PATH_LEN];
+        if (pw != NULL &&
+            env_resolve(r->env, job->argv[0], bin, sizeof(bin)) == 0) {
+          prewarm_record(pw, bin, job_ms, job_majflt);
+        }
+        if (job->lost) {
+          char msg[256];
+          int l = snprintf(msg, sizeof(msg), "cmds: output of %s lost: %s\n",
+                           job->input, strerror(ENOMEM));
+          if (put_frame(sp, STREAM_ERR, msg,
+                        l < (int)sizeof(msg) ? (size_t)l : sizeof(msg) - 1) ==
+              -1) {
+            syslog(LOG_ERR, "[cmds] [%zu] spool_write: %s", r->id,
+                   strerror(errno));
+          }
+          failed++;
+        } else if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS) {
+          history_record(hist, job->argv, job_ms);
+        } else {
+          failed++;
+        }
+      }
+      if (tagged && fan_flush(sp, job, k, true) == -1) {
+        syslog(LOG_ERR, "[cmds] [%zu] spool_write: %s", r->id,
+               strerror(errno));
+      }
+    }
+
+    // ordered: stream the oldest running input, release finished ones
+    for (; emit < next; emit++) {
+      struct fan_job *job = &jobs[emit];
+      if (!tagged && (fan_flush(sp, job, 0, false) == -1 ||
+                      fan_flush(sp, job, 1, false) == -1)) {
+        syslog(LOG_ERR, "[cmds] [%zu] spool_write: %s", r->id,
+               strerror(errno));
+      }
+      if (!job->done) {
+        break;
+      }
+      for (int k = 0; k < 2; k++) {
+        free(job->st[k].buf);
+        job->st[k].buf = NULL;
+      }
+      fan_free_argv(job->argv);
+      job->argv = NULL;
+    }
+    forward(r, sp);
+  }
+
+  // every command is done and its slot given back, the client reads the rest
+  // at its own pace
+  drain(r, sp);
+  spool_dispose(&sp);
+  for (size_t i = 0; i < fo.ninputs; i++) {
+    free(jobs[i].st[0].buf);
+    free(jobs[i].st[1].buf);
+    fan_free_argv(jobs[i].argv);
+  }
+  free(jobs);
+  cmdline_free(&cl);
+
+  clock_gettime(CLOCK_REALTIME, &times[2]);
+  // like a shell loop, the fan-out fails if any of its inputs failed
+  complete(r, (failed > 0 ? EXIT_FAILURE : EXIT_SUCCESS) << 8, times);
+  syslog(LOG_INFO,
+         "[cmds] [%zu] Finnished fan-out: [%s] for client[%d] in %ldms, "
+         "%zu/%u inputs failed",
+         r->id, tmpl, r->clt.pid, diff_ms(&times[1], &times[2]), failed,
+         fo.ninputs);
+  return true;
+}
+
+long diff_ms(const struct timespec *start, const struct timespec *end) {
+  return (long)(end->tv_sec - start->tv_sec) * 1000 +
+         (end->tv_nsec - start->tv_nsec) / 1000000;
+}
+
+void print_stats(void) {
+  linker *first = linker_connect(LINKER_SHM);
+  if (first == NULL) {
+    fprintf(stderr, "Error: Can't connect to the linker.\n");
+    exit(EXIT_FAILURE);
+  }
+  unsigned n = linker_shards(first);
+  for (unsigned s = 0; s < n; s++) {
+    linker *l = first;
+    if (s > 0) {
+      char name[PIPE_LEN];
+      linker_name(name, sizeof(name), s);
+      if ((l = linker_connect(name)) == NULL) {
+        fprintf(stderr, "Error: Can't connect to the linker of shard %u.\n",
+                s);
+        exit(EXIT_FAILURE);
+      }
+    }
+    unsigned busy;
+    linker_load(l, &busy);
+    printf("shard %u: %u/%d runners busy\n", s, busy, CAPACITY);
+    printf("lane\tdepth\tbytes\tpushed\tpopped\n");
+    for (unsigned i = 0; i < LINKER_LANES; i++) {
+      lane_stats st;
+      if (linker_stats(l, i, &st) == -1) {
+        fprintf(stderr, "Error: Can't read lane %u.\n", i);
+        exit(EXIT_FAILURE);
+      }
+      printf("%u\t%zu\t%zu\t%lu\t%lu\n", i, st.depth, st.bytes, st.pushed,
+             st.popped);
+    }
+    print_binaries(s);
+    if (l != first) {
+      linker_disconnect(&l);
+    }
+  }
+  linker_disconnect(&first);
+  print_cgroups();
+}
+
+void print_cgroups(void) {
+  pid_t pid = get_dpid();
+  char base[PATH_MAX];
+  if (pid == -1 || cgroup_base(pid, base, sizeof(base)) != 1) {
+    return;
+  }
+  printf("cgroups of %s\n", base);
+  printf("cgroup\tprocs\tmemory\tcpu\tmemory\tio\n");
+  print_cgroup("total", base);
+  char dir[PATH_MAX + 80];
+  snprintf(dir, sizeof(dir), "%s/%s", base, CGROUP_DAEMON);
+  print_cgroup(CGROUP_DAEMON, dir);
+  // the sessions of a daemon handing over may be there too
+  size_t ids[2 * SHARDS_MAX * CAPACITY];
+  size_t n = cgroup_sessions(base, ids, sizeof(ids) / sizeof(ids[0]));
+  for (size_t i = 0; i < n; i++) {
+    char name[64];
+    snprintf(name, sizeof(name), "%s%zu", CGROUP_PREFIX, ids[i]);
+    snprintf(dir, sizeof(dir), "%s/%s", base, name);
+    print_cgroup(name, dir);
+  }
+}
+
+void print_cgroup(const char *name, const char *dir) {
+  cgroup_stat st;
+  if (cgroup_read(dir, &st) == -1) {
+    return;
+  }
+  char cells[4][32];
+  snprintf(cells[0], sizeof(cells[0]), st.memory < 0 ? "-" : "%lldK",
+           (st.memory + 1023) >> 10);
+  double psi[3] = {st.cpu_some, st.memory_some, st.io_some};
+  for (int i = 0; i < 3; i++) {
+    snprintf(cells[i + 1], sizeof(cells[i + 1]), psi[i] < 0 ? "-" : "%.2f%%",
+             psi[i]);
+  }
+  printf("%s\t%ld\t%s\t%s\t%s\t%s\n", name, st.procs, cells[0], cells[1],
+         cells[2], cells[3]);
+}
+
+void print_binaries(unsigned s) {
+  char path[PATH_MAX];
+  if (s == 0) {
+    snprintf(path, sizeof(path), "%s", PREWARM_FILE);
+  } else {
+    snprintf(path, sizeof(path), "%s.%u", PREWARM_FILE, s);
+  }
+  // the stats must not create nor reset the counts of a daemon
+  prewarm *counts = prewarm_open_readonly(path);
+  if (counts == NULL) {
+    return;
+  }
+  prewarm_stat top[PREWARM_TOP];
+  size_t n = prewarm_top(counts, top, PREWARM_TOP);
+  prewarm_close(&counts);
+  if (n == 0) {
+    return;
+  }
+  printf("runs\tcold\tcold ms\twarm ms\tcached\tlocked\tbinary\n");
+  for (size_t i = 0; i < n; i++) {
+    char ms[2][32];
+    for (int k = 0; k < 2; k++) {
+      double x = k == 0 ? top[i].cold_ms : top[i].warm_ms;
+      snprintf(ms[k], sizeof(ms[k]), x < 0 ? "-" : "%.0f", x);
+    }
+    printf("%lu\t%lu\t%s\t%s\t%d%%\t%luK\t%s\n", top[i].runs,
+           top[i].cold_runs, ms[0], ms[1], prewarm_resident(top[i].path),
+           (top[i].locked + 1023) >> 10, top[i].path);
+  }
+}
+
+void handler(int signum) {
+  if (signum == SIGTERM) {
+    syslog(LOG_INFO, "[cmds] Daemon Stopped");
     cleanup();
     exit(EXIT_SUCCESS);
   } else if (signum == SIG_SUCCESS) {
@@ -687,3 +3605,24 @@ void handler(int signum) {
   }
   quit("wrong signal [%d]", signum);
 }
+
+void drain_handler(int signum, siginfo_t *info, void *ctx) {
+  (void)ctx;
+  if (drain_mode != DRAIN_NONE) {
+    return;
+  }
+  drain_mode = signum == SIG_HANDOVER ? DRAIN_HANDOVER : DRAIN_STOP;
+  if (info->si_code == SI_QUEUE && info->si_value.sival_int > 0) {
+    drain_ms = info->si_value.sival_int;
+  }
+  union sigval deadline = {.sival_int = drain_ms};
+  for (unsigned i = 1; shard == 0 && i < nshards; i++) {
+    if (shard_pids[i] > 0) {
+      sigqueue(shard_pids[i], signum, deadline);
+    }
+  }
+  // the pipe stays readable, waking every runner waiting for a request
+  if (write(drain_pipe[1], "", 1) == -1) {
+    return;
+  }
+}
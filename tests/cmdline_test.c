@@ -0,0 +1,66 @@
+#ifdef _XOPEN_SOURCE
+#undef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 700
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "cmdline.h"
+
+/**
+ * @function  same
+ * @abstract  are two optional strings equal?
+ */
+static bool same(const char *a, const char *b) {
+  return a == NULL ? b == NULL : b != NULL && strcmp(a, b) == 0;
+}
+
+/**
+ * @function  check
+ * @abstract  parse a line and check its last stage
+ * @param   line    the command line
+ * @param   ok      should it parse?
+ * @param   argc    expected number of words of the last stage
+ * @param   out     expected stdout target of the last stage, NULL for none
+ * @param   err     expected stderr target of the last stage, NULL for none
+ * @result  bool    did the line parse as expected?
+ */
+static bool check(const char *line, bool ok, size_t argc, const char *out,
+                  const char *err) {
+  cmdline cl;
+  int rc = cmdline_parse(line, &cl);
+  bool pass;
+  if (rc == -1) {
+    pass = !ok && errno == EINVAL;
+  } else {
+    const stage *st = &cl.stages[cl.nstages - 1];
+    pass = ok && st->argc == argc && same(st->out, out) && same(st->err, err);
+    cmdline_free(&cl);
+  }
+  printf("%s: [%s] %s\n", pass ? "ok" : "FAIL", line,
+         ok ? "parsed" : "refused");
+  return pass;
+}
+
+int main(void) {
+  bool ok = true;
+
+  ok = check("ls -l > out 2>> err", true, 2, "out", "err") && ok;
+  ok = check("echo a|wc -c>n", true, 2, "n", NULL) && ok;
+  ok = check("echo '&1' > '&1'", true, 2, "&1", NULL) && ok;
+  ok = check("echo a > \\&1", true, 2, "&1", NULL) && ok;
+  ok = check("ls x 2>&1", false, 0, NULL, NULL) && ok;
+  ok = check("ls x >&2", false, 0, NULL, NULL) && ok;
+  ok = check("ls x >>&2", false, 0, NULL, NULL) && ok;
+  ok = check("ls x 2> &1", false, 0, NULL, NULL) && ok;
+  ok = check("ls x 2>&1 | wc -l", false, 0, NULL, NULL) && ok;
+  ok = check("ls >", false, 0, NULL, NULL) && ok;
+  ok = check("ls | | wc", false, 0, NULL, NULL) && ok;
+  ok = check("echo 'a", false, 0, NULL, NULL) && ok;
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
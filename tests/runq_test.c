@@ -0,0 +1,158 @@
+#ifdef _XOPEN_SOURCE
+#undef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 700
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "config.h"
+#include "runq.h"
+
+/**
+ * @define  POLL_MS   time between two checks that a thread is waiting
+ */
+#ifndef POLL_MS
+#define POLL_MS 1
+#endif
+
+/**
+ * @struct    job
+ * @abstract  a command waiting for the slot held by the test
+ *
+ * @field     q             the run queue
+ * @field     expected_ms   expected runtime of the command
+ * @field     name          name printed when the order is wrong
+ * @field     thread        the thread waiting
+ */
+struct job {
+  runq *q;
+  double expected_ms;
+  const char *name;
+  pthread_t thread;
+};
+
+static pthread_mutex_t order_mutex = PTHREAD_MUTEX_INITIALIZER;
+static const char *order[8];
+static size_t norder;
+
+/**
+ * @function  sleep_ms
+ * @abstract  sleep for ms milliseconds
+ */
+static void sleep_ms(long ms) {
+  struct timespec t = {.tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000};
+  while (nanosleep(&t, &t) == -1) {
+  }
+}
+
+/**
+ * @function  wait_queued
+ * @abstract  wait for n commands to be waiting for a slot
+ */
+static void wait_queued(runq *q, size_t n) {
+  while (runq_waiting(q) < n) {
+    sleep_ms(POLL_MS);
+  }
+}
+
+/**
+ * @function  run
+ * @abstract  take a slot, note the order it was granted in, give it back
+ */
+static void *run(void *arg) {
+  struct job *j = arg;
+  if (runq_acquire(j->q, j->expected_ms) == -1) {
+    perror("runq_acquire");
+    exit(EXIT_FAILURE);
+  }
+  pthread_mutex_lock(&order_mutex);
+  order[norder++] = j->name;
+  pthread_mutex_unlock(&order_mutex);
+  runq_release(j->q);
+  return NULL;
+}
+
+/**
+ * @function  dispatch
+ * @abstract  hold the only slot of a run queue while the jobs queue up, one
+ *            after the other, gap_ms apart, then release it and check the
+ *            order the jobs got it in
+ * @param   title   name of the test
+ * @param   jobs    the jobs, in the order they queue up
+ * @param   n       number of jobs
+ * @param   gap_ms  time a job waits before the next one queues up
+ * @param   want    names of the jobs in the expected order
+ * @result  bool    was the order the expected one?
+ */
+static bool dispatch(const char *title, struct job *jobs, size_t n,
+                     long gap_ms, const char *const *want) {
+  runq *q = runq_init(1);
+  if (q == NULL || runq_acquire(q, 0) == -1) {
+    perror("runq_init");
+    exit(EXIT_FAILURE);
+  }
+  norder = 0;
+  for (size_t i = 0; i < n; i++) {
+    jobs[i].q = q;
+    if (pthread_create(&jobs[i].thread, NULL, run, &jobs[i]) != 0) {
+      perror("pthread_create");
+      exit(EXIT_FAILURE);
+    }
+    wait_queued(q, i + 1);
+    if (i + 1 < n) {
+      sleep_ms(gap_ms);
+    }
+  }
+  runq_release(q);
+  for (size_t i = 0; i < n; i++) {
+    pthread_join(jobs[i].thread, NULL);
+  }
+  runq_dispose(&q);
+
+  bool ok = norder == n;
+  for (size_t i = 0; ok && i < n; i++) {
+    ok = order[i] == want[i];
+  }
+  printf("%s: %s", ok ? "ok" : "FAIL", title);
+  if (!ok) {
+    printf(" (got");
+    for (size_t i = 0; i < norder; i++) {
+      printf(" %s", order[i]);
+    }
+    printf(")");
+  }
+  printf("\n");
+  return ok;
+}
+
+int main(void) {
+  bool ok = true;
+
+  // free slots are taken right away, only the last one is refused
+  runq *q = runq_init(2);
+  bool free_ok = q != NULL && runq_try_acquire(q) && runq_try_acquire(q) &&
+                 !runq_try_acquire(q);
+  printf("%s: free slots taken at once\n", free_ok ? "ok" : "FAIL");
+  runq_dispose(&q);
+  ok = ok && free_ok;
+
+  // queued longest first, granted shortest expected first
+  struct job sejf[] = {{.expected_ms = 3000, .name = "3000ms"},
+                       {.expected_ms = 1000, .name = "1000ms"},
+                       {.expected_ms = 2000, .name = "2000ms"}};
+  const char *sejf_want[] = {"1000ms", "2000ms", "3000ms"};
+  ok = dispatch("shortest expected first", sejf, 3, 0, sejf_want) && ok;
+
+  // a long command waiting long enough goes before a newer short one
+  long waited = (long)(600 / RUNQ_AGING);
+  struct job aging[] = {{.expected_ms = 300, .name = "old 300ms"},
+                        {.expected_ms = 100, .name = "new 100ms"}};
+  const char *aging_want[] = {"old 300ms", "new 100ms"};
+  ok = dispatch("aging", aging, 2, waited, aging_want) && ok;
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,193 @@
+#ifdef _XOPEN_SOURCE
+#undef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 700
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "config.h"
+#include "proto.h"
+
+/**
+ * @struct    cap_header
+ * @abstract  start of a capture file
+ *
+ * @field     magic     CAPTURE_MAGIC
+ * @field     start     wall clock second the capture started
+ */
+struct cap_header {
+  uint64_t magic;
+  int64_t start;
+};
+
+struct capture {
+  int fd;
+  struct timespec start;
+  uint32_t next;
+  uint32_t step;
+  pthread_mutex_t mutex;
+};
+
+#define FUN_FAILURE -1
+#define FUN_SUCCESS 0
+
+/**
+ * @function  _append
+ * @abstract  append a record and its payload, stamped with the time elapsed
+ *            since the start of the capture
+ */
+static int _append(capture *c, cap_record *rec, const char *payload) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  rec->t_us = (uint64_t)(now.tv_sec - c->start.tv_sec) * 1000000 +
+              (uint64_t)(now.tv_nsec / 1000) -
+              (uint64_t)(c->start.tv_nsec / 1000);
+  struct iovec iov[2] = {{.iov_base = rec, .iov_len = sizeof(*rec)},
+                         {.iov_base = (void *)payload, .iov_len = rec->len}};
+  size_t total = sizeof(*rec) + rec->len;
+  // a single write keeps the record whole, the file being opened to append
+  ssize_t w = writev(c->fd, iov, rec->len > 0 ? 2 : 1);
+  if (w == -1) {
+    perror("writev");
+    return FUN_FAILURE;
+  }
+  if ((size_t)w != total) {
+    errno = ENOSPC;
+    perror("writev");
+    return FUN_FAILURE;
+  }
+  return FUN_SUCCESS;
+}
+
+capture *capture_open(const char *path) {
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC,
+                S_IRUSR | S_IWUSR);
+  if (fd == -1) {
+    perror("open");
+    return NULL;
+  }
+  struct cap_header hdr = {.magic = CAPTURE_MAGIC,
+                           .start = (int64_t)time(NULL)};
+  if (proto_write_full(fd, &hdr, sizeof(hdr)) == -1) {
+    perror("write");
+    close(fd);
+    return NULL;
+  }
+
+  capture *c = malloc(sizeof(capture));
+  if (c == NULL) {
+    perror("malloc");
+    close(fd);
+    return NULL;
+  }
+  c->fd = fd;
+  c->next = 1;
+  c->step = 1;
+  clock_gettime(CLOCK_MONOTONIC, &c->start);
+  if (pthread_mutex_init(&c->mutex, NULL) != 0) {
+    perror("pthread_mutex_init");
+    close(fd);
+    free(c);
+    return NULL;
+  }
+  return c;
+}
+
+void capture_shard(capture *c, unsigned shard, unsigned shards) {
+  c->next = (uint32_t)shard + 1;
+  c->step = (uint32_t)shards;
+}
+
+uint32_t capture_session(capture *c, unsigned lane, unsigned flags,
+                         const char *wd) {
+  if (wd == NULL) {
+    wd = "";
+  }
+  cap_record rec = {.len = (uint32_t)strlen(wd),
+                    .type = CAP_SESSION,
+                    .lane = (uint16_t)lane,
+                    .flags = (uint32_t)flags};
+  pthread_mutex_lock(&c->mutex);
+  rec.session = c->next;
+  c->next += c->step;
+  int rc = _append(c, &rec, wd);
+  pthread_mutex_unlock(&c->mutex);
+  return rc == FUN_SUCCESS ? rec.session : 0;
+}
+
+int capture_command(capture *c, uint32_t session, const char *line) {
+  cap_record rec = {
+      .session = session, .len = (uint32_t)strlen(line), .type = CAP_CMD};
+  pthread_mutex_lock(&c->mutex);
+  int rc = _append(c, &rec, line);
+  pthread_mutex_unlock(&c->mutex);
+  return rc;
+}
+
+int capture_end(capture *c, uint32_t session) {
+  cap_record rec = {.session = session, .len = 0, .type = CAP_END};
+  pthread_mutex_lock(&c->mutex);
+  int rc = _append(c, &rec, NULL);
+  pthread_mutex_unlock(&c->mutex);
+  return rc;
+}
+
+void capture_close(capture **capture_p) {
+  capture *c = *capture_p;
+  if (c == NULL) {
+    return;
+  }
+  if (close(c->fd) == -1) {
+    perror("close");
+  }
+  pthread_mutex_destroy(&c->mutex);
+  free(c);
+  *capture_p = NULL;
+}
+
+int capture_check(int fd, int64_t *start) {
+  struct cap_header hdr;
+  ssize_t r = proto_read_full(fd, &hdr, sizeof(hdr));
+  if (r == -1) {
+    return FUN_FAILURE;
+  }
+  if ((size_t)r != sizeof(hdr) || hdr.magic != CAPTURE_MAGIC) {
+    errno = EINVAL;
+    return FUN_FAILURE;
+  }
+  *start = hdr.start;
+  return FUN_SUCCESS;
+}
+
+int capture_next(int fd, cap_record *rec, char **payload) {
+  ssize_t r = proto_read_full(fd, rec, sizeof(*rec));
+  if (r <= 0) {
+    return (int)r;
+  }
+  // a capture cut by a crash ends with a partial record
+  if ((size_t)r != sizeof(*rec) || rec->len > REQ_MAX) {
+    return 0;
+  }
+  *payload = malloc((size_t)rec->len + 1);
+  if (*payload == NULL) {
+    perror("malloc");
+    return FUN_FAILURE;
+  }
+  r = proto_read_full(fd, *payload, rec->len);
+  if (r == -1 || (size_t)r != rec->len) {
+    free(*payload);
+    return r == -1 ? FUN_FAILURE : 0;
+  }
+  (*payload)[rec->len] = 0;
+  return 1;
+}
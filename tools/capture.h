@@ -0,0 +1,125 @@
+#ifndef CAPTURE__H
+#define CAPTURE__H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+* @define CAPTURE_MAGIC marks a file holding a capture of this layout
+*/
+#define CAPTURE_MAGIC 0x636d647363617031ULL
+
+/**
+* @enum   cap_type
+*         kinds of records of a capture
+* @const  CAP_SESSION   a session arrived, refused or not. The payload is its
+*                       working directory, empty if it could not be read.
+* @const  CAP_CMD       a command line sent by a session
+* @const  CAP_END       the end of a session
+*/
+enum cap_type { CAP_SESSION = 1, CAP_CMD = 2, CAP_END = 3 };
+
+/**
+* @typedef struct cap_record
+*         header of each record of a capture, following the file header:
+*         the CAPTURE_MAGIC and the wall clock second the capture started
+* @field    t_us      microseconds elapsed since the capture started
+* @field    session   number of the session in the capture, from 1, in
+*                     the order they arrived in a shard
+* @field    len       length of the payload following the header
+* @field    type      the cap_type of the record
+* @field    lane      priority lane of a CAP_SESSION, 0 otherwise
+* @field    flags     CLIENT_* options of a CAP_SESSION, 0 otherwise
+*/
+typedef struct cap_record {
+  uint64_t t_us;
+  uint32_t session;
+  uint32_t len;
+  uint16_t type;
+  uint16_t lane;
+  uint32_t flags;
+} cap_record;
+
+/**
+* @typedef capture
+*         a capture file being written by the daemon, records being appended
+*         by any thread. Environments are not captured as they may hold
+*         secrets.
+* @field    fd        the capture file
+* @field    start     time the capture started
+* @field    next      number of the next session
+* @field    step      gap between the numbers of two sessions, the shards
+*                     of the daemon sharing the file
+* @field    mutex     keeps records whole between threads
+*/
+typedef struct capture capture;
+
+/**
+ * @function  capture_open
+ * @abstract  create or truncate a capture file and write its header
+ * @param   path    the file storing the capture
+ */
+extern capture *capture_open(const char *path);
+/**
+ * @function  capture_shard
+ * @abstract  number the sessions of a shard apart from the other shards
+ *            writing the same capture: shard + 1, then every shards
+ * @param   c       the capture to use, opened before the shards forked
+ * @param   shard   the shard of the calling process
+ * @param   shards  number of shards
+ */
+extern void capture_shard(capture *c, unsigned shard, unsigned shards);
+/**
+ * @function  capture_session
+ * @abstract  record the arrival of a session
+ * @param   c       the capture to use
+ * @param   lane    priority lane of the session
+ * @param   flags   CLIENT_* options of the session
+ * @param   wd      working directory of the session, NULL if unknown
+ * @result  uint32_t  the number of the session in the capture, 0 on failure
+ */
+extern uint32_t capture_session(capture *c, unsigned lane, unsigned flags,
+                                const char *wd);
+/**
+ * @function  capture_command
+ * @abstract  record a command line sent by a session
+ * @param   c       the capture to use
+ * @param   session the number of the session
+ * @param   line    the command line
+ * @result  int     0 on success, -1 on failure
+ */
+extern int capture_command(capture *c, uint32_t session, const char *line);
+/**
+ * @function  capture_end
+ * @abstract  record the end of a session
+ * @param   c       the capture to use
+ * @param   session the number of the session
+ * @result  int     0 on success, -1 on failure
+ */
+extern int capture_end(capture *c, uint32_t session);
+/**
+ * @function  capture_close
+ * @abstract  close the capture file and free memory
+ * @param   capture_p   a pointer to the capture's pointer
+ */
+extern void capture_close(capture **capture_p);
+/**
+ * @function  capture_check
+ * @abstract  read the header of a capture file
+ * @param   fd      the capture file, at its start
+ * @param   start   buffer to store the wall clock second the capture started
+ * @result  int     0 on success, -1 if fd holds no capture (errno EINVAL)
+ */
+extern int capture_check(int fd, int64_t *start);
+/**
+ * @function  capture_next
+ * @abstract  read the next record of a capture file
+ * @param   fd      the capture file, after its header
+ * @param   rec     buffer to store the record header
+ * @param   payload buffer to store the allocated payload, null terminated,
+ *                  to be freed by the caller
+ * @result  int     1 on success, 0 at the end of the file, -1 on failure
+ */
+extern int capture_next(int fd, cap_record *rec, char **payload);
+
+#endif
@@ -0,0 +1,286 @@
+#ifdef _XOPEN_SOURCE
+#undef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 700
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cgroup.h"
+
+#define FUN_FAILURE -1
+#define FUN_SUCCESS 0
+
+/**
+ * @function  _mount
+ * @abstract  mount point of the cgroup v2 hierarchy, read from mountinfo
+ */
+static int _mount(char *buf, size_t len) {
+  FILE *f = fopen("/proc/self/mountinfo", "r");
+  if (f == NULL) {
+    return FUN_FAILURE;
+  }
+  char line[4096];
+  int ret = FUN_FAILURE;
+  while (ret == FUN_FAILURE && fgets(line, sizeof(line), f) != NULL) {
+    // id parent dev root mount options... - type source options
+    char *sep = strstr(line, " - cgroup2 ");
+    if (sep == NULL) {
+      continue;
+    }
+    char *p = line;
+    for (int field = 0; field < 4 && p != NULL; field++) {
+      p = strchr(p, ' ');
+      p = p != NULL ? p + 1 : NULL;
+    }
+    if (p == NULL) {
+      continue;
+    }
+    size_t n = strcspn(p, " ");
+    if (n < len) {
+      memcpy(buf, p, n);
+      buf[n] = 0;
+      ret = FUN_SUCCESS;
+    }
+  }
+  fclose(f);
+  if (ret == FUN_FAILURE) {
+    errno = ENOENT;
+  }
+  return ret;
+}
+
+/**
+ * @function  _write
+ * @abstract  write a value to a file of a cgroup
+ */
+static int _write(const char *dir, const char *file, const char *value) {
+  char path[PATH_MAX];
+  if (snprintf(path, sizeof(path), "%s/%s", dir, file) >= (int)sizeof(path)) {
+    errno = ENAMETOOLONG;
+    return FUN_FAILURE;
+  }
+  int fd = open(path, O_WRONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return FUN_FAILURE;
+  }
+  ssize_t w = write(fd, value, strlen(value));
+  int err = errno;
+  close(fd);
+  errno = err;
+  return w == (ssize_t)strlen(value) ? FUN_SUCCESS : FUN_FAILURE;
+}
+
+/**
+ * @function  _read
+ * @abstract  read the start of a file of a cgroup
+ * @result  int     0 on success, -1 on failure
+ */
+static int _read(const char *dir, const char *file, char *buf, size_t len) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/%s", dir, file);
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return FUN_FAILURE;
+  }
+  ssize_t r = read(fd, buf, len - 1);
+  close(fd);
+  if (r == -1) {
+    return FUN_FAILURE;
+  }
+  buf[r] = 0;
+  return FUN_SUCCESS;
+}
+
+/**
+ * @function  _some
+ * @abstract  "some avg10" of a pressure file, -1 if unknown
+ */
+static double _some(const char *dir, const char *file) {
+  char buf[256];
+  if (_read(dir, file, buf, sizeof(buf)) == FUN_FAILURE ||
+      strncmp(buf, "some avg10=", strlen("some avg10=")) != 0) {
+    return -1;
+  }
+  return strtod(buf + strlen("some avg10="), NULL);
+}
+
+int cgroup_base(pid_t pid, char *buf, size_t len) {
+  char path[64];
+  if (pid == 0) {
+    snprintf(path, sizeof(path), "/proc/self/cgroup");
+  } else {
+    snprintf(path, sizeof(path), "/proc/%d/cgroup", pid);
+  }
+  if (_mount(buf, len) == FUN_FAILURE) {
+    return FUN_FAILURE;
+  }
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+    return FUN_FAILURE;
+  }
+  // the line of the cgroup v2 hierarchy has no controller: 0::/path
+  char line[PATH_MAX];
+  char *cg = NULL;
+  while (cg == NULL && fgets(line, sizeof(line), f) != NULL) {
+    if (strncmp(line, "0::", 3) == 0) {
+      cg = line + 3;
+      cg[strcspn(cg, "\n")] = 0;
+    }
+  }
+  fclose(f);
+  if (cg == NULL) {
+    errno = ENOENT;
+    return FUN_FAILURE;
+  }
+  size_t mount_len = strlen(buf);
+  if (strcmp(cg, "/") == 0) {
+    cg++;
+  }
+  if (mount_len + strlen(cg) >= len) {
+    errno = ENAMETOOLONG;
+    return FUN_FAILURE;
+  }
+  strcpy(buf + mount_len, cg);
+  char *leaf = strrchr(buf, '/');
+  if (leaf != NULL && strcmp(leaf + 1, CGROUP_DAEMON) == 0) {
+    *leaf = 0;
+    return 1;
+  }
+  return 0;
+}
+
+int cgroup_delegate(const char *base) {
+  char dir[PATH_MAX];
+  snprintf(dir, sizeof(dir), "%s/%s", base, CGROUP_DAEMON);
+  if (mkdir(dir, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) == -1 &&
+      errno != EEXIST) {
+    perror("mkdir");
+    return FUN_FAILURE;
+  }
+  if (_write(dir, "cgroup.procs", "0") == FUN_FAILURE) {
+    perror("cgroup.procs");
+    return FUN_FAILURE;
+  }
+  char avail[256];
+  if (_read(base, "cgroup.controllers", avail, sizeof(avail)) ==
+      FUN_FAILURE) {
+    perror("cgroup.controllers");
+    return FUN_FAILURE;
+  }
+  static const struct {
+    const char *name;
+    int mask;
+  } ctrls[] = {{"cpu", CGROUP_CPU},
+               {"memory", CGROUP_MEMORY},
+               {"pids", CGROUP_PIDS}};
+  int enabled = 0;
+  char *save;
+  for (char *tok = strtok_r(avail, " \n", &save); tok != NULL;
+       tok = strtok_r(NULL, " \n", &save)) {
+    for (size_t i = 0; i < sizeof(ctrls) / sizeof(ctrls[0]); i++) {
+      if (strcmp(tok, ctrls[i].name) != 0) {
+        continue;
+      }
+      char value[16];
+      snprintf(value, sizeof(value), "+%s", ctrls[i].name);
+      if (_write(base, "cgroup.subtree_control", value) == FUN_FAILURE) {
+        perror("cgroup.subtree_control");
+        return FUN_FAILURE;
+      }
+      enabled |= ctrls[i].mask;
+    }
+  }
+  return enabled;
+}
+
+int cgroup_create(const char *base, size_t id, const cgroup_limits *lim) {
+  char dir[PATH_MAX];
+  snprintf(dir, sizeof(dir), "%s/%s%zu", base, CGROUP_PREFIX, id);
+  if (mkdir(dir, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) == -1 &&
+      errno != EEXIST) {
+    perror("mkdir");
+    return FUN_FAILURE;
+  }
+  const char *files[] = {"cpu.weight", "memory.max", "pids.max"};
+  const char *values[] = {lim->cpu_weight, lim->memory_max, lim->pids_max};
+  for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+    if (values[i] != NULL && _write(dir, files[i], values[i]) == FUN_FAILURE) {
+      perror(files[i]);
+      return FUN_FAILURE;
+    }
+  }
+  char path[PATH_MAX + sizeof("/cgroup.procs")];
+  snprintf(path, sizeof(path), "%s/cgroup.procs", dir);
+  int fd = open(path, O_WRONLY | O_CLOEXEC);
+  if (fd == -1) {
+    perror("cgroup.procs");
+    return FUN_FAILURE;
+  }
+  return fd;
+}
+
+int cgroup_remove(const char *base, size_t id) {
+  char dir[PATH_MAX];
+  snprintf(dir, sizeof(dir), "%s/%s%zu", base, CGROUP_PREFIX, id);
+  return rmdir(dir);
+}
+
+size_t cgroup_sessions(const char *base, size_t *ids, size_t n) {
+  DIR *d = opendir(base);
+  if (d == NULL) {
+    return 0;
+  }
+  size_t count = 0;
+  struct dirent *ent;
+  while (count < n && (ent = readdir(d)) != NULL) {
+    const char *name = ent->d_name;
+    if (strncmp(name, CGROUP_PREFIX, strlen(CGROUP_PREFIX)) != 0) {
+      continue;
+    }
+    char *end;
+    const char *num = name + strlen(CGROUP_PREFIX);
+    unsigned long long id = strtoull(num, &end, 10);
+    if (end == num || *end != 0) {
+      continue;
+    }
+    // insertion keeping the ids sorted
+    size_t i = count++;
+    for (; i > 0 && ids[i - 1] > id; i--) {
+      ids[i] = ids[i - 1];
+    }
+    ids[i] = (size_t)id;
+  }
+  closedir(d);
+  return count;
+}
+
+int cgroup_read(const char *dir, cgroup_stat *st) {
+  char path[PATH_MAX + sizeof("/cgroup.procs")];
+  snprintf(path, sizeof(path), "%s/cgroup.procs", dir);
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+    return FUN_FAILURE;
+  }
+  st->procs = 0;
+  int c;
+  while ((c = fgetc(f)) != EOF) {
+    st->procs += c == '\n';
+  }
+  fclose(f);
+  char buf[64];
+  st->memory = _read(dir, "memory.current", buf, sizeof(buf)) == FUN_SUCCESS
+                   ? atoll(buf)
+                   : -1;
+  st->cpu_some = _some(dir, "cpu.pressure");
+  st->memory_some = _some(dir, "memory.pressure");
+  st->io_some = _some(dir, "io.pressure");
+  return FUN_SUCCESS;
+}
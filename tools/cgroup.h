@@ -0,0 +1,121 @@
+#ifndef CGROUP__H
+#define CGROUP__H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+* @define CGROUP_DAEMON  cgroup the daemon moves to, under the subtree
+*                        delegated to it, its parent may not hold processes
+*                        once controllers are enabled for its children
+*/
+#ifndef CGROUP_DAEMON
+#define CGROUP_DAEMON "cmds.daemon"
+#endif
+
+/**
+* @define CGROUP_PREFIX  prefix of the cgroups of the sessions, followed by the
+*                        id of their runner
+*/
+#ifndef CGROUP_PREFIX
+#define CGROUP_PREFIX "cmds."
+#endif
+
+/**
+* @define CGROUP_CPU, CGROUP_MEMORY, CGROUP_PIDS  controllers enabled for the
+*                        cgroups of the sessions, as returned by
+*                        cgroup_delegate
+*/
+#define CGROUP_CPU 0x1
+#define CGROUP_MEMORY 0x2
+#define CGROUP_PIDS 0x4
+
+/**
+* @typedef cgroup_limits
+*         limits of the cgroup of a session, as written in its files
+* @field    cpu_weight  cpu.weight, NULL to keep the default
+* @field    memory_max  memory.max, NULL to keep the default
+* @field    pids_max    pids.max, NULL to keep the default
+*/
+typedef struct cgroup_limits {
+  const char *cpu_weight;
+  const char *memory_max;
+  const char *pids_max;
+} cgroup_limits;
+
+/**
+* @typedef cgroup_stat
+*         usage of a cgroup, as returned by cgroup_read
+* @field    procs       number of processes in it
+* @field    memory      bytes of memory charged to it, -1 if unknown
+* @field    cpu_some    share of the last 10s some of its tasks waited for a
+*                       CPU, in %, -1 if unknown
+* @field    memory_some same for memory
+* @field    io_some     same for io
+*/
+typedef struct cgroup_stat {
+  long procs;
+  long long memory;
+  double cpu_some;
+  double memory_some;
+  double io_some;
+} cgroup_stat;
+
+/**
+ * @function  cgroup_base
+ * @abstract  directory of the cgroup v2 of a process, that of its parent if
+ *            it is in a CGROUP_DAEMON cgroup
+ * @param   pid     the process, 0 for the calling one
+ * @param   buf     buffer to store the directory
+ * @param   len     size of buf
+ * @result  int     1 if the process is in a CGROUP_DAEMON cgroup, 0 if not,
+ *                  -1 on failure
+ */
+extern int cgroup_base(pid_t pid, char *buf, size_t len);
+/**
+ * @function  cgroup_delegate
+ * @abstract  move the calling process to the CGROUP_DAEMON cgroup of a
+ *            subtree delegated to it, then enable the cpu, memory and pids
+ *            controllers available for the other cgroups of the subtree
+ * @param   base    the subtree
+ * @result  int     the controllers enabled, -1 on failure
+ */
+extern int cgroup_delegate(const char *base);
+/**
+ * @function  cgroup_create
+ * @abstract  create, or reuse, the cgroup of the sessions of a runner and
+ *            set its limits
+ * @param   base    the subtree
+ * @param   id      the id of the runner
+ * @param   lim     the limits
+ * @result  int     the cgroup.procs of the cgroup, open for writing, to which
+ *                  a child writes "0" to enter it; -1 on failure
+ */
+extern int cgroup_create(const char *base, size_t id, const cgroup_limits *lim);
+/**
+ * @function  cgroup_remove
+ * @abstract  remove the cgroup of a runner, failing while processes are left
+ * @param   base    the subtree
+ * @param   id      the id of the runner
+ * @result  int     0 on success, -1 on failure
+ */
+extern int cgroup_remove(const char *base, size_t id);
+/**
+ * @function  cgroup_sessions
+ * @abstract  ids of the runners having a cgroup in a subtree
+ * @param   base    the subtree
+ * @param   ids     buffer to store the ids
+ * @param   n       size of ids
+ * @result  size_t  number of ids stored, in increasing order
+ */
+extern size_t cgroup_sessions(const char *base, size_t *ids, size_t n);
+/**
+ * @function  cgroup_read
+ * @abstract  read the usage and the pressure stall information of a cgroup
+ * @param   dir     the directory of the cgroup
+ * @param   st      buffer to store the usage
+ * @result  int     0 on success, -1 if the cgroup can't be read
+ */
+extern int cgroup_read(const char *dir, cgroup_stat *st);
+
+#endif
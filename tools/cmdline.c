@@ -0,0 +1,162 @@
+#ifdef _XOPEN_SOURCE
+#undef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 700
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "cmdline.h"
+
+#define FUN_FAILURE -1
+#define FUN_SUCCESS 0
+
+/**
+ * @function  _is_blank
+ * @abstract  is c a word separator?
+ */
+static bool _is_blank(char c) {
+  return c == ' ' || c == '\t' || c == '\n';
+}
+
+/**
+ * @function  _is_operator
+ * @abstract  does c end a word and start an operator?
+ */
+static bool _is_operator(char c) {
+  return c == '|' || c == '>';
+}
+
+/**
+ * @function  _end_stage
+ * @abstract  close the argv of the current stage
+ */
+static int _end_stage(cmdline *cl, size_t *nwords, size_t *first) {
+  if (*nwords == *first) {
+    return FUN_FAILURE;
+  }
+  cl->stages[cl->nstages].argv = cl->words + *first;
+  cl->stages[cl->nstages].argc = *nwords - *first;
+  cl->nstages++;
+  cl->words[(*nwords)++] = NULL;
+  *first = *nwords;
+  return FUN_SUCCESS;
+}
+
+/**
+ * @function  _read_word
+ * @abstract  read a word starting at *p into *w, removing quotes
+ * @param   p   the position in the line, moved after the word
+ * @param   w   the position in the words storage, moved after the word
+ * @result  char *  the word, NULL if a quote is not terminated
+ */
+static char *_read_word(const char **p, char **w) {
+  char *word = *w;
+  char quote = 0;
+  const char *s = *p;
+  for (; *s != 0 && (quote || !(_is_blank(*s) || _is_operator(*s))); s++) {
+    if (quote) {
+      if (*s == quote) {
+        quote = 0;
+      } else if (quote == '"' && *s == '\\' && (s[1] == '"' || s[1] == '\\')) {
+        *(*w)++ = *++s;
+      } else {
+        *(*w)++ = *s;
+      }
+    } else if (*s == '\'' || *s == '"') {
+      quote = *s;
+    } else if (*s == '\\' && s[1] != 0) {
+      *(*w)++ = *++s;
+    } else {
+      *(*w)++ = *s;
+    }
+  }
+  *(*w)++ = 0;
+  *p = s;
+  return quote ? NULL : word;
+}
+
+int cmdline_parse(const char *str, cmdline *cl) {
+  size_t len = strlen(str);
+
+  // a word never takes more than its chars plus a null char, a stage never
+  // has more words than chars
+  cl->nstages = 0;
+  cl->buf = malloc(2 * len + 2);
+  cl->words = malloc((2 * len + 2) * sizeof(char *));
+  cl->stages = calloc(len + 1, sizeof(stage));
+  if (cl->buf == NULL || cl->words == NULL || cl->stages == NULL) {
+    cmdline_free(cl);
+    return FUN_FAILURE;
+  }
+
+  size_t nwords = 0, first = 0;
+  char *w = cl->buf;
+  const char *p = str;
+  while (*p != 0) {
+    if (_is_blank(*p)) {
+      p++;
+      continue;
+    }
+    if (*p == '|') {
+      if (_end_stage(cl, &nwords, &first) == FUN_FAILURE) {
+        goto syntax;
+      }
+      p++;
+      continue;
+    }
+
+    if (*p == '>' || (p[0] == '2' && p[1] == '>')) {
+      // redirection of stdout or stderr, the target is the next word
+      stage *st = &cl->stages[cl->nstages];
+      bool err = *p == '2';
+      p += err ? 2 : 1;
+      bool append = *p == '>';
+      p += append;
+      while (_is_blank(*p)) {
+        p++;
+      }
+      // duplications ('2>&1', '>&2') are not supported, an unquoted '&1'
+      // must not be taken for a file name
+      char *target;
+      if (*p == 0 || *p == '&' || _is_operator(*p) ||
+          (target = _read_word(&p, &w)) == NULL) {
+        goto syntax;
+      }
+      if (err) {
+        st->err = target;
+        st->err_append = append;
+      } else {
+        st->out = target;
+        st->out_append = append;
+      }
+      continue;
+    }
+
+    if ((cl->words[nwords++] = _read_word(&p, &w)) == NULL) {
+      goto syntax;
+    }
+  }
+  if (_end_stage(cl, &nwords, &first) == FUN_FAILURE) {
+    goto syntax;
+  }
+  return FUN_SUCCESS;
+
+syntax:
+  cmdline_free(cl);
+  errno = EINVAL;
+  return FUN_FAILURE;
+}
+
+void cmdline_free(cmdline *cl) {
+  free(cl->buf);
+  free(cl->words);
+  free(cl->stages);
+  cl->buf = NULL;
+  cl->words = NULL;
+  cl->stages = NULL;
+  cl->nstages = 0;
+}
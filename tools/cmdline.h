@@ -0,0 +1,64 @@
+#ifndef CMDLINE__H
+#define CMDLINE__H
+
+#include <stddef.h>
+
+#include <stdbool.h>
+
+/**
+* @typedef struct stage
+*         a command of a pipeline
+* @field    argv        the words of the command, NULL terminated
+* @field    argc        number of words
+* @field    out         file stdout is redirected to ('>'), NULL if none
+* @field    out_append  append to out ('>>') instead of truncating it
+* @field    err         file stderr is redirected to ('2>'), NULL if none
+* @field    err_append  append to err ('2>>') instead of truncating it
+*/
+typedef struct stage {
+  char **argv;
+  size_t argc;
+  char *out;
+  bool out_append;
+  char *err;
+  bool err_append;
+} stage;
+
+/**
+* @typedef struct cmdline
+*         a parsed command line: commands separated by '|', each one
+*         optionally redirecting its output with '>', '>>', '2>' or '2>>'
+*         followed by a file name. Words are
+*         separated by blanks, quotes ('...' and "...") and backslashes
+*         keep blanks and operators inside a word.
+* @field    nstages   number of commands in the pipeline
+* @field    stages    the commands, in pipeline order
+* @field    words     the argv of every stage, each one NULL terminated
+* @field    buf       storage of the words
+*/
+typedef struct cmdline {
+  size_t nstages;
+  stage *stages;
+  char **words;
+  char *buf;
+} cmdline;
+
+/**
+ * @function  cmdline_parse
+ * @abstract  parse a command line
+ * @param   str     the command line, not modified
+ * @param   cl      the buffer to store the parsed line, to be freed with
+ *                  cmdline_free
+ * @result  int     0 on success, -1 with errno set to EINVAL on a syntax
+ *                  error (empty command, unterminated quote, missing
+*                  redirection target, duplication such as '2>&1')
+ */
+extern int cmdline_parse(const char *str, cmdline *cl);
+/**
+ * @function  cmdline_free
+ * @abstract  free the memory of a parsed command line
+ * @param   cl      the parsed line
+ */
+extern void cmdline_free(cmdline *cl);
+
+#endif
@@ -9,12 +9,223 @@
 #endif
 
 /**
-* @define LINKER_SHM Name of the shm in which we store the linker
+* @define EXEC_SLOTS  number of commands executed at the same time by all the
+*                     runners of a shard, further commands wait shortest
+*                     expected first. 0 for the online CPUs shared between
+*                     the shards, at most CAPACITY - 1 so that the order
+*                     matters once every runner is busy.
+*/
+#ifndef EXEC_SLOTS
+#define EXEC_SLOTS 0
+#endif
+
+/**
+* @define RUNQ_AGING  milliseconds of expected runtime forgiven to a waiting
+*                     command for each millisecond it has waited
+*/
+#ifndef RUNQ_AGING
+#define RUNQ_AGING 1.0
+#endif
+
+/**
+* @define HISTORY_FILE  file in which the runtime history of commands is kept
+*/
+#ifndef HISTORY_FILE
+#define HISTORY_FILE "/var/tmp/cmds_history"
+#endif
+
+/**
+* @define HISTORY_SLOTS  number of commands kept in the history
+*/
+#ifndef HISTORY_SLOTS
+#define HISTORY_SLOTS 1024
+#endif
+
+/**
+* @define HISTORY_UNKNOWN_MS  expected runtime of a command never seen before
+*/
+#ifndef HISTORY_UNKNOWN_MS
+#define HISTORY_UNKNOWN_MS 1000.0
+#endif
+
+/**
+* @define PREWARM_FILE  file in which the binaries run by the commands are
+*                       counted
+*/
+#ifndef PREWARM_FILE
+#define PREWARM_FILE "/var/tmp/cmds_prewarm"
+#endif
+
+/**
+* @define PREWARM_SLOTS  number of binaries counted
+*/
+#ifndef PREWARM_SLOTS
+#define PREWARM_SLOTS 256
+#endif
+
+/**
+* @define PREWARM_TOP  number of most run binaries kept warm
+*/
+#ifndef PREWARM_TOP
+#define PREWARM_TOP 16
+#endif
+
+/**
+* @define PREWARM_INTERVAL_MS  milliseconds between two passes of prewarming
+*/
+#ifndef PREWARM_INTERVAL_MS
+#define PREWARM_INTERVAL_MS 30000
+#endif
+
+/**
+* @define PREWARM_LOCK_BYTES  bytes of binaries and libraries a daemon, or a
+*                             shard, may lock in memory
+*/
+#ifndef PREWARM_LOCK_BYTES
+#define PREWARM_LOCK_BYTES (64L << 20)
+#endif
+
+/**
+* @define PREWARM_LIB_DIRS  directories searched for the libraries a binary
+*                           needs, as the dynamic loader does by default
+*/
+#ifndef PREWARM_LIB_DIRS
+#define PREWARM_LIB_DIRS                                                       \
+  "/lib/x86_64-linux-gnu:/usr/lib/x86_64-linux-gnu:/lib64:/usr/lib64:"         \
+  "/lib:/usr/lib:/usr/local/lib"
+#endif
+
+/**
+* @define CGROUP_CPU_WEIGHT  cpu.weight of the cgroup of each session
+*/
+#ifndef CGROUP_CPU_WEIGHT
+#define CGROUP_CPU_WEIGHT "100"
+#endif
+
+/**
+* @define CGROUP_MEMORY_MAX  memory.max of the cgroup of each session
+*/
+#ifndef CGROUP_MEMORY_MAX
+#define CGROUP_MEMORY_MAX "max"
+#endif
+
+/**
+* @define CGROUP_PIDS_MAX  pids.max of the cgroup of each session
+*/
+#ifndef CGROUP_PIDS_MAX
+#define CGROUP_PIDS_MAX "max"
+#endif
+
+/**
+* @define SPOOL_MEM  bytes of command output kept in memory when the client
+*                    reads slower than the command writes, further output
+*                    goes to a temporary file
+*/
+#ifndef SPOOL_MEM
+#define SPOOL_MEM (1 << 20)
+#endif
+
+/**
+* @define SPOOL_DIR  directory of the temporary files of the output spools
+*/
+#ifndef SPOOL_DIR
+#define SPOOL_DIR "/tmp"
+#endif
+
+/**
+* @define LINKER_LANES  number of priority classes in the linker, lane 0 is the
+*                       most urgent one
+*/
+#ifndef LINKER_LANES
+#define LINKER_LANES 3
+#endif
+
+/**
+* @define LINKER_WEIGHTS  pops granted to each lane per round when the linker
+*                         is read with the weighted policy
+*/
+#ifndef LINKER_WEIGHTS
+#define LINKER_WEIGHTS {8, 3, 1}
+#endif
+
+/**
+* @define LINKER_LANE_BYTES  size in bytes of the records of a priority lane,
+*                            a multiple of 8, each waiting client takes 8
+*                            bytes of header plus its record
+*/
+#ifndef LINKER_LANE_BYTES
+#define LINKER_LANE_BYTES 4096
+#endif
+
+/**
+* @define LINKER_SHM Name of the shm in which we store the linker of the first
+*                    shard, the linker of shard N being LINKER_SHM "_N"
 */
 #ifndef LINKER_SHM
 #define LINKER_SHM "/shm_my_linker_1207"
 #endif
 
+/**
+* @define SHARDS_MAX  max number of shards of the daemon, each one a process
+*                     with its own linker and CAPACITY runners
+*/
+#ifndef SHARDS_MAX
+#define SHARDS_MAX 64
+#endif
+
+/**
+* @define RING_SHM  format of the name of the shm of a client output ring,
+*                   from the client pid and session id
+*/
+#ifndef RING_SHM
+#define RING_SHM "/cmds_ring_%d_%u"
+#endif
+
+/**
+* @define SLOT_SHM  format of the name of the shm of a client completion slot,
+*                   from the client pid and session id
+*/
+#ifndef SLOT_SHM
+#define SLOT_SHM "/cmds_slot_%d_%u"
+#endif
+
+/**
+* @define PIPE_IN   format of the name of the request pipe of a client, from
+*                   its pid and session id
+* @define PIPE_OUT  format of the name of the output pipe of a client, from its
+*                   pid and session id
+*/
+#ifndef PIPE_IN
+#define PIPE_IN "/tmp/%d_%u_in"
+#endif
+#ifndef PIPE_OUT
+#define PIPE_OUT "/tmp/%d_%u_out"
+#endif
+
+/**
+* @define RESUME_PIPE  format of the name of the pipe through which a client
+*                      resumes a session, from the id of its runner
+*/
+#ifndef RESUME_PIPE
+#define RESUME_PIPE "/tmp/cmds_resume_%zu"
+#endif
+
+/**
+* @define RESUME_GRACE_MS  milliseconds a session whose client was lost waits
+*                          for it to resume before its runner is freed
+*/
+#ifndef RESUME_GRACE_MS
+#define RESUME_GRACE_MS 30000
+#endif
+
+/**
+* @define RESUME_READ_MS  milliseconds a runner waits for the rest of a resume
+*                         request once its first byte arrived
+*/
+#ifndef RESUME_READ_MS
+#define RESUME_READ_MS 1000
+#endif
+
 /**
 * @define PIPE_LEN the max length of a pipe name
 */
@@ -0,0 +1,215 @@
+#ifdef _XOPEN_SOURCE
+#undef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 700
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "env.h"
+
+struct env {
+  char **vars;
+  size_t count;
+  size_t cap;
+};
+
+#define FUN_FAILURE -1
+#define FUN_SUCCESS 0
+
+/**
+ * @function  _find
+ * @abstract  index of the variable named by the start of entry, up to its
+ *            '=' if any, count if it is not set
+ */
+static size_t _find(env *e, const char *entry) {
+  size_t name_len = strcspn(entry, "=");
+  for (size_t i = 0; i < e->count; i++) {
+    if (strncmp(e->vars[i], entry, name_len) == 0 &&
+        e->vars[i][name_len] == '=') {
+      return i;
+    }
+  }
+  return e->count;
+}
+
+/**
+ * @function  _set
+ * @abstract  set a variable from a "NAME=value" entry
+ */
+static int _set(env *e, const char *entry) {
+  char *var = strdup(entry);
+  if (var == NULL) {
+    perror("strdup");
+    return FUN_FAILURE;
+  }
+  size_t i = _find(e, entry);
+  if (i < e->count) {
+    free(e->vars[i]);
+    e->vars[i] = var;
+    return FUN_SUCCESS;
+  }
+  if (e->count + 1 == e->cap) {
+    char **vars = realloc(e->vars, 2 * e->cap * sizeof(char *));
+    if (vars == NULL) {
+      perror("realloc");
+      free(var);
+      return FUN_FAILURE;
+    }
+    e->vars = vars;
+    e->cap *= 2;
+  }
+  e->vars[e->count++] = var;
+  e->vars[e->count] = NULL;
+  return FUN_SUCCESS;
+}
+
+/**
+ * @function  _unset
+ * @abstract  unset a variable, the last one taking its place
+ */
+static void _unset(env *e, const char *name) {
+  size_t i = _find(e, name);
+  if (i == e->count) {
+    return;
+  }
+  free(e->vars[i]);
+  e->vars[i] = e->vars[--e->count];
+  e->vars[e->count] = NULL;
+}
+
+env *env_create(void) {
+  env *e = malloc(sizeof(env));
+  if (e == NULL) {
+    perror("malloc");
+    return NULL;
+  }
+  e->cap = 64;
+  e->count = 0;
+  e->vars = malloc(e->cap * sizeof(char *));
+  if (e->vars == NULL) {
+    perror("malloc");
+    free(e);
+    return NULL;
+  }
+  e->vars[0] = NULL;
+  return e;
+}
+
+int env_apply(env *e, const char *delta, size_t len) {
+  if (e == NULL || (len > 0 && delta[len - 1] != 0)) {
+    errno = EINVAL;
+    return FUN_FAILURE;
+  }
+  for (const char *p = delta; p < delta + len; p += strlen(p) + 1) {
+    if (*p == 0 || *p == '=') {
+      continue;
+    }
+    if (strchr(p, '=') == NULL) {
+      _unset(e, p);
+    } else if (_set(e, p) == FUN_FAILURE) {
+      return FUN_FAILURE;
+    }
+  }
+  return FUN_SUCCESS;
+}
+
+char *const *env_envp(env *e) {
+  return e->vars;
+}
+
+int env_exec(env *e, char *const argv[]) {
+  if (strchr(argv[0], '/') != NULL) {
+    execve(argv[0], argv, e->vars);
+    return FUN_FAILURE;
+  }
+  size_t i = _find(e, "PATH");
+  const char *path = i < e->count ? e->vars[i] + strlen("PATH=")
+                                  : ENV_DEFAULT_PATH;
+  size_t name_len = strlen(argv[0]);
+  bool denied = false;
+  char full[PATH_MAX];
+  while (*path != 0) {
+    size_t dir_len = strcspn(path, ":");
+    // an empty entry is the current directory
+    const char *dir = dir_len == 0 ? "." : path;
+    size_t len = dir_len == 0 ? 1 : dir_len;
+    if (len + 1 + name_len < sizeof(full)) {
+      memcpy(full, dir, len);
+      full[len] = '/';
+      memcpy(full + len + 1, argv[0], name_len + 1);
+      execve(full, argv, e->vars);
+      if (errno == EACCES) {
+        denied = true;
+      } else if (errno != ENOENT && errno != ENOTDIR) {
+        return FUN_FAILURE;
+      }
+    }
+    path += dir_len;
+    if (*path == ':') {
+      path++;
+    }
+  }
+  errno = denied ? EACCES : ENOENT;
+  return FUN_FAILURE;
+}
+
+int env_resolve(env *e, const char *name, char *buf, size_t len) {
+  size_t name_len = strlen(name);
+  if (strchr(name, '/') != NULL) {
+    if (name[0] != '/' || name_len >= len) {
+      errno = ENOENT;
+      return FUN_FAILURE;
+    }
+    memcpy(buf, name, name_len + 1);
+    return FUN_SUCCESS;
+  }
+  const char *path = NULL;
+  if (e != NULL) {
+    size_t i = _find(e, "PATH");
+    path = i < e->count ? e->vars[i] + strlen("PATH=") : NULL;
+  } else {
+    path = getenv("PATH");
+  }
+  if (path == NULL) {
+    path = ENV_DEFAULT_PATH;
+  }
+  while (*path != 0) {
+    size_t dir_len = strcspn(path, ":");
+    if (path[0] == '/' && dir_len + 1 + name_len < len) {
+      memcpy(buf, path, dir_len);
+      buf[dir_len] = '/';
+      memcpy(buf + dir_len + 1, name, name_len + 1);
+      struct stat st;
+      if (stat(buf, &st) == 0 && S_ISREG(st.st_mode) &&
+          access(buf, X_OK) == 0) {
+        return FUN_SUCCESS;
+      }
+    }
+    path += dir_len;
+    if (*path == ':') {
+      path++;
+    }
+  }
+  errno = ENOENT;
+  return FUN_FAILURE;
+}
+
+void env_dispose(env **env_p) {
+  env *e = *env_p;
+  if (e == NULL) {
+    return;
+  }
+  for (size_t i = 0; i < e->count; i++) {
+    free(e->vars[i]);
+  }
+  free(e->vars);
+  free(e);
+  *env_p = NULL;
+}
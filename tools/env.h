@@ -0,0 +1,73 @@
+#ifndef ENV__H
+#define ENV__H
+
+#include <stddef.h>
+
+/**
+* @define ENV_DEFAULT_PATH search path of commands when PATH is not set
+*/
+#ifndef ENV_DEFAULT_PATH
+#define ENV_DEFAULT_PATH "/usr/local/bin:/usr/bin:/bin"
+#endif
+
+/**
+* @typedef env
+*         environment of a client session, each variable stored once. The
+*         variables are kept as a NULL terminated array of "NAME=value"
+*         strings, ready to be given to execve.
+* @field    vars      the variables, NULL terminated
+* @field    count     number of variables
+* @field    cap       allocated size of vars, the NULL included
+*/
+typedef struct env env;
+
+/**
+ * @function  env_create
+ * @abstract  creates an empty environment
+ */
+extern env *env_create(void);
+/**
+ * @function  env_apply
+ * @abstract  apply a delta to an environment
+ * @param   e       the environment to use
+ * @param   delta   entries terminated by a null char: "NAME=value" sets a
+ *                  variable, "NAME" unsets it
+ * @param   len     length of delta
+ * @result  int     0 on success, -1 on failure
+ */
+extern int env_apply(env *e, const char *delta, size_t len);
+/**
+ * @function  env_envp
+ * @abstract  the variables of an environment, as given to execve
+ * @param   e       the environment to use
+ */
+extern char *const *env_envp(env *e);
+/**
+ * @function  env_exec
+ * @abstract  execute a command with an environment, searching argv[0] in the
+ *            PATH of the environment if it has no slash
+ * @param   e       the environment to use
+ * @param   argv    the command, NULL terminated
+ * @result  int     -1, only returns on failure
+ */
+extern int env_exec(env *e, char *const argv[]);
+/**
+ * @function  env_resolve
+ * @abstract  the file a command would be executed from, searched as env_exec
+ *            does but only in the absolute directories of the PATH, the
+ *            directory of the client being unknown here
+ * @param   e       the environment to use, NULL for the one of the process
+ * @param   name    the command
+ * @param   buf     buffer to store the path
+ * @param   len     size of buf
+ * @result  int     0 on success, -1 if the command is not found
+ */
+extern int env_resolve(env *e, const char *name, char *buf, size_t len);
+/**
+ * @function  env_dispose
+ * @abstract  free memory of an environment
+ * @param   env_p   a pointer to the environment's pointer
+ */
+extern void env_dispose(env **env_p);
+
+#endif
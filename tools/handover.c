@@ -0,0 +1,209 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "handover.h"
+#include "proto.h"
+
+#define FUN_FAILURE -1
+#define FUN_SUCCESS 0
+
+/**
+ * @struct    ho_header
+ * @abstract  start of a message, carrying its descriptors
+ *
+ * @field     len       length of the message following the header
+ * @field     nfds      number of descriptors passed with the header
+ */
+struct ho_header {
+  uint32_t len;
+  uint32_t nfds;
+};
+
+/**
+ * @function  _address
+ * @abstract  fill the address of a socket path
+ */
+static int _address(const char *path, struct sockaddr_un *addr) {
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr->sun_path)) {
+    errno = ENAMETOOLONG;
+    return FUN_FAILURE;
+  }
+  strcpy(addr->sun_path, path);
+  return FUN_SUCCESS;
+}
+
+int handover_listen(const char *path) {
+  struct sockaddr_un addr;
+  if (_address(path, &addr) == FUN_FAILURE) {
+    perror("handover_listen");
+    return FUN_FAILURE;
+  }
+  int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sock == -1) {
+    perror("socket");
+    return FUN_FAILURE;
+  }
+  unlink(path);
+  // nobody can connect before listen, once the socket is restricted
+  if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+      chmod(path, S_IRUSR | S_IWUSR) == -1 || listen(sock, SOMAXCONN) == -1) {
+    perror("bind");
+    close(sock);
+    unlink(path);
+    return FUN_FAILURE;
+  }
+  return sock;
+}
+
+int handover_accept(int sock) {
+  int conn;
+  while ((conn = accept4(sock, NULL, NULL, SOCK_CLOEXEC)) == -1) {
+    if (errno != EINTR) {
+      perror("accept4");
+      return FUN_FAILURE;
+    }
+  }
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+  if (getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1) {
+    perror("getsockopt");
+    close(conn);
+    return FUN_FAILURE;
+  }
+  if (cred.uid != geteuid()) {
+    close(conn);
+    errno = EPERM;
+    return FUN_FAILURE;
+  }
+  return conn;
+}
+
+int handover_connect(const char *path) {
+  struct sockaddr_un addr;
+  if (_address(path, &addr) == FUN_FAILURE) {
+    return FUN_FAILURE;
+  }
+  int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sock == -1) {
+    return FUN_FAILURE;
+  }
+  if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+    close(sock);
+    return FUN_FAILURE;
+  }
+  return sock;
+}
+
+int handover_send(int sock, const void *msg, size_t len, const int *fds,
+                  size_t nfds) {
+  if (nfds > HANDOVER_FDS || len > UINT32_MAX) {
+    errno = EINVAL;
+    return FUN_FAILURE;
+  }
+  struct ho_header hdr = {.len = (uint32_t)len, .nfds = (uint32_t)nfds};
+  struct iovec iov = {.iov_base = &hdr, .iov_len = sizeof(hdr)};
+  union {
+    char buf[CMSG_SPACE(HANDOVER_FDS * sizeof(int))];
+    struct cmsghdr align;
+  } ctl;
+  memset(&ctl, 0, sizeof(ctl));
+  struct msghdr mh = {.msg_iov = &iov, .msg_iovlen = 1};
+  if (nfds > 0) {
+    mh.msg_control = ctl.buf;
+    mh.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+    memcpy(CMSG_DATA(cm), fds, nfds * sizeof(int));
+  }
+  ssize_t w;
+  while ((w = sendmsg(sock, &mh, MSG_NOSIGNAL)) == -1 && errno == EINTR) {
+  }
+  if (w != (ssize_t)sizeof(hdr) ||
+      (len > 0 && proto_write_full(sock, msg, len) == -1)) {
+    return FUN_FAILURE;
+  }
+  char ok;
+  ssize_t r = proto_read_full(sock, &ok, 1);
+  if (r != 1) {
+    if (r == 0) {
+      errno = ECONNRESET;
+    }
+    return FUN_FAILURE;
+  }
+  if (!ok) {
+    errno = ECONNREFUSED;
+    return FUN_FAILURE;
+  }
+  return FUN_SUCCESS;
+}
+
+int handover_recv(int sock, char **msg, size_t *len, int *fds,
+                  size_t *nfds) {
+  struct ho_header hdr;
+  struct iovec iov = {.iov_base = &hdr, .iov_len = sizeof(hdr)};
+  union {
+    char buf[CMSG_SPACE(HANDOVER_FDS * sizeof(int))];
+    struct cmsghdr align;
+  } ctl;
+  struct msghdr mh = {.msg_iov = &iov,
+                      .msg_iovlen = 1,
+                      .msg_control = ctl.buf,
+                      .msg_controllen = sizeof(ctl.buf)};
+  ssize_t r;
+  while ((r = recvmsg(sock, &mh, MSG_CMSG_CLOEXEC)) == -1 && errno == EINTR) {
+  }
+  if (r <= 0) {
+    return (int)r;
+  }
+  *nfds = 0;
+  for (struct cmsghdr *cm = CMSG_FIRSTHDR(&mh); cm != NULL;
+       cm = CMSG_NXTHDR(&mh, cm)) {
+    if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS) {
+      size_t n = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      memcpy(fds, CMSG_DATA(cm), n * sizeof(int));
+      *nfds = n;
+    }
+  }
+  // the descriptors come with the first byte, the rest may come later
+  if ((size_t)r < sizeof(hdr) &&
+      proto_read_full(sock, (char *)&hdr + r, sizeof(hdr) - (size_t)r) !=
+          (ssize_t)(sizeof(hdr) - (size_t)r)) {
+    r = -1;
+  } else if ((mh.msg_flags & MSG_CTRUNC) || hdr.nfds != *nfds) {
+    errno = EPROTO;
+    r = -1;
+  } else if ((*msg = malloc((size_t)hdr.len + 1)) == NULL) {
+    perror("malloc");
+    r = -1;
+  } else if (proto_read_full(sock, *msg, hdr.len) != (ssize_t)hdr.len) {
+    free(*msg);
+    r = -1;
+  }
+  if (r == -1) {
+    for (size_t i = 0; i < *nfds; i++) {
+      close(fds[i]);
+    }
+    return FUN_FAILURE;
+  }
+  (*msg)[hdr.len] = 0;
+  *len = hdr.len;
+  return 1;
+}
+
+int handover_reply(int sock, bool accepted) {
+  char ok = accepted;
+  return proto_write_full(sock, &ok, 1);
+}
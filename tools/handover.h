@@ -0,0 +1,80 @@
+#ifndef HANDOVER__H
+#define HANDOVER__H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+* @define HANDOVER_FDS  max number of file descriptors handed over at once
+*/
+#ifndef HANDOVER_FDS
+#define HANDOVER_FDS 4
+#endif
+
+/**
+ * A handover socket carries messages from a daemon leaving to the daemon
+ * taking its place: a length, the descriptors passed as SCM_RIGHTS, then the
+ * bytes of the message. The receiver replies with one byte telling whether
+ * it took the message over.
+ */
+
+/**
+ * @function  handover_listen
+ * @abstract  create a unix socket only its user can connect to, replacing a
+ *            previous one, and listen on it
+ * @param   path    the path of the socket
+ * @result  int     the socket, -1 on failure
+ */
+extern int handover_listen(const char *path);
+/**
+ * @function  handover_accept
+ * @abstract  accept a connection from a process of the same user
+ * @param   sock    the listening socket
+ * @result  int     the connection, -1 on failure (errno EPERM for a process
+ *                  of another user)
+ */
+extern int handover_accept(int sock);
+/**
+ * @function  handover_connect
+ * @abstract  connect to a handover socket
+ * @param   path    the path of the socket
+ * @result  int     the connection, -1 on failure
+ */
+extern int handover_connect(const char *path);
+/**
+ * @function  handover_send
+ * @abstract  send a message and descriptors, then wait for the reply
+ * @param   sock    the connection
+ * @param   msg     the message
+ * @param   len     length of the message
+ * @param   fds     the descriptors, duplicated in the receiver
+ * @param   nfds    number of descriptors, at most HANDOVER_FDS
+ * @result  int     0 if the receiver took the message over, -1 otherwise
+ *                  (errno ECONNREFUSED if it refused it)
+ */
+extern int handover_send(int sock, const void *msg, size_t len, const int *fds,
+                         size_t nfds);
+/**
+ * @function  handover_recv
+ * @abstract  receive a message and its descriptors
+ * @param   sock    the connection
+ * @param   msg     buffer to store the allocated message, to be freed by the
+ *                  caller
+ * @param   len     buffer to store the length of the message
+ * @param   fds     buffer to store the descriptors, HANDOVER_FDS long, to be
+ *                  closed by the caller
+ * @param   nfds    buffer to store the number of descriptors
+ * @result  int     1 on success, 0 if the sender left, -1 on failure
+ */
+extern int handover_recv(int sock, char **msg, size_t *len, int *fds,
+                         size_t *nfds);
+/**
+ * @function  handover_reply
+ * @abstract  tell the sender whether its message was taken over
+ * @param   sock      the connection
+ * @param   accepted  was it taken over?
+ * @result  int     0 on success, -1 on failure
+ */
+extern int handover_reply(int sock, bool accepted);
+
+#endif
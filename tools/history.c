@@ -0,0 +1,233 @@
+#ifdef _XOPEN_SOURCE
+#undef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 700
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "history.h"
+
+/**
+ * @define  HIST_MAGIC    marks a file holding a history of this layout
+ */
+#define HIST_MAGIC 0x636d647368697374ULL
+
+/**
+ * @define  HIST_WARMUP   number of samples averaged before switching to an
+ *                        exponential moving average
+ */
+#define HIST_WARMUP 4
+
+/**
+ * @struct    hist_entry
+ * @abstract  statistics of a command, stored in the history file
+ *
+ * @field     key       hash of the command name and argv shape, 0 if unused
+ * @field     name      the command name, for humans reading the file
+ * @field     argc      number of arguments of the command
+ * @field     count     number of runs measured
+ * @field     mean_ms   smoothed runtime in ms
+ * @field     max_ms    longest runtime in ms
+ */
+struct hist_entry {
+  uint64_t key;
+  char name[HIST_NAME_LEN];
+  uint32_t argc;
+  uint64_t count;
+  double mean_ms;
+  double max_ms;
+};
+
+/**
+ * @struct    hist_file
+ * @abstract  layout of the history file
+ *
+ * @field     magic     HIST_MAGIC
+ * @field     slots     number of entries
+ * @field     entries[] open addressed table of commands
+ */
+struct hist_file {
+  uint64_t magic;
+  uint64_t slots;
+  struct hist_entry entries[];
+};
+
+struct history {
+  struct hist_file *map;
+  pthread_mutex_t mutex;
+};
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+/**
+ * @function  _hash
+ * @abstract  FNV-1a of len bytes, continuing from h
+ */
+static uint64_t _hash(uint64_t h, const void *data, size_t len) {
+  const unsigned char *p = data;
+  for (size_t i = 0; i < len; i++) {
+    h ^= p[i];
+    h *= FNV_PRIME;
+  }
+  return h;
+}
+
+/**
+ * @function  _key
+ * @abstract  key of a command: its name, its number of arguments and its
+ *            options, operands are ignored so `make -j4 a` and `make -j4 b`
+ *            share their statistics
+ * @param   argv    the command
+ * @param   argc    buffer to store the number of arguments
+ */
+static uint64_t _key(char *const argv[], uint32_t *argc) {
+  uint64_t h = _hash(FNV_OFFSET, argv[0], strlen(argv[0]) + 1);
+  uint32_t n = 1;
+  for (; argv[n] != NULL; n++) {
+    if (argv[n][0] == '-') {
+      h = _hash(h, argv[n], strlen(argv[n]) + 1);
+    }
+  }
+  h = _hash(h, &n, sizeof(n));
+  *argc = n;
+  return h == 0 ? 1 : h;
+}
+
+/**
+ * @function  _find
+ * @abstract  find the entry of key, or the slot where it should be added
+ */
+static struct hist_entry *_find(history *h, uint64_t key) {
+  size_t slots = (size_t)h->map->slots;
+  size_t i = (size_t)(key % slots);
+  for (size_t n = 0; n < slots; n++) {
+    struct hist_entry *e = &h->map->entries[(i + n) % slots];
+    if (e->key == key || e->key == 0) {
+      return e;
+    }
+  }
+  // table full: forget the command in the first probed slot
+  return &h->map->entries[i];
+}
+
+history *history_open(const char *path) {
+  size_t size =
+      sizeof(struct hist_file) + HISTORY_SLOTS * sizeof(struct hist_entry);
+
+  int fd = open(path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+  if (fd == -1) {
+    perror("open");
+    return NULL;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    perror("fstat");
+    close(fd);
+    return NULL;
+  }
+
+  bool fresh = (size_t)st.st_size != size;
+  if (fresh && ftruncate(fd, (off_t)size) == -1) {
+    perror("ftruncate");
+    close(fd);
+    return NULL;
+  }
+
+  struct hist_file *map =
+      mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    perror("mmap");
+    return NULL;
+  }
+
+  if (fresh || map->magic != HIST_MAGIC || map->slots != HISTORY_SLOTS) {
+    memset(map, 0, size);
+    map->magic = HIST_MAGIC;
+    map->slots = HISTORY_SLOTS;
+  }
+
+  history *h = malloc(sizeof(history));
+  if (h == NULL) {
+    perror("malloc");
+    munmap(map, size);
+    return NULL;
+  }
+  h->map = map;
+  if (pthread_mutex_init(&h->mutex, NULL) != 0) {
+    perror("pthread_mutex_init");
+    munmap(map, size);
+    free(h);
+    return NULL;
+  }
+
+  return h;
+}
+
+double history_predict(history *h, char *const argv[]) {
+  if (h == NULL || argv[0] == NULL) {
+    return HISTORY_UNKNOWN_MS;
+  }
+  uint32_t argc;
+  uint64_t key = _key(argv, &argc);
+
+  pthread_mutex_lock(&h->mutex);
+  struct hist_entry *e = _find(h, key);
+  double ms = e->key == key ? e->mean_ms : HISTORY_UNKNOWN_MS;
+  pthread_mutex_unlock(&h->mutex);
+
+  return ms;
+}
+
+void history_record(history *h, char *const argv[], long ms) {
+  if (h == NULL || argv[0] == NULL) {
+    return;
+  }
+  uint32_t argc;
+  uint64_t key = _key(argv, &argc);
+  double x = (double)ms;
+
+  pthread_mutex_lock(&h->mutex);
+  struct hist_entry *e = _find(h, key);
+  if (e->key != key) {
+    memset(e, 0, sizeof(*e));
+    e->key = key;
+    e->argc = argc;
+    strncpy(e->name, argv[0], HIST_NAME_LEN - 1);
+  }
+  e->count++;
+  uint64_t w = e->count < HIST_WARMUP ? e->count : HIST_WARMUP;
+  e->mean_ms += (x - e->mean_ms) / (double)w;
+  if (x > e->max_ms) {
+    e->max_ms = x;
+  }
+  pthread_mutex_unlock(&h->mutex);
+}
+
+void history_close(history **history_p) {
+  history *h = *history_p;
+  if (h == NULL) {
+    return;
+  }
+  size_t size = sizeof(struct hist_file) +
+                (size_t)h->map->slots * sizeof(struct hist_entry);
+  if (munmap(h->map, size) == -1) {
+    perror("munmap");
+  }
+  pthread_mutex_destroy(&h->mutex);
+  free(h);
+  *history_p = NULL;
+}
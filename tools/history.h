@@ -0,0 +1,51 @@
+#ifndef HISTORY__H
+#define HISTORY__H
+
+/**
+* @define HIST_NAME_LEN max length of a command name stored in the history
+*/
+#ifndef HIST_NAME_LEN
+#define HIST_NAME_LEN 32
+#endif
+
+/**
+* @typedef history
+*         runtime statistics of commands, mapped from a file so they survive
+*         daemon restarts. Commands are keyed by their name and the shape of
+*         their argv: the number of arguments and the options used.
+* @field    map       the mapped file: a header followed by the entries
+* @field    mutex     protects the entries against concurrent runners
+*/
+typedef struct history history;
+
+/**
+ * @function  history_open
+ * @abstract  map the history stored in path, creating it if needed
+ * @param   path    the file storing the history
+ */
+extern history *history_open(const char *path);
+/**
+ * @function  history_predict
+ * @abstract  expected runtime of a command
+ * @param   h       the history to use
+ * @param   argv    the command, NULL terminated
+ * @result  double  the expected runtime in ms, HISTORY_UNKNOWN_MS if the
+ *                  command was never seen
+ */
+extern double history_predict(history *h, char *const argv[]);
+/**
+ * @function  history_record
+ * @abstract  add a measured runtime to the statistics of a command
+ * @param   h       the history to use
+ * @param   argv    the command, NULL terminated
+ * @param   ms      the measured runtime in ms
+ */
+extern void history_record(history *h, char *const argv[], long ms);
+/**
+ * @function  history_close
+ * @abstract  unmap the history and free memory
+ * @param   history_p   a pointer to the history's pointer
+ */
+extern void history_close(history **history_p);
+
+#endif
@@ -2,29 +2,112 @@
 #undef _XOPEN_SOURCE
 #define _XOPEN_SOURCE 500
 #endif
+#define _DEFAULT_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
 #include <semaphore.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <string.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "config.h"
 #include "linker.h"
 
+/**
+ * @define  LINKER_LINE   size of a cache line, lanes and their data start on
+ *                        their own line
+ * @define  LINKER_ALIGN  alignment of the records in a lane
+ * @define  LINKER_WRAP   length of the record marking the unused end of a lane
+ */
+#define LINKER_LINE 64
+#define LINKER_ALIGN 8
+#define LINKER_WRAP UINT32_MAX
+
+/**
+ * @define  LINKER_NAME_LEN  max length of the name of a linker's shm
+ */
+#define LINKER_NAME_LEN 64
+
+/**
+ * @struct    rec_hdr
+ * @abstract  header of a record in a lane, followed by len bytes padded to
+ *            LINKER_ALIGN
+ *
+ * @field     len       length of the record, LINKER_WRAP if the record
+ *                      continues at the start of the lane
+ * @field     pad       unused, keeps records aligned
+ */
+struct rec_hdr {
+  uint32_t len;
+  uint32_t pad;
+};
+
+/**
+ * @struct    lane
+ * @abstract  byte ring of a priority lane, stored in the linker
+ *
+ * @field     head      bytes pushed since creation
+ * @field     tail      bytes popped since creation
+ * @field     space_seq futex bumped each time bytes are popped
+ * @field     waiting   number of pushers sleeping on space_seq
+ * @field     credit    pops left to this lane in the current weighted round
+ * @field     pushed    number of clients pushed since creation
+ * @field     popped    number of clients popped since creation
+ */
+struct lane {
+  _Alignas(LINKER_LINE) uint64_t head;
+  uint64_t tail;
+  _Atomic uint32_t space_seq;
+  _Atomic uint32_t waiting;
+  unsigned credit;
+  unsigned long pushed;
+  unsigned long popped;
+};
+
 struct linker {
-  size_t head;
-  size_t tail;
+  char name[LINKER_NAME_LEN];
   sem_t mutex;
-  sem_t empty;
   sem_t full;
-  char buffer[];
+  _Atomic uint32_t shards;
+  _Atomic uint32_t busy;
+  _Atomic uint32_t epoch;
+  struct lane lanes[LINKER_LANES];
+  _Alignas(LINKER_LINE) char buffer[];
 };
 
+_Static_assert(LINKER_LANE_BYTES % LINKER_ALIGN == 0,
+               "LINKER_LANE_BYTES must be a multiple of LINKER_ALIGN");
+
+static const unsigned lane_weights[LINKER_LANES] = LINKER_WEIGHTS;
+
+/**
+ * @function  _futex_wait
+ * @abstract  sleep while *addr is val, at most timeout if not NULL
+ */
+static void _futex_wait(_Atomic uint32_t *addr, uint32_t val,
+                        const struct timespec *timeout) {
+  syscall(SYS_futex, addr, FUTEX_WAIT, val, timeout, NULL, 0);
+}
+
+/**
+ * @function  _futex_wake
+ * @abstract  wake everyone sleeping on addr
+ */
+static void _futex_wake(_Atomic uint32_t *addr) {
+  syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
 /**
  * @function  _cleanup
  * @abstract  free the memory and destroy linker's shm
@@ -37,16 +120,13 @@ static void _cleanup(linker *lp) {
   if (sem_destroy(&lp->full) == -1) {
     perror("sem_destroy - full");
   }
-  if (sem_destroy(&lp->empty) == -1) {
-    perror("sem_destroy - empty");
-  }
-  if (shm_unlink(LINKER_SHM) == -1) {
+  if (shm_unlink(lp->name) == -1) {
     perror("shm_unlink");
   }
 }
 
 linker *linker_init(const char *name) {
-  size_t shm_size = sizeof(linker) + CAPACITY * sizeof(client);
+  size_t shm_size = sizeof(linker) + LINKER_LANES * LINKER_LANE_BYTES;
 
   int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
 
@@ -69,9 +149,7 @@ linker *linker_init(const char *name) {
   }
 
   close(fd);
-
-  lp->head = 0;
-  lp->tail = 0;
+  snprintf(lp->name, sizeof(lp->name), "%s", name);
 
   if (sem_init(&lp->mutex, 1, 1) == -1) {
     perror("sem_init - mutex");
@@ -84,11 +162,19 @@ linker *linker_init(const char *name) {
     _cleanup(lp);
     return NULL;
   }
-
-  if (sem_init(&lp->empty, 1, CAPACITY) == -1) {
-    perror("sem_init - empty");
-    _cleanup(lp);
-    return NULL;
+  atomic_init(&lp->shards, 1);
+  atomic_init(&lp->busy, 0);
+  atomic_init(&lp->epoch, 0);
+
+  for (size_t i = 0; i < LINKER_LANES; i++) {
+    struct lane *ln = &lp->lanes[i];
+    ln->head = 0;
+    ln->tail = 0;
+    ln->credit = lane_weights[i] > 0 ? lane_weights[i] : 1;
+    ln->space_seq = 0;
+    ln->waiting = 0;
+    ln->pushed = 0;
+    ln->popped = 0;
   }
 
   return lp;
@@ -125,23 +211,138 @@ linker *linker_connect(const char *name) {
 #define FUN_FAILURE -1
 #define FUN_SUCCESS 0
 
-int linker_push(linker *lin, const client *c) {
-  if (lin == NULL || c == NULL) {
-    return FUN_FAILURE;
+/**
+ * @function  _at
+ * @abstract  address in the buffer of a byte count of a lane
+ * @param   lin   the linker
+ * @param   lane  the priority lane
+ * @param   pos   bytes pushed or popped since creation
+ */
+static char *_at(linker *lin, size_t lane, uint64_t pos) {
+  return lin->buffer + lane * LINKER_LANE_BYTES +
+         (size_t)(pos % LINKER_LANE_BYTES);
+}
+
+/**
+ * @function  _rec_size
+ * @abstract  bytes taken in a lane by a record of len bytes
+ */
+static size_t _rec_size(size_t len) {
+  return sizeof(struct rec_hdr) + (len + LINKER_ALIGN - 1) / LINKER_ALIGN *
+                                      LINKER_ALIGN;
+}
+
+/**
+ * @function  _lane_put
+ * @abstract  append a record to a lane if it has room, the mutex must be held.
+ *            A record never wraps: if it doesn't fit before the end of the
+ *            buffer, the end is marked unused and it starts over.
+ * @param   lin   the linker
+ * @param   lane  the priority lane
+ * @param   rec   the record
+ * @param   len   length of the record
+ * @result  bool  false if the lane is too full
+ */
+static bool _lane_put(linker *lin, size_t lane, const void *rec, size_t len) {
+  struct lane *ln = &lin->lanes[lane];
+  size_t size = _rec_size(len);
+  size_t to_end = LINKER_LANE_BYTES - (size_t)(ln->head % LINKER_LANE_BYTES);
+  size_t skip = size > to_end ? to_end : 0;
+  if (skip + size > LINKER_LANE_BYTES - (size_t)(ln->head - ln->tail)) {
+    return false;
   }
+  struct rec_hdr hdr = {LINKER_WRAP, 0};
+  if (skip > 0) {
+    memcpy(_at(lin, lane, ln->head), &hdr, sizeof(hdr));
+    ln->head += skip;
+  }
+  hdr.len = (uint32_t)len;
+  char *p = _at(lin, lane, ln->head);
+  memcpy(p, &hdr, sizeof(hdr));
+  memcpy(p + sizeof(hdr), rec, len);
+  ln->head += size;
+  return true;
+}
 
-  if (sem_wait(&lin->empty) == -1) {
-    perror("sem_wait");
-    return FUN_FAILURE;
+/**
+ * @function  _lane_take
+ * @abstract  remove the first record of a non empty lane, the mutex must be
+ *            held. A record longer than buf is truncated, a shorter one is
+ *            padded with zeros.
+ * @param   lin   the linker
+ * @param   lane  the priority lane
+ * @param   buf   the buffer to store the record
+ * @param   len   size of buf
+ */
+static void _lane_take(linker *lin, size_t lane, void *buf, size_t len) {
+  struct lane *ln = &lin->lanes[lane];
+  struct rec_hdr hdr;
+  memcpy(&hdr, _at(lin, lane, ln->tail), sizeof(hdr));
+  if (hdr.len == LINKER_WRAP) {
+    ln->tail += LINKER_LANE_BYTES - (size_t)(ln->tail % LINKER_LANE_BYTES);
+    memcpy(&hdr, _at(lin, lane, ln->tail), sizeof(hdr));
   }
+  size_t n = hdr.len < len ? hdr.len : len;
+  memcpy(buf, _at(lin, lane, ln->tail) + sizeof(hdr), n);
+  memset((char *)buf + n, 0, len - n);
+  ln->tail += _rec_size(hdr.len);
+}
 
-  if (sem_wait(&lin->mutex) == -1) {
-    perror("sem_wait");
+/**
+ * @function  _choose_lane
+ * @abstract  choose the lane to pop from, the mutex must be held and at least
+ *            one lane must be non empty
+ * @param   lin   the linker
+ * @param   pol   the policy used to choose between lanes
+ */
+static size_t _choose_lane(linker *lin, enum linker_policy pol) {
+  for (;;) {
+    for (size_t i = 0; i < LINKER_LANES; i++) {
+      struct lane *ln = &lin->lanes[i];
+      if (ln->pushed == ln->popped) {
+        continue;
+      }
+      if (pol == LINKER_STRICT) {
+        return i;
+      }
+      if (ln->credit > 0) {
+        ln->credit--;
+        return i;
+      }
+    }
+    // every non empty lane used its credit: start a new round
+    for (size_t i = 0; i < LINKER_LANES; i++) {
+      lin->lanes[i].credit = lane_weights[i] > 0 ? lane_weights[i] : 1;
+    }
+  }
+}
+
+int linker_push(linker *lin, const client *c, unsigned lane) {
+  if (lin == NULL || c == NULL || lane >= LINKER_LANES) {
     return FUN_FAILURE;
   }
 
-  memcpy(lin->buffer + lin->head * sizeof(client), c, sizeof(client));
-  lin->head = (lin->head + 1) % CAPACITY;
+  struct lane *ln = &lin->lanes[lane];
+
+  for (;;) {
+    if (sem_wait(&lin->mutex) == -1) {
+      perror("sem_wait");
+      return FUN_FAILURE;
+    }
+    if (_lane_put(lin, lane, c, sizeof(client))) {
+      break;
+    }
+    // lane full: sleep until a pop frees some bytes
+    uint32_t seq = atomic_load(&ln->space_seq);
+    atomic_fetch_add(&ln->waiting, 1);
+    if (sem_post(&lin->mutex)) {
+      perror("sem_post");
+      return FUN_FAILURE;
+    }
+    _futex_wait(&ln->space_seq, seq, NULL);
+    atomic_fetch_sub(&ln->waiting, 1);
+  }
+  ln->pushed++;
 
   if (sem_post(&lin->mutex)) {
     perror("sem_post");
@@ -156,7 +357,38 @@ int linker_push(linker *lin, const client *c) {
   return FUN_SUCCESS;
 }
 
-int linker_pop(linker *lin, client *buf) {
+/**
+ * @function  _pop_taken
+ * @abstract  remove the client counted out of full, which can't be given
+ *            back: a signal doesn't stop the wait for the mutex
+ */
+static int _pop_taken(linker *lin, client *buf, enum linker_policy pol) {
+  while (sem_wait(&lin->mutex) == -1) {
+    if (errno != EINTR) {
+      perror("sem_wait");
+      return FUN_FAILURE;
+    }
+  }
+
+  size_t lane = _choose_lane(lin, pol);
+  struct lane *ln = &lin->lanes[lane];
+
+  _lane_take(lin, lane, buf, sizeof(client));
+  ln->popped++;
+  atomic_fetch_add(&ln->space_seq, 1);
+  if (atomic_load(&ln->waiting) > 0) {
+    _futex_wake(&ln->space_seq);
+  }
+
+  if (sem_post(&lin->mutex)) {
+    perror("sem_post");
+    return FUN_FAILURE;
+  }
+
+  return (int)lane;
+}
+
+int linker_pop(linker *lin, client *buf, enum linker_policy pol) {
   if (lin == NULL || buf == NULL) {
     return FUN_FAILURE;
   }
@@ -166,28 +398,391 @@ int linker_pop(linker *lin, client *buf) {
     return FUN_FAILURE;
   }
 
+  return _pop_taken(lin, buf, pol);
+}
+
+int linker_timedpop(linker *lin, client *buf, enum linker_policy pol,
+                    int timeout_ms) {
+  if (lin == NULL || buf == NULL) {
+    return FUN_FAILURE;
+  }
+
+  // sem_timedwait only knows the realtime clock
+  struct timespec until;
+  clock_gettime(CLOCK_REALTIME, &until);
+  until.tv_sec += timeout_ms / 1000;
+  until.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+  if (until.tv_nsec >= 1000000000) {
+    until.tv_sec++;
+    until.tv_nsec -= 1000000000;
+  }
+  if (sem_timedwait(&lin->full, &until) == -1) {
+    if (errno != ETIMEDOUT && errno != EINTR) {
+      perror("sem_timedwait");
+    }
+    return FUN_FAILURE;
+  }
+
+  return _pop_taken(lin, buf, pol);
+}
+
+int linker_stats(linker *lin, unsigned lane, lane_stats *st) {
+  if (lin == NULL || st == NULL || lane >= LINKER_LANES) {
+    return FUN_FAILURE;
+  }
+
   if (sem_wait(&lin->mutex) == -1) {
     perror("sem_wait");
     return FUN_FAILURE;
   }
 
-  memcpy(buf, lin->buffer + lin->tail * sizeof(client), sizeof(client));
-  lin->tail = (lin->tail + 1) % CAPACITY;
+  struct lane *ln = &lin->lanes[lane];
+  st->pushed = ln->pushed;
+  st->popped = ln->popped;
+  st->depth = (size_t)(ln->pushed - ln->popped);
+  st->bytes = (size_t)(ln->head - ln->tail);
 
   if (sem_post(&lin->mutex)) {
     perror("sem_post");
     return FUN_FAILURE;
   }
 
-  if (sem_post(&lin->empty)) {
-    perror("sem_post");
-    return FUN_FAILURE;
+  return FUN_SUCCESS;
+}
+
+void linker_name(char *buf, size_t len, unsigned shard) {
+  if (shard == 0) {
+    snprintf(buf, len, "%s", LINKER_SHM);
+  } else {
+    snprintf(buf, len, "%s_%u", LINKER_SHM, shard);
   }
+}
 
-  return FUN_SUCCESS;
+void linker_set_shards(linker *lin, unsigned n) {
+  atomic_store(&lin->shards, (uint32_t)n);
+}
+
+unsigned linker_shards(linker *lin) {
+  return (unsigned)atomic_load(&lin->shards);
+}
+
+unsigned linker_next_epoch(linker *lin) {
+  return (unsigned)atomic_fetch_add(&lin->epoch, 1) + 1;
+}
+
+void linker_busy(linker *lin, int delta) {
+  if (delta > 0) {
+    atomic_fetch_add(&lin->busy, 1);
+  } else {
+    atomic_fetch_sub(&lin->busy, 1);
+  }
+}
+
+unsigned linker_load(linker *lin, unsigned *busy) {
+  unsigned b = (unsigned)atomic_load(&lin->busy);
+  int waiting;
+  if (sem_getvalue(&lin->full, &waiting) == -1 || waiting < 0) {
+    waiting = 0;
+  }
+  if (busy != NULL) {
+    *busy = b;
+  }
+  return b + (unsigned)waiting;
+}
+
+void linker_disconnect(linker **linker_p) {
+  if (*linker_p == NULL) {
+    return;
+  }
+  size_t shm_size = sizeof(linker) + LINKER_LANES * LINKER_LANE_BYTES;
+  if (munmap(*linker_p, shm_size) == -1) {
+    perror("munmap");
+  }
+  *linker_p = NULL;
 }
 
 void linker_dispose(linker **linker_p) {
   _cleanup(*linker_p);
   *linker_p = NULL;
 }
+
+/**
+ * @define  RING_CONSUMER_WAITING   the consumer sleeps on data_seq
+ * @define  RING_PRODUCER_WAITING   the producer sleeps on space_seq
+ */
+#define RING_CONSUMER_WAITING 0x1
+#define RING_PRODUCER_WAITING 0x2
+
+struct ring {
+  _Atomic uint64_t head;
+  _Atomic uint64_t tail;
+  _Atomic uint64_t end_seq;
+  _Atomic uint64_t end_pos;
+  uint64_t read_ends;
+  _Atomic uint32_t data_seq;
+  _Atomic uint32_t space_seq;
+  _Atomic uint32_t waiting;
+  char data[RING_SIZE];
+};
+
+/**
+ * @function  _shm_create
+ * @abstract  create the shm name, filled with size zeros, and map it
+ */
+static void *_shm_create(const char *name, size_t size) {
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+  if (fd == -1) {
+    perror("shm_open");
+    return NULL;
+  }
+  if (ftruncate(fd, (off_t)size) == -1) {
+    perror("ftruncate");
+    close(fd);
+    shm_unlink(name);
+    return NULL;
+  }
+  void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    perror("mmap");
+    shm_unlink(name);
+    return NULL;
+  }
+  return p;
+}
+
+/**
+ * @function  _shm_open
+ * @abstract  map the existing shm name
+ */
+static void *_shm_open(const char *name, size_t size) {
+  int fd = shm_open(name, O_RDWR, S_IRUSR | S_IWUSR);
+  if (fd == -1) {
+    perror("shm_open");
+    return NULL;
+  }
+  void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    perror("mmap");
+    return NULL;
+  }
+  return p;
+}
+
+/**
+ * @function  _shm_close
+ * @abstract  unmap a shm, destroying it if name is not NULL
+ */
+static void _shm_close(void *p, size_t size, const char *name) {
+  if (munmap(p, size) == -1) {
+    perror("munmap");
+  }
+  if (name != NULL && shm_unlink(name) == -1) {
+    perror("shm_unlink");
+  }
+}
+
+ring *ring_create(const char *name) {
+  // a new shm is filled with zeros: the ring is empty
+  return _shm_create(name, sizeof(ring));
+}
+
+ring *ring_open(const char *name) {
+  return _shm_open(name, sizeof(ring));
+}
+
+size_t ring_space(ring *rg) {
+  uint64_t head = atomic_load_explicit(&rg->head, memory_order_relaxed);
+  uint64_t tail = atomic_load_explicit(&rg->tail, memory_order_acquire);
+  return RING_SIZE - (size_t)(head - tail);
+}
+
+size_t ring_reserve(ring *rg, char **data) {
+  uint64_t head = atomic_load_explicit(&rg->head, memory_order_relaxed);
+  uint64_t tail = atomic_load_explicit(&rg->tail, memory_order_acquire);
+  size_t space = RING_SIZE - (size_t)(head - tail);
+  size_t off = (size_t)(head & (RING_SIZE - 1));
+  *data = rg->data + off;
+  return space < RING_SIZE - off ? space : RING_SIZE - off;
+}
+
+void ring_commit(ring *rg, size_t len) {
+  atomic_fetch_add_explicit(&rg->head, len, memory_order_release);
+  atomic_fetch_add(&rg->data_seq, 1);
+  if (atomic_load(&rg->waiting) & RING_CONSUMER_WAITING) {
+    _futex_wake(&rg->data_seq);
+  }
+}
+
+size_t ring_write(ring *rg, const void *buf, size_t len) {
+  size_t done = 0;
+  char *space;
+  size_t n;
+  // at most twice: up to the end of the data, then from its start
+  while (done < len && (n = ring_reserve(rg, &space)) > 0) {
+    n = n < len - done ? n : len - done;
+    memcpy(space, (const char *)buf + done, n);
+    ring_commit(rg, n);
+    done += n;
+  }
+  return done;
+}
+
+int ring_wait_space(ring *rg, int timeout_ms) {
+  struct timespec timeout = {.tv_sec = timeout_ms / 1000,
+                             .tv_nsec = (timeout_ms % 1000) * 1000000L};
+  uint32_t seq = atomic_load(&rg->space_seq);
+  atomic_fetch_or(&rg->waiting, RING_PRODUCER_WAITING);
+  if (atomic_load(&rg->head) - atomic_load(&rg->tail) == RING_SIZE) {
+    _futex_wait(&rg->space_seq, seq, &timeout);
+  }
+  atomic_fetch_and(&rg->waiting, ~(uint32_t)RING_PRODUCER_WAITING);
+  return atomic_load(&rg->head) - atomic_load(&rg->tail) < RING_SIZE
+             ? FUN_SUCCESS
+             : FUN_FAILURE;
+}
+
+void ring_end(ring *rg) {
+  atomic_store(&rg->end_pos, atomic_load(&rg->head));
+  atomic_fetch_add(&rg->end_seq, 1);
+  atomic_fetch_add(&rg->data_seq, 1);
+  if (atomic_load(&rg->waiting) & RING_CONSUMER_WAITING) {
+    _futex_wake(&rg->data_seq);
+  }
+}
+
+size_t ring_read(ring *rg, const char **data) {
+  for (;;) {
+    uint32_t seq = atomic_load(&rg->data_seq);
+    uint64_t tail = atomic_load_explicit(&rg->tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&rg->head, memory_order_acquire);
+    if (head != tail) {
+      size_t off = (size_t)(tail & (RING_SIZE - 1));
+      size_t n = (size_t)(head - tail);
+      *data = rg->data + off;
+      return n < RING_SIZE - off ? n : RING_SIZE - off;
+    }
+    if (atomic_load(&rg->end_seq) > rg->read_ends &&
+        atomic_load(&rg->end_pos) == tail) {
+      rg->read_ends++;
+      return 0;
+    }
+
+    atomic_fetch_or(&rg->waiting, RING_CONSUMER_WAITING);
+    if (atomic_load(&rg->head) == tail &&
+        atomic_load(&rg->end_seq) == rg->read_ends) {
+      _futex_wait(&rg->data_seq, seq, NULL);
+    }
+    atomic_fetch_and(&rg->waiting, ~(uint32_t)RING_CONSUMER_WAITING);
+  }
+}
+
+void ring_consume(ring *rg, size_t len) {
+  atomic_fetch_add_explicit(&rg->tail, len, memory_order_release);
+  atomic_fetch_add(&rg->space_seq, 1);
+  if (atomic_load(&rg->waiting) & RING_PRODUCER_WAITING) {
+    _futex_wake(&rg->space_seq);
+  }
+}
+
+void ring_close(ring **ring_p, const char *name) {
+  if (*ring_p == NULL) {
+    return;
+  }
+  _shm_close(*ring_p, sizeof(ring), name);
+  *ring_p = NULL;
+}
+
+struct slot {
+  _Atomic uint32_t seq;
+  _Atomic uint32_t waiting;
+  uint32_t read_seq;
+  completion rec;
+  uint64_t runner;
+  uint64_t token;
+};
+
+slot *slot_create(const char *name) {
+  return _shm_create(name, sizeof(slot));
+}
+
+slot *slot_open(const char *name) {
+  return _shm_open(name, sizeof(slot));
+}
+
+void slot_post(slot *sl, const completion *rec) {
+  // the client reads the record only once seq moved, it is not read while
+  // being written
+  sl->rec = *rec;
+  atomic_fetch_add_explicit(&sl->seq, 1, memory_order_release);
+  if (atomic_load(&sl->waiting)) {
+    _futex_wake(&sl->seq);
+  }
+}
+
+void slot_wait(slot *sl, completion *rec) {
+  uint32_t seq;
+  while ((seq = atomic_load_explicit(&sl->seq, memory_order_acquire)) ==
+         sl->read_seq) {
+    atomic_store(&sl->waiting, 1);
+    _futex_wait(&sl->seq, seq, NULL);
+    atomic_store(&sl->waiting, 0);
+  }
+  sl->read_seq = seq;
+  *rec = sl->rec;
+}
+
+int slot_timedwait(slot *sl, completion *rec, int timeout_ms) {
+  struct timespec timeout = {.tv_sec = timeout_ms / 1000,
+                             .tv_nsec = (timeout_ms % 1000) * 1000000L};
+  uint32_t seq = atomic_load_explicit(&sl->seq, memory_order_acquire);
+  if (seq == sl->read_seq) {
+    atomic_store(&sl->waiting, 1);
+    _futex_wait(&sl->seq, seq, &timeout);
+    atomic_store(&sl->waiting, 0);
+    seq = atomic_load_explicit(&sl->seq, memory_order_acquire);
+    if (seq == sl->read_seq) {
+      return FUN_FAILURE;
+    }
+  }
+  sl->read_seq = seq;
+  *rec = sl->rec;
+  return FUN_SUCCESS;
+}
+
+void slot_notify(slot *sl) {
+  if (atomic_load(&sl->waiting)) {
+    _futex_wake(&sl->seq);
+  }
+}
+
+int slot_peek(const slot *sl, completion *rec) {
+  if (atomic_load_explicit(&sl->seq, memory_order_acquire) == sl->read_seq) {
+    return FUN_FAILURE;
+  }
+  *rec = sl->rec;
+  return FUN_SUCCESS;
+}
+
+bool slot_unread(const slot *sl) {
+  return atomic_load_explicit(&sl->seq, memory_order_acquire) != sl->read_seq;
+}
+
+void slot_set_session(slot *sl, uint64_t runner, uint64_t token) {
+  sl->runner = runner;
+  sl->token = token;
+}
+
+void slot_session(const slot *sl, uint64_t *runner, uint64_t *token) {
+  *runner = sl->runner;
+  *token = sl->token;
+}
+
+void slot_close(slot **slot_p, const char *name) {
+  if (*slot_p == NULL) {
+    return;
+  }
+  _shm_close(*slot_p, sizeof(slot), name);
+  *slot_p = NULL;
+}
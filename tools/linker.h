@@ -2,39 +2,151 @@
 #define LINKER__H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <sys/types.h>
 
 /**
-* @define WD_LEN max length of the working dir string
+* @define RING_SIZE size of the data of an output ring, a power of 2
 */
-#ifndef WD_LEN
-#define WD_LEN 512
+#ifndef RING_SIZE
+#define RING_SIZE (1 << 20)
 #endif
 
+/**
+* @define CLIENT_RING flag of a client reading its output from a shm ring
+*/
+#define CLIENT_RING 0x1
+
+/**
+* @define CLIENT_PTY flag of a client whose commands write to a pseudo terminal,
+*         so that they flush their output line by line
+*/
+#define CLIENT_PTY 0x2
+
+/**
+* @define CLIENT_NOSIG flag of a client that must never be signaled, such as
+*         a process using libcmdc: a refused or cancelled session is reported
+*         through its completion slot instead of SIG_FAILURE
+*/
+#define CLIENT_NOSIG 0x4
+
 /**
 * @typedef struct client
 *         infos attached to a client
 * @field    pid           the client process id
-* @field    working_dir   the client working directory
+* @field    sid           the session id, unique among the sessions of pid
+* @field    flags         CLIENT_* options of the session
+* @field    wd_dev        device of the client working directory
+* @field    wd_ino        inode of the client working directory, the daemon
+*                         opens the directory through /proc and checks it is
+*                         this one
 */
 typedef struct client {
   pid_t pid;
-  char working_dir[WD_LEN];
+  uint32_t sid;
+  unsigned flags;
+  uint64_t wd_dev;
+  uint64_t wd_ino;
 } client;
 
+/**
+* @enum   linker_policy
+*         how linker_pop chooses between the priority lanes
+* @const  LINKER_STRICT     always serve the most urgent non empty lane
+* @const  LINKER_WEIGHTED   serve lanes in rounds of LINKER_WEIGHTS pops
+*/
+enum linker_policy { LINKER_STRICT, LINKER_WEIGHTED };
+
+/**
+* @typedef struct lane_stats
+*         metrics of a priority lane
+* @field    depth     number of clients waiting in the lane
+* @field    pushed    number of clients pushed in the lane since creation
+* @field    popped    number of clients popped from the lane since creation
+* @field    bytes     bytes of the lane taken by the waiting clients
+*/
+typedef struct lane_stats {
+  size_t depth;
+  unsigned long pushed;
+  unsigned long popped;
+  size_t bytes;
+} lane_stats;
+
 /**
 * @typedef linker
-*         the synchronised queue structure
-* @field    shm_name  the name in which the linker is stored
-* @field    head      head index
-* @field    tail      tail index
+*         the synchronised queue structure, one byte ring per priority lane
+*         storing clients as length prefixed records
+* @field    name      name of the shm, unlinked when the linker is disposed
 * @field    mutex     mutex shm
-* @field    empty     empty blocking shm
-* @field    full      full blocking shm
-* @field    buffer[]  memory allocated to the linker
+* @field    full      number of clients waiting in all the lanes
+* @field    shards    number of shards of the daemon, set in the linker of
+*                     the first one
+* @field    busy      number of runners of the shard serving a client
+* @field    epoch     number of daemons which took the linkers over from a
+*                     previous one, set in the linker of the first shard
+* @field    lanes[]   byte counts, space futex and metrics of each lane, each
+*                     on its own cache line
+* @field    buffer[]  LINKER_LANE_BYTES bytes of records per lane
 */
 typedef struct linker linker;
 
+/**
+* @typedef struct completion
+*         how a request of a client ended
+* @field    exit_code   exit status of the command, -1 if killed by a signal
+*                       or, with signal 0, if the daemon cancelled the session
+* @field    signal      signal that killed the command, 0 if it exited
+* @field    queued_ms   time waited for an execution slot
+* @field    run_ms      time from the start of the command to its end
+* @field    first_ms    time from the start of the command to its first byte
+*                       of output, -1 if it wrote nothing
+* @field    bytes       bytes of output sent to the client
+* @field    cpu         CPU the command ran on last, -1 if unknown
+* @field    majflt      major page faults of the commands, -1 if unknown
+*/
+typedef struct completion {
+  int32_t exit_code;
+  int32_t signal;
+  int64_t queued_ms;
+  int64_t run_ms;
+  int64_t first_ms;
+  uint64_t bytes;
+  int32_t cpu;
+  int32_t majflt;
+} completion;
+
+/**
+* @typedef slot
+*         completion record of the last request of a session, in a shm. The
+*         daemon posts a record once the output of a request ended, the client
+*         sleeps on a futex until it is posted.
+* @field    seq         futex bumped on each record posted
+* @field    waiting     is the client asleep?
+* @field    read_seq    last seq read by the client
+* @field    rec         the last record posted
+* @field    runner      id of the runner of the session
+* @field    token       secret of the session, presented to resume it
+*/
+typedef struct slot slot;
+
+/**
+* @typedef ring
+*         single producer single consumer byte ring in a shm, used by the
+*         daemon to send the output of commands to a client. The end of the
+*         output of each command is marked in the ring. A side sleeping on an
+*         empty or full ring is woken through a futex by the other side.
+* @field    head        bytes written since creation
+* @field    tail        bytes read since creation
+* @field    end_seq     number of command outputs ended by the producer
+* @field    end_pos     value of head at the last end of output
+* @field    read_ends   number of ends seen by the consumer
+* @field    data_seq    futex bumped by the producer on each write
+* @field    space_seq   futex bumped by the consumer on each read
+* @field    waiting     RING_*_WAITING flags of the sides asleep
+* @field    data[]      RING_SIZE bytes of data
+*/
+typedef struct ring ring;
+
 /**
  * @function  linker_init
  * @abstract  creates a linker
@@ -49,18 +161,94 @@ extern linker *linker_init(const char *name);
 extern linker *linker_connect(const char *name);
 /**
  * @function  linker_push
- * @abstract  adds a client to the end of the queue
+ * @abstract  adds a client to the end of the queue of a priority lane
  * @param   lin   the linker to use
  * @param   c     the client to put in the linker
+ * @param   lane  the priority lane, 0 is the most urgent
  */
-extern int linker_push(linker *lin, const client *c);
+extern int linker_push(linker *lin, const client *c, unsigned lane);
 /**
  * @function  linker_pop
- * @abstract  get and remove the first client in the queue
+ * @abstract  get and remove the first client of the lane chosen by policy
  * @param   lin   the linker to use
  * @param   buf   the buffer to store the client
+ * @param   pol   the policy used to choose between lanes
+ * @result  int   the lane the client was popped from, -1 on failure
+ */
+extern int linker_pop(linker *lin, client *buf, enum linker_policy pol);
+/**
+ * @function  linker_timedpop
+ * @abstract  linker_pop waiting at most timeout_ms for a client
+ * @param   lin         the linker to use
+ * @param   buf         the buffer to store the client
+ * @param   pol         the policy used to choose between lanes
+ * @param   timeout_ms  the longest wait
+ * @result  int   the lane the client was popped from, -1 on failure, errno
+ *                ETIMEDOUT if no client came and EINTR if a signal came first
+ */
+extern int linker_timedpop(linker *lin, client *buf, enum linker_policy pol,
+                           int timeout_ms);
+/**
+ * @function  linker_stats
+ * @abstract  read the metrics of a priority lane
+ * @param   lin   the linker to use
+ * @param   lane  the priority lane
+ * @param   st    the buffer to store the metrics
+ */
+extern int linker_stats(linker *lin, unsigned lane, lane_stats *st);
+/**
+ * @function  linker_name
+ * @abstract  name of the shm of the linker of a shard, LINKER_SHM for the
+ *            first one
+ * @param   buf   buffer to store the name
+ * @param   len   size of buf
+ * @param   shard the shard
+ */
+extern void linker_name(char *buf, size_t len, unsigned shard);
+/**
+ * @function  linker_set_shards
+ * @abstract  publish the number of shards of the daemon
+ * @param   lin   the linker of the first shard
+ * @param   n     number of shards
+ */
+extern void linker_set_shards(linker *lin, unsigned n);
+/**
+ * @function  linker_shards
+ * @abstract  number of shards of the daemon, read in the linker of the first
+ *            one
+ * @param   lin   the linker of the first shard
+ */
+extern unsigned linker_shards(linker *lin);
+/**
+ * @function  linker_next_epoch
+ * @abstract  count one more daemon taking the linkers over from a previous
+ *            one
+ * @param   lin   the linker of the first shard
+ * @result  unsigned  the number of the calling daemon, the one that created
+ *                    the linkers being 0
  */
-extern int linker_pop(linker *lin, client *buf);
+extern unsigned linker_next_epoch(linker *lin);
+/**
+ * @function  linker_busy
+ * @abstract  account a runner of the shard taking or leaving a client
+ * @param   lin   the linker of the shard
+ * @param   delta 1 when a runner takes a client, -1 when it leaves it
+ */
+extern void linker_busy(linker *lin, int delta);
+/**
+ * @function  linker_load
+ * @abstract  load of a shard: its busy runners and its waiting clients
+ * @param   lin   the linker of the shard
+ * @param   busy  buffer to store the number of busy runners, may be NULL
+ * @result  unsigned  busy runners plus waiting clients
+ */
+extern unsigned linker_load(linker *lin, unsigned *busy);
+/**
+ * @function  linker_disconnect
+ * @abstract  unmap a linker connected with linker_connect
+ * @param   linker_p    a pointer to the linker's pointer
+ */
+extern void linker_disconnect(linker **linker_p);
 /**
  * @function  linker_dispose
  * @abstract  free memory and destroy a linker
@@ -68,4 +256,168 @@ extern int linker_pop(linker *lin, client *buf);
  */
 extern void linker_dispose(linker **linker_p);
 
+/**
+ * @function  ring_create
+ * @abstract  creates an empty output ring, done by the consumer
+ * @param   name    shm name to store the ring
+ */
+extern ring *ring_create(const char *name);
+/**
+ * @function  ring_open
+ * @abstract  connect to an existing output ring, done by the producer
+ * @param   name    name of the ring's shm
+ */
+extern ring *ring_open(const char *name);
+/**
+ * @function  ring_write
+ * @abstract  write what fits in the ring without waiting
+ * @param   rg    the ring to use
+ * @param   buf   the bytes to write
+ * @param   len   number of bytes
+ * @result  size_t  number of bytes written
+ */
+extern size_t ring_write(ring *rg, const void *buf, size_t len);
+/**
+ * @function  ring_space
+ * @abstract  number of bytes that can be written without waiting
+ * @param   rg    the ring to use
+ */
+extern size_t ring_space(ring *rg);
+/**
+ * @function  ring_reserve
+ * @abstract  get the free space of the ring in place, to be filled then
+ *            published with ring_commit
+ * @param   rg    the ring to use
+ * @param   data  buffer to store the address of the free space
+ * @result  size_t  number of contiguous free bytes
+ */
+extern size_t ring_reserve(ring *rg, char **data);
+/**
+ * @function  ring_commit
+ * @abstract  publish bytes written in the space returned by ring_reserve
+ * @param   rg    the ring to use
+ * @param   len   number of bytes written
+ */
+extern void ring_commit(ring *rg, size_t len);
+/**
+ * @function  ring_wait_space
+ * @abstract  wait until the consumer frees space in a full ring
+ * @param   rg          the ring to use
+ * @param   timeout_ms  max time to wait
+ * @result  int   0 if there is space, -1 on timeout
+ */
+extern int ring_wait_space(ring *rg, int timeout_ms);
+/**
+ * @function  ring_end
+ * @abstract  mark the end of the output of a command
+ * @param   rg    the ring to use
+ */
+extern void ring_end(ring *rg);
+/**
+ * @function  ring_read
+ * @abstract  wait for output, returning the bytes in place
+ * @param   rg    the ring to use
+ * @param   data  buffer to store the address of the bytes in the ring
+ * @result  size_t  number of contiguous bytes available, 0 once the output
+ *                  of the command ended
+ */
+extern size_t ring_read(ring *rg, const char **data);
+/**
+ * @function  ring_consume
+ * @abstract  give back to the producer bytes returned by ring_read
+ * @param   rg    the ring to use
+ * @param   len   number of bytes done with
+ */
+extern void ring_consume(ring *rg, size_t len);
+/**
+ * @function  ring_close
+ * @abstract  unmap a ring, destroying its shm if name is not NULL
+ * @param   ring_p    a pointer to the ring's pointer
+ * @param   name      name of the ring's shm, NULL to keep it
+ */
+extern void ring_close(ring **ring_p, const char *name);
+
+/**
+ * @function  slot_create
+ * @abstract  creates an empty completion slot, done by the client
+ * @param   name    shm name to store the slot
+ */
+extern slot *slot_create(const char *name);
+/**
+ * @function  slot_open
+ * @abstract  connect to an existing completion slot, done by the daemon
+ * @param   name    name of the slot's shm
+ */
+extern slot *slot_open(const char *name);
+/**
+ * @function  slot_post
+ * @abstract  publish the completion record of a request
+ * @param   sl    the slot to use
+ * @param   rec   the record
+ */
+extern void slot_post(slot *sl, const completion *rec);
+/**
+ * @function  slot_wait
+ * @abstract  wait for the record of the request following the last one read
+ * @param   sl    the slot to use
+ * @param   rec   buffer to store the record
+ */
+extern void slot_wait(slot *sl, completion *rec);
+/**
+ * @function  slot_timedwait
+ * @abstract  wait at most timeout_ms for the record of the request following
+ *            the last one read
+ * @param   sl          the slot to use
+ * @param   rec         buffer to store the record
+ * @param   timeout_ms  max time to wait
+ * @result  int   0 if a record was read, -1 on timeout
+ */
+extern int slot_timedwait(slot *sl, completion *rec, int timeout_ms);
+/**
+ * @function  slot_notify
+ * @abstract  wake the client waiting on a slot without posting a record, done
+ *            by the daemon once it reads the request pipe of the client
+ * @param   sl    the slot to use
+ */
+extern void slot_notify(slot *sl);
+/**
+ * @function  slot_peek
+ * @abstract  get the last record posted if the client has not read it,
+ *            without marking it read
+ * @param   sl    the slot to use
+ * @param   rec   buffer to store the record
+ * @result  int   0 if a record was unread, -1 otherwise
+ */
+extern int slot_peek(const slot *sl, completion *rec);
+/**
+ * @function  slot_unread
+ * @abstract  tell if the client has not read the last record posted
+ * @param   sl    the slot to use
+ */
+extern bool slot_unread(const slot *sl);
+/**
+ * @function  slot_set_session
+ * @abstract  give the client what it needs to resume its session, done by
+ *            the daemon before the client connects
+ * @param   sl      the slot to use
+ * @param   runner  id of the runner of the session
+ * @param   token   secret of the session
+ */
+extern void slot_set_session(slot *sl, uint64_t runner, uint64_t token);
+/**
+ * @function  slot_session
+ * @abstract  get the runner and token of a session, done by the client
+ * @param   sl      the slot to use
+ * @param   runner  buffer to store the id of the runner
+ * @param   token   buffer to store the secret of the session
+ */
+extern void slot_session(const slot *sl, uint64_t *runner, uint64_t *token);
+/**
+ * @function  slot_close
+ * @abstract  unmap a slot, destroying its shm if name is not NULL
+ * @param   slot_p    a pointer to the slot's pointer
+ * @param   name      name of the slot's shm, NULL to keep it
+ */
+extern void slot_close(slot **slot_p, const char *name);
+
 #endif
@@ -0,0 +1,725 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "prewarm.h"
+
+#define FUN_FAILURE -1
+#define FUN_SUCCESS 0
+
+/**
+ * @define  PW_MAGIC      marks a file holding counts of this layout
+ */
+#define PW_MAGIC 0x636d64737761726dULL
+
+/**
+ * @define  PW_PHDRS      max number of program headers read from a binary
+ */
+#define PW_PHDRS 64
+
+/**
+ * @define  PW_DYNS       max number of dynamic entries read from a binary
+ */
+#define PW_DYNS 512
+
+/**
+ * @define  PW_FILES      max number of files prewarmed by a pass
+ */
+#define PW_FILES (PREWARM_TOP * PREWARM_DEPS)
+
+/**
+ * @struct    pw_entry
+ * @abstract  counts of a binary, stored in the file
+ *
+ * @field     key         hash of the path, 0 if unused
+ * @field     path        the binary
+ * @field     runs        number of commands run from it
+ * @field     recent      runs, halved at every pass so the binaries used
+ *                        lately come first
+ * @field     cold_runs   number of runs which made major page faults
+ * @field     cold_timed  number of cold runs with a known runtime
+ * @field     cold_ms     total runtime of these in ms
+ * @field     warm_timed  number of other runs with a known runtime
+ * @field     warm_ms     total runtime of these in ms
+ * @field     prefetched  bytes prefetched for the binary by the last pass
+ * @field     locked      bytes of them locked in memory
+ */
+struct pw_entry {
+  uint64_t key;
+  char path[PREWARM_PATH_LEN];
+  uint64_t runs;
+  double recent;
+  uint64_t cold_runs;
+  uint64_t cold_timed;
+  double cold_ms;
+  uint64_t warm_timed;
+  double warm_ms;
+  uint64_t prefetched;
+  uint64_t locked;
+};
+
+/**
+ * @struct    pw_file
+ * @abstract  layout of the file
+ *
+ * @field     magic     PW_MAGIC
+ * @field     slots     number of entries
+ * @field     entries[] open addressed table of binaries
+ */
+struct pw_file {
+  uint64_t magic;
+  uint64_t slots;
+  struct pw_entry entries[];
+};
+
+/**
+ * @struct    pw_lock
+ * @abstract  a file mapped and locked in memory
+ *
+ * @field     path      the file
+ * @field     addr      the mapping
+ * @field     len       length of the mapping
+ * @field     seen      is the file still needed by the current pass?
+ */
+struct pw_lock {
+  char path[PREWARM_PATH_LEN];
+  void *addr;
+  size_t len;
+  bool seen;
+};
+
+struct prewarm {
+  struct pw_file *map;
+  pthread_mutex_t mutex;
+  pthread_cond_t wake;
+  pthread_t thread;
+  bool started;
+  bool stop;
+  long interval_ms;
+  size_t lock_bytes;
+  struct pw_lock locks[PW_FILES];
+  size_t nlocks;
+  char files[PW_FILES][PREWARM_PATH_LEN];
+};
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+/**
+ * @function  _key
+ * @abstract  FNV-1a of a path, never 0
+ */
+static uint64_t _key(const char *path) {
+  uint64_t h = FNV_OFFSET;
+  for (const unsigned char *p = (const unsigned char *)path; *p != 0; p++) {
+    h ^= *p;
+    h *= FNV_PRIME;
+  }
+  return h == 0 ? 1 : h;
+}
+
+/**
+ * @function  _find
+ * @abstract  find the entry of key, or the slot where it should be added
+ */
+static struct pw_entry *_find(prewarm *pw, uint64_t key) {
+  size_t slots = (size_t)pw->map->slots;
+  size_t i = (size_t)(key % slots);
+  for (size_t n = 0; n < slots; n++) {
+    struct pw_entry *e = &pw->map->entries[(i + n) % slots];
+    if (e->key == key || e->key == 0) {
+      return e;
+    }
+  }
+  // table full: forget the binary in the first probed slot
+  return &pw->map->entries[i];
+}
+
+/**
+ * @function  _before
+ * @abstract  should a come before b in the top?
+ */
+static bool _before(const struct pw_entry *a, const struct pw_entry *b) {
+  return a->recent > b->recent || (a->recent == b->recent && a->runs > b->runs);
+}
+
+/**
+ * @function  _top
+ * @abstract  the n entries used the most lately, the mutex being held
+ * @result  size_t  number of entries stored in top
+ */
+static size_t _top(prewarm *pw, struct pw_entry **top, size_t n) {
+  size_t count = 0;
+  for (size_t i = 0; i < (size_t)pw->map->slots; i++) {
+    struct pw_entry *e = &pw->map->entries[i];
+    if (e->key == 0 || n == 0) {
+      continue;
+    }
+    // insertion in the sorted top, the last one falling off when full
+    size_t j = count < n ? count++ : n;
+    while (j > 0 && _before(e, top[j - 1])) {
+      if (j < n) {
+        top[j] = top[j - 1];
+      }
+      j--;
+    }
+    if (j < n) {
+      top[j] = e;
+    }
+  }
+  return count;
+}
+
+/**
+ * @function  _add
+ * @abstract  add a path to files[start..n) unless already in
+ * @result  size_t  the new number of files
+ */
+static size_t _add(char (*files)[PREWARM_PATH_LEN], size_t start, size_t n,
+                   const char *path) {
+  if (n - start >= PREWARM_DEPS || strlen(path) >= PREWARM_PATH_LEN) {
+    return n;
+  }
+  for (size_t i = start; i < n; i++) {
+    if (strcmp(files[i], path) == 0) {
+      return n;
+    }
+  }
+  strcpy(files[n], path);
+  return n + 1;
+}
+
+/**
+ * @function  _library
+ * @abstract  find a library in PREWARM_LIB_DIRS, as the dynamic loader would
+ *            without a cache
+ */
+static int _library(const char *name, char *buf, size_t len) {
+  size_t name_len = strlen(name);
+  const char *dirs = PREWARM_LIB_DIRS;
+  while (*dirs != 0) {
+    size_t dir_len = strcspn(dirs, ":");
+    if (dir_len + 1 + name_len < len) {
+      memcpy(buf, dirs, dir_len);
+      buf[dir_len] = '/';
+      memcpy(buf + dir_len + 1, name, name_len + 1);
+      if (access(buf, R_OK) == 0) {
+        return FUN_SUCCESS;
+      }
+    }
+    dirs += dir_len;
+    if (*dirs == ':') {
+      dirs++;
+    }
+  }
+  return FUN_FAILURE;
+}
+
+/**
+ * @function  _offset
+ * @abstract  offset in the file of an address of the loaded binary
+ * @result  off_t   the offset, -1 if the address is not loaded from the file
+ */
+static off_t _offset(const Elf64_Phdr *ph, size_t nph, uint64_t vaddr) {
+  for (size_t i = 0; i < nph; i++) {
+    if (ph[i].p_type == PT_LOAD && vaddr >= ph[i].p_vaddr &&
+        vaddr - ph[i].p_vaddr < ph[i].p_filesz) {
+      return (off_t)(vaddr - ph[i].p_vaddr + ph[i].p_offset);
+    }
+  }
+  return -1;
+}
+
+/**
+ * @function  _needs
+ * @abstract  add to files[start..n) the loader and the libraries an ELF64
+ *            binary needs, read from its program headers and dynamic section,
+ *            or the interpreter of a script
+ * @result  size_t  the new number of files
+ */
+static size_t _needs(const char *path, char (*files)[PREWARM_PATH_LEN],
+                     size_t start, size_t n) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return n;
+  }
+  Elf64_Ehdr eh;
+  Elf64_Phdr ph[PW_PHDRS];
+  size_t nph = 0;
+  if (pread(fd, &eh, sizeof(eh), 0) == (ssize_t)sizeof(eh) &&
+      memcmp(eh.e_ident, ELFMAG, SELFMAG) == 0 &&
+      eh.e_ident[EI_CLASS] == ELFCLASS64 &&
+      eh.e_phentsize == sizeof(Elf64_Phdr) && eh.e_phnum <= PW_PHDRS &&
+      pread(fd, ph, eh.e_phnum * sizeof(Elf64_Phdr), (off_t)eh.e_phoff) ==
+          (ssize_t)(eh.e_phnum * sizeof(Elf64_Phdr))) {
+    nph = eh.e_phnum;
+  }
+  char name[PREWARM_PATH_LEN];
+  char lib[PREWARM_PATH_LEN];
+  ssize_t r = pread(fd, name, sizeof(name) - 1, 0);
+  if (nph == 0 && r > 2 && name[0] == '#' && name[1] == '!') {
+    name[r] = 0;
+    char *interp = name + 2 + strspn(name + 2, " \t");
+    interp[strcspn(interp, " \t\n")] = 0;
+    n = _add(files, start, n, interp);
+  }
+  for (size_t i = 0; i < nph; i++) {
+    if (ph[i].p_type == PT_INTERP && ph[i].p_filesz < sizeof(name) &&
+        pread(fd, name, ph[i].p_filesz, (off_t)ph[i].p_offset) ==
+            (ssize_t)ph[i].p_filesz) {
+      name[ph[i].p_filesz] = 0;
+      n = _add(files, start, n, name);
+    }
+    if (ph[i].p_type != PT_DYNAMIC) {
+      continue;
+    }
+    Elf64_Dyn dyn[PW_DYNS];
+    size_t ndyn = ph[i].p_filesz / sizeof(Elf64_Dyn);
+    ndyn = ndyn < PW_DYNS ? ndyn : PW_DYNS;
+    if (pread(fd, dyn, ndyn * sizeof(Elf64_Dyn), (off_t)ph[i].p_offset) !=
+        (ssize_t)(ndyn * sizeof(Elf64_Dyn))) {
+      continue;
+    }
+    uint64_t strtab = 0, strsz = 0;
+    for (size_t d = 0; d < ndyn && dyn[d].d_tag != DT_NULL; d++) {
+      if (dyn[d].d_tag == DT_STRTAB) {
+        strtab = dyn[d].d_un.d_ptr;
+      } else if (dyn[d].d_tag == DT_STRSZ) {
+        strsz = dyn[d].d_un.d_val;
+      }
+    }
+    off_t off = _offset(ph, nph, strtab);
+    for (size_t d = 0; off != -1 && d < ndyn && dyn[d].d_tag != DT_NULL;
+         d++) {
+      if (dyn[d].d_tag != DT_NEEDED || dyn[d].d_un.d_val >= strsz) {
+        continue;
+      }
+      r = pread(fd, name, sizeof(name) - 1, off + (off_t)dyn[d].d_un.d_val);
+      if (r <= 0 || memchr(name, 0, (size_t)r) == NULL) {
+        continue;
+      }
+      if (strchr(name, '/') != NULL) {
+        n = _add(files, start, n, name);
+      } else if (_library(name, lib, sizeof(lib)) == FUN_SUCCESS) {
+        n = _add(files, start, n, lib);
+      }
+    }
+  }
+  close(fd);
+  return n;
+}
+
+/**
+ * @function  _locked
+ * @abstract  the lock of a file, NULL if it is not locked
+ */
+static struct pw_lock *_locked(prewarm *pw, const char *path) {
+  for (size_t i = 0; i < pw->nlocks; i++) {
+    if (strcmp(pw->locks[i].path, path) == 0) {
+      return &pw->locks[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * @function  _unlock
+ * @abstract  unlock and unmap the files no longer seen, all if all is set
+ */
+static void _unlock(prewarm *pw, bool all) {
+  size_t kept = 0;
+  for (size_t i = 0; i < pw->nlocks; i++) {
+    struct pw_lock *l = &pw->locks[i];
+    if (l->seen && !all) {
+      pw->locks[kept++] = *l;
+      continue;
+    }
+    munlock(l->addr, l->len);
+    munmap(l->addr, l->len);
+  }
+  pw->nlocks = kept;
+}
+
+/**
+ * @function  _warm
+ * @abstract  prefetch a file into the page cache and lock it in memory if it
+ *            is not yet and fits in the budget
+ * @param   budget  buffer holding the bytes which may still be locked
+ * @param   locked  buffer to add the bytes of the file locked to
+ * @result  size_t  the bytes prefetched
+ */
+static size_t _warm(prewarm *pw, const char *path, size_t *budget,
+                    size_t *locked) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return 0;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+    close(fd);
+    return 0;
+  }
+  size_t size = (size_t)st.st_size;
+  // reads ahead asynchronously, the pages already cached are left as is
+  posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+  struct pw_lock *l = _locked(pw, path);
+  if (l == NULL && pw->nlocks < PW_FILES && size <= *budget) {
+    void *addr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr != MAP_FAILED) {
+      // commands forked by the daemon need not copy the mapping
+      madvise(addr, size, MADV_DONTFORK);
+      if (mlock(addr, size) == 0) {
+        l = &pw->locks[pw->nlocks++];
+        strcpy(l->path, path);
+        l->addr = addr;
+        l->len = size;
+        l->seen = true;
+        *budget -= size;
+      } else {
+        munmap(addr, size);
+      }
+    }
+  }
+  if (l != NULL) {
+    *locked += l->len;
+  }
+  close(fd);
+  return size;
+}
+
+/**
+ * @function  _pass
+ * @abstract  prewarm the binaries used the most lately, then age the counts
+ */
+static void _pass(prewarm *pw) {
+  char bins[PREWARM_TOP][PREWARM_PATH_LEN];
+  uint64_t keys[PREWARM_TOP];
+  size_t start[PREWARM_TOP + 1];
+  struct pw_entry *top[PREWARM_TOP];
+
+  pthread_mutex_lock(&pw->mutex);
+  size_t ntop = _top(pw, top, PREWARM_TOP);
+  for (size_t b = 0; b < ntop; b++) {
+    keys[b] = top[b]->key;
+    strcpy(bins[b], top[b]->path);
+  }
+  for (size_t i = 0; i < (size_t)pw->map->slots; i++) {
+    pw->map->entries[i].recent /= 2;
+  }
+  pthread_mutex_unlock(&pw->mutex);
+
+  // each binary comes with its loader and its libraries, and theirs
+  size_t n = 0;
+  for (size_t b = 0; b < ntop; b++) {
+    start[b] = n;
+    n = _add(pw->files, n, n, bins[b]);
+    for (size_t k = start[b]; k < n; k++) {
+      n = _needs(pw->files[k], pw->files, start[b], n);
+    }
+  }
+  start[ntop] = n;
+
+  // the files left out are unlocked before any other is locked
+  for (size_t i = 0; i < pw->nlocks; i++) {
+    struct pw_lock *l = &pw->locks[i];
+    l->seen = false;
+    for (size_t k = 0; k < n && !l->seen; k++) {
+      l->seen = strcmp(l->path, pw->files[k]) == 0;
+    }
+  }
+  _unlock(pw, false);
+  size_t budget = pw->lock_bytes;
+  for (size_t i = 0; i < pw->nlocks; i++) {
+    budget = budget > pw->locks[i].len ? budget - pw->locks[i].len : 0;
+  }
+
+  for (size_t b = 0; b < ntop; b++) {
+    size_t prefetched = 0, locked = 0;
+    for (size_t k = start[b]; k < start[b + 1]; k++) {
+      prefetched += _warm(pw, pw->files[k], &budget, &locked);
+    }
+    pthread_mutex_lock(&pw->mutex);
+    struct pw_entry *e = _find(pw, keys[b]);
+    if (e->key == keys[b]) {
+      e->prefetched = prefetched;
+      e->locked = locked;
+    }
+    pthread_mutex_unlock(&pw->mutex);
+  }
+}
+
+/**
+ * @function  _routine
+ * @abstract  pass, then sleep until the next one or until stopped
+ */
+static void *_routine(void *arg) {
+  prewarm *pw = arg;
+  pthread_mutex_lock(&pw->mutex);
+  while (!pw->stop) {
+    pthread_mutex_unlock(&pw->mutex);
+    _pass(pw);
+    pthread_mutex_lock(&pw->mutex);
+    struct timespec t;
+    clock_gettime(CLOCK_REALTIME, &t);
+    t.tv_sec += pw->interval_ms / 1000;
+    t.tv_nsec += pw->interval_ms % 1000 * 1000000;
+    if (t.tv_nsec >= 1000000000) {
+      t.tv_sec++;
+      t.tv_nsec -= 1000000000;
+    }
+    while (!pw->stop &&
+           pthread_cond_timedwait(&pw->wake, &pw->mutex, &t) != ETIMEDOUT) {
+    }
+  }
+  pthread_mutex_unlock(&pw->mutex);
+  return NULL;
+}
+
+/**
+ * @function  _wrap
+ * @abstract  the counts of a mapped file, unmapped on failure
+ */
+static prewarm *_wrap(struct pw_file *map, size_t size) {
+  prewarm *pw = malloc(sizeof(prewarm));
+  if (pw == NULL) {
+    perror("malloc");
+    munmap(map, size);
+    return NULL;
+  }
+  pw->map = map;
+  pw->started = false;
+  pw->stop = false;
+  pw->nlocks = 0;
+  if (pthread_mutex_init(&pw->mutex, NULL) != 0 ||
+      pthread_cond_init(&pw->wake, NULL) != 0) {
+    perror("pthread_mutex_init");
+    munmap(map, size);
+    free(pw);
+    return NULL;
+  }
+
+  return pw;
+}
+
+prewarm *prewarm_open(const char *path) {
+  size_t size =
+      sizeof(struct pw_file) + PREWARM_SLOTS * sizeof(struct pw_entry);
+
+  int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+  if (fd == -1) {
+    perror("open");
+    return NULL;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    perror("fstat");
+    close(fd);
+    return NULL;
+  }
+
+  bool fresh = (size_t)st.st_size != size;
+  if (fresh && ftruncate(fd, (off_t)size) == -1) {
+    perror("ftruncate");
+    close(fd);
+    return NULL;
+  }
+
+  struct pw_file *map =
+      mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    perror("mmap");
+    return NULL;
+  }
+
+  if (fresh || map->magic != PW_MAGIC || map->slots != PREWARM_SLOTS) {
+    memset(map, 0, size);
+    map->magic = PW_MAGIC;
+    map->slots = PREWARM_SLOTS;
+  }
+
+  return _wrap(map, size);
+}
+
+prewarm *prewarm_open_readonly(const char *path) {
+  size_t size =
+      sizeof(struct pw_file) + PREWARM_SLOTS * sizeof(struct pw_entry);
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == -1 || (size_t)st.st_size != size) {
+    close(fd);
+    errno = EINVAL;
+    return NULL;
+  }
+  struct pw_file *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return NULL;
+  }
+  if (map->magic != PW_MAGIC || map->slots != PREWARM_SLOTS) {
+    munmap(map, size);
+    errno = EINVAL;
+    return NULL;
+  }
+
+  return _wrap(map, size);
+}
+
+void prewarm_record(prewarm *pw, const char *bin, long ms, long majflt) {
+  if (pw == NULL || bin[0] != '/' || strlen(bin) >= PREWARM_PATH_LEN) {
+    return;
+  }
+  uint64_t key = _key(bin);
+  bool cold = majflt > 0;
+
+  pthread_mutex_lock(&pw->mutex);
+  struct pw_entry *e = _find(pw, key);
+  if (e->key != key) {
+    memset(e, 0, sizeof(*e));
+    e->key = key;
+    strcpy(e->path, bin);
+  }
+  e->runs++;
+  e->recent += 1;
+  if (cold) {
+    e->cold_runs++;
+  }
+  if (ms >= 0 && majflt >= 0) {
+    if (cold) {
+      e->cold_timed++;
+      e->cold_ms += (double)ms;
+    } else {
+      e->warm_timed++;
+      e->warm_ms += (double)ms;
+    }
+  }
+  pthread_mutex_unlock(&pw->mutex);
+}
+
+int prewarm_start(prewarm *pw, long interval_ms, size_t lock_bytes) {
+  if (pw->started) {
+    errno = EALREADY;
+    return FUN_FAILURE;
+  }
+  pw->interval_ms = interval_ms;
+  pw->lock_bytes = lock_bytes;
+  // the thread takes no signal, they are for the threads of the caller
+  sigset_t all, old;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  int err = pthread_create(&pw->thread, NULL, _routine, pw);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  if (err != 0) {
+    errno = err;
+    perror("pthread_create");
+    return FUN_FAILURE;
+  }
+  pw->started = true;
+  return FUN_SUCCESS;
+}
+
+size_t prewarm_top(prewarm *pw, prewarm_stat *out, size_t n) {
+  struct pw_entry *top[PREWARM_SLOTS];
+  if (pw == NULL) {
+    return 0;
+  }
+  n = n < PREWARM_SLOTS ? n : PREWARM_SLOTS;
+
+  pthread_mutex_lock(&pw->mutex);
+  size_t count = _top(pw, top, n);
+  for (size_t i = 0; i < count; i++) {
+    struct pw_entry *e = top[i];
+    strcpy(out[i].path, e->path);
+    out[i].runs = e->runs;
+    out[i].cold_runs = e->cold_runs;
+    out[i].cold_ms =
+        e->cold_timed > 0 ? e->cold_ms / (double)e->cold_timed : -1;
+    out[i].warm_ms =
+        e->warm_timed > 0 ? e->warm_ms / (double)e->warm_timed : -1;
+    out[i].prefetched = e->prefetched;
+    out[i].locked = e->locked;
+  }
+  pthread_mutex_unlock(&pw->mutex);
+
+  return count;
+}
+
+int prewarm_resident(const char *path) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return FUN_FAILURE;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    close(fd);
+    return FUN_FAILURE;
+  }
+  if (st.st_size == 0) {
+    close(fd);
+    return 100;
+  }
+  size_t size = (size_t)st.st_size;
+  void *addr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    return FUN_FAILURE;
+  }
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t pages = (size + page - 1) / page;
+  unsigned char *vec = malloc(pages);
+  int pct = FUN_FAILURE;
+  if (vec != NULL && mincore(addr, size, vec) == 0) {
+    size_t resident = 0;
+    for (size_t i = 0; i < pages; i++) {
+      resident += vec[i] & 1;
+    }
+    pct = (int)(resident * 100 / pages);
+  }
+  free(vec);
+  munmap(addr, size);
+  return pct;
+}
+
+void prewarm_close(prewarm **prewarm_p) {
+  prewarm *pw = *prewarm_p;
+  if (pw == NULL) {
+    return;
+  }
+  if (pw->started) {
+    pthread_mutex_lock(&pw->mutex);
+    pw->stop = true;
+    pthread_cond_signal(&pw->wake);
+    pthread_mutex_unlock(&pw->mutex);
+    pthread_join(pw->thread, NULL);
+  }
+  _unlock(pw, true);
+  size_t size = sizeof(struct pw_file) +
+                (size_t)pw->map->slots * sizeof(struct pw_entry);
+  if (munmap(pw->map, size) == -1) {
+    perror("munmap");
+  }
+  pthread_cond_destroy(&pw->wake);
+  pthread_mutex_destroy(&pw->mutex);
+  free(pw);
+  *prewarm_p = NULL;
+}
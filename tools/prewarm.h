@@ -0,0 +1,127 @@
+#ifndef PREWARM__H
+#define PREWARM__H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+* @define PREWARM_PATH_LEN  max length of the path of a binary counted
+*/
+#ifndef PREWARM_PATH_LEN
+#define PREWARM_PATH_LEN 256
+#endif
+
+/**
+* @define PREWARM_DEPS  max number of files prewarmed for one binary: the
+*                       binary, its loader and the libraries it needs
+*/
+#ifndef PREWARM_DEPS
+#define PREWARM_DEPS 32
+#endif
+
+/**
+* @typedef prewarm
+*         counts of the binaries commands are executed from, mapped from a
+*         file so they survive daemon restarts, and the thread keeping the
+*         most run ones in the page cache.
+* @field    map       the mapped file: a header followed by the entries
+* @field    mutex     protects the entries against concurrent runners and the
+*                     thread
+* @field    wake      wakes the thread up to stop it
+* @field    thread    the thread prewarming, if started
+* @field    started   was the thread started?
+* @field    stop      should the thread stop?
+* @field    interval_ms   milliseconds between two passes
+* @field    lock_bytes    bytes the thread may lock in memory, 0 for none
+* @field    locks     the files locked in memory by the thread
+* @field    nlocks    number of files locked
+* @field    files     the files prewarmed by the current pass
+*/
+typedef struct prewarm prewarm;
+
+/**
+* @typedef prewarm_stat
+*         statistics of a binary, as returned by prewarm_top
+* @field    path        the binary
+* @field    runs        number of commands run from it
+* @field    cold_runs   number of them which had to read it from the disk
+* @field    cold_ms     mean runtime of the cold runs in ms, -1 if unknown
+* @field    warm_ms     mean runtime of the other runs in ms, -1 if unknown
+* @field    prefetched  bytes of the binary and its libraries prefetched by the
+*                       last pass
+* @field    locked      bytes of them locked in memory
+*/
+typedef struct prewarm_stat {
+  char path[PREWARM_PATH_LEN];
+  uint64_t runs;
+  uint64_t cold_runs;
+  double cold_ms;
+  double warm_ms;
+  uint64_t prefetched;
+  uint64_t locked;
+} prewarm_stat;
+
+/**
+ * @function  prewarm_open
+ * @abstract  map the counts stored in path, creating them if needed
+ * @param   path    the file storing the counts
+ */
+extern prewarm *prewarm_open(const char *path);
+/**
+ * @function  prewarm_open_readonly
+ * @abstract  map the counts stored in path to read them, without creating
+ *            nor resetting them. Only prewarm_top and prewarm_close may be
+ *            used on them.
+ * @param   path    the file storing the counts
+ * @result  prewarm*  the counts, NULL if the file is missing or not valid
+ */
+extern prewarm *prewarm_open_readonly(const char *path);
+/**
+ * @function  prewarm_record
+ * @abstract  count a command run from a binary
+ * @param   pw      the counts to use
+ * @param   bin     the binary, an absolute path
+ * @param   ms      the runtime of the command in ms, -1 if unknown
+ * @param   majflt  major page faults of the command, -1 if unknown. A command
+ *                  which made some had to read its binary or libraries from
+ *                  the disk: its run is cold.
+ */
+extern void prewarm_record(prewarm *pw, const char *bin, long ms,
+                           long majflt);
+/**
+ * @function  prewarm_start
+ * @abstract  start a thread which, at once then every interval, prefetches
+ *            the PREWARM_TOP binaries run the most lately into the page
+ *            cache, with their loader and the libraries they need
+ * @param   pw            the counts to use
+ * @param   interval_ms   milliseconds between two passes
+ * @param   lock_bytes    bytes of these files which may also be locked in
+ *                        memory, 0 to lock none
+ * @result  int     0 on success, -1 on failure
+ */
+extern int prewarm_start(prewarm *pw, long interval_ms, size_t lock_bytes);
+/**
+ * @function  prewarm_top
+ * @abstract  statistics of the binaries run the most lately
+ * @param   pw      the counts to use
+ * @param   out     buffer to store the statistics
+ * @param   n       size of out
+ * @result  size_t  number of binaries stored, by decreasing use
+ */
+extern size_t prewarm_top(prewarm *pw, prewarm_stat *out, size_t n);
+/**
+ * @function  prewarm_resident
+ * @abstract  share of a file currently in the page cache
+ * @param   path    the file
+ * @result  int     the percentage of its pages resident, -1 on failure
+ */
+extern int prewarm_resident(const char *path);
+/**
+ * @function  prewarm_close
+ * @abstract  stop the thread, unlock the files, unmap the counts and free
+ *            memory
+ * @param   prewarm_p   a pointer to the counts' pointer
+ */
+extern void prewarm_close(prewarm **prewarm_p);
+
+#endif
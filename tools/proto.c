@@ -0,0 +1,90 @@
+#ifdef _XOPEN_SOURCE
+#undef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 700
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "proto.h"
+
+#define FUN_FAILURE -1
+#define FUN_SUCCESS 0
+
+ssize_t proto_read_full(int fd, void *buf, size_t len) {
+  size_t done = 0;
+  while (done < len) {
+    ssize_t r = read(fd, (char *)buf + done, len - done);
+    if (r == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return FUN_FAILURE;
+    }
+    if (r == 0) {
+      break;
+    }
+    done += (size_t)r;
+  }
+  return (ssize_t)done;
+}
+
+int proto_write_full(int fd, const void *buf, size_t len) {
+  size_t done = 0;
+  while (done < len) {
+    ssize_t w = write(fd, (const char *)buf + done, len - done);
+    if (w == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return FUN_FAILURE;
+    }
+    done += (size_t)w;
+  }
+  return FUN_SUCCESS;
+}
+
+int proto_send(int fd, uint32_t type, const void *payload, size_t len) {
+  if (len > REQ_MAX) {
+    errno = EMSGSIZE;
+    return FUN_FAILURE;
+  }
+  // one write so small requests stay atomic in the pipe
+  char *msg = malloc(sizeof(request) + len);
+  if (msg == NULL) {
+    return FUN_FAILURE;
+  }
+  request hdr = {.type = type, .len = (uint32_t)len};
+  memcpy(msg, &hdr, sizeof(hdr));
+  memcpy(msg + sizeof(hdr), payload, len);
+  int r = proto_write_full(fd, msg, sizeof(hdr) + len);
+  free(msg);
+  return r;
+}
+
+int proto_recv(int fd, request *hdr, char **payload) {
+  ssize_t r = proto_read_full(fd, hdr, sizeof(request));
+  if (r <= 0) {
+    return (int)r;
+  }
+  if ((size_t)r < sizeof(request) || hdr->len > REQ_MAX) {
+    errno = EPROTO;
+    return FUN_FAILURE;
+  }
+  char *buf = malloc((size_t)hdr->len + 1);
+  if (buf == NULL) {
+    return FUN_FAILURE;
+  }
+  if (proto_read_full(fd, buf, hdr->len) != (ssize_t)hdr->len) {
+    free(buf);
+    errno = EPROTO;
+    return FUN_FAILURE;
+  }
+  buf[hdr->len] = 0;
+  *payload = buf;
+  return 1;
+}
@@ -0,0 +1,137 @@
+#ifndef PROTO__H
+#define PROTO__H
+
+#include "linker.h"
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+* @define REQ_MAX max length of a request payload
+*/
+#ifndef REQ_MAX
+#define REQ_MAX (1 << 20)
+#endif
+
+/**
+* @enum   req_type
+*         kinds of requests sent by a client through its input pipe
+* @const  REQ_CMD       a command line
+* @const  REQ_FANOUT    a command template run once per input, see fanout
+* @const  REQ_ENV       a delta of the session environment, entries terminated
+*                       by a null char: "NAME=value" or "NAME" to unset it.
+*                       The whole environment is sent once at connection, no
+*                       output nor completion record answers it.
+* @const  REQ_RESUME    a resume, the first request sent through the
+*                       RESUME_PIPE of a session by the client taking it over.
+*                       It is answered by the output held since the previous
+*                       client was lost and the completion record of its
+*                       request, a record with queued_ms -1 if none was lost.
+* @const  REQ_BYE       the end of the session, which is not kept for a
+*                       resume once the client leaves
+*/
+enum req_type {
+  REQ_CMD = 1,
+  REQ_FANOUT = 2,
+  REQ_ENV = 3,
+  REQ_RESUME = 4,
+  REQ_BYE = 5
+};
+
+/**
+* @typedef struct request
+*         header preceding each request in the input pipe
+* @field    type    the req_type of the request
+* @field    len     length of the payload following the header
+*/
+typedef struct request {
+  uint32_t type;
+  uint32_t len;
+} request;
+
+/**
+* @typedef struct fanout
+*         start of a REQ_FANOUT payload, followed by the command template and
+*         the inputs, each terminated by a null char. In the template `{}` is
+*         replaced by the input, the input is appended if there is no `{}`.
+* @field    parallel  max number of inputs run at the same time, 0 for the
+*                     whole execution pool
+* @field    ordered   merge outputs in input order instead of interleaving
+*                     lines tagged by their input
+* @field    ninputs   number of inputs
+*/
+typedef struct fanout {
+  uint32_t parallel;
+  uint32_t ordered;
+  uint32_t ninputs;
+} fanout;
+
+/**
+* @typedef struct resume
+*         REQ_RESUME payload
+* @field    token   secret of the session, see slot_session
+* @field    clt     the client taking the session over, its working directory
+*                   is ignored as the session keeps its own
+*/
+typedef struct resume {
+  uint64_t token;
+  client clt;
+} resume;
+
+/**
+* @enum   stream_id
+*         streams of a command multiplexed in its output
+* @const  STREAM_OUT    the standard output
+* @const  STREAM_ERR    the error output
+*/
+enum stream_id { STREAM_OUT = 1, STREAM_ERR = 2 };
+
+/**
+* @typedef struct frame
+*         header preceding each chunk of output sent to a client, the output
+*         of a request being a sequence of frames ended by the end of file of
+*         the output pipe or the end mark of the output ring
+* @field    stream  the stream_id of the chunk
+* @field    len     length of the chunk following the header
+*/
+typedef struct frame {
+  uint32_t stream;
+  uint32_t len;
+} frame;
+
+/**
+ * @function  proto_read_full
+ * @abstract  read exactly len bytes unless end of file is reached
+ * @param   fd    file descriptor to read
+ * @param   buf   buffer to store the bytes
+ * @param   len   number of bytes to read
+ * @result  ssize_t number of bytes read, -1 on failure
+ */
+extern ssize_t proto_read_full(int fd, void *buf, size_t len);
+/**
+ * @function  proto_write_full
+ * @abstract  write exactly len bytes
+ * @param   fd    file descriptor to write
+ * @param   buf   bytes to write
+ * @param   len   number of bytes to write
+ */
+extern int proto_write_full(int fd, const void *buf, size_t len);
+/**
+ * @function  proto_send
+ * @abstract  send a request: its header then its payload
+ * @param   fd      file descriptor to write
+ * @param   type    the req_type of the request
+ * @param   payload the payload
+ * @param   len     length of the payload
+ */
+extern int proto_send(int fd, uint32_t type, const void *payload, size_t len);
+/**
+ * @function  proto_recv
+ * @abstract  receive a request, the payload is allocated and null terminated
+ * @param   fd      file descriptor to read
+ * @param   hdr     buffer to store the header
+ * @param   payload buffer to store the payload pointer, to be freed
+ * @result  int     1 on success, 0 at end of file, -1 on failure
+ */
+extern int proto_recv(int fd, request *hdr, char **payload);
+
+#endif
@@ -0,0 +1,175 @@
+#ifdef _XOPEN_SOURCE
+#undef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 700
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "config.h"
+#include "runq.h"
+
+/**
+ * @struct    waiter
+ * @abstract  a command waiting for a slot, lives on the waiting thread stack
+ *
+ * @field     expected_ms   expected runtime of the command
+ * @field     since         time the command started waiting
+ * @field     cond          signaled when the slot is granted
+ * @field     granted       has a slot been given to the command?
+ * @field     next          next waiting command
+ */
+struct waiter {
+  double expected_ms;
+  struct timespec since;
+  pthread_cond_t cond;
+  bool granted;
+  struct waiter *next;
+};
+
+struct runq {
+  pthread_mutex_t mutex;
+  size_t free;
+  struct waiter *waiters;
+};
+
+#define FUN_FAILURE -1
+#define FUN_SUCCESS 0
+
+/**
+ * @function  _elapsed_ms
+ * @abstract  milliseconds between from and to
+ */
+static double _elapsed_ms(const struct timespec *from,
+                          const struct timespec *to) {
+  return (double)(to->tv_sec - from->tv_sec) * 1000.0 +
+         (double)(to->tv_nsec - from->tv_nsec) / 1000000.0;
+}
+
+runq *runq_init(size_t slots) {
+  runq *s = malloc(sizeof(runq));
+  if (s == NULL) {
+    perror("malloc");
+    return NULL;
+  }
+  if (pthread_mutex_init(&s->mutex, NULL) != 0) {
+    perror("pthread_mutex_init");
+    free(s);
+    return NULL;
+  }
+  s->free = slots;
+  s->waiters = NULL;
+  return s;
+}
+
+int runq_acquire(runq *s, double expected_ms) {
+  if (s == NULL) {
+    return FUN_FAILURE;
+  }
+
+  pthread_mutex_lock(&s->mutex);
+  if (s->free > 0 && s->waiters == NULL) {
+    s->free--;
+    pthread_mutex_unlock(&s->mutex);
+    return FUN_SUCCESS;
+  }
+
+  struct waiter w;
+  w.expected_ms = expected_ms;
+  w.granted = false;
+  if (clock_gettime(CLOCK_MONOTONIC, &w.since) == -1 ||
+      pthread_cond_init(&w.cond, NULL) != 0) {
+    pthread_mutex_unlock(&s->mutex);
+    return FUN_FAILURE;
+  }
+  w.next = s->waiters;
+  s->waiters = &w;
+
+  while (!w.granted) {
+    pthread_cond_wait(&w.cond, &s->mutex);
+  }
+  pthread_mutex_unlock(&s->mutex);
+  pthread_cond_destroy(&w.cond);
+
+  return FUN_SUCCESS;
+}
+
+bool runq_try_acquire(runq *s) {
+  if (s == NULL) {
+    return false;
+  }
+
+  pthread_mutex_lock(&s->mutex);
+  bool taken = s->free > 0 && s->waiters == NULL;
+  if (taken) {
+    s->free--;
+  }
+  pthread_mutex_unlock(&s->mutex);
+
+  return taken;
+}
+
+int runq_release(runq *s) {
+  if (s == NULL) {
+    return FUN_FAILURE;
+  }
+
+  struct timespec now;
+  if (clock_gettime(CLOCK_MONOTONIC, &now) == -1) {
+    return FUN_FAILURE;
+  }
+
+  pthread_mutex_lock(&s->mutex);
+  // pick the waiter with the shortest aged expected runtime
+  struct waiter **best = NULL;
+  double best_score = 0;
+  for (struct waiter **w = &s->waiters; *w != NULL; w = &(*w)->next) {
+    double score =
+        (*w)->expected_ms - RUNQ_AGING * _elapsed_ms(&(*w)->since, &now);
+    if (best == NULL || score < best_score) {
+      best = w;
+      best_score = score;
+    }
+  }
+
+  if (best == NULL) {
+    s->free++;
+  } else {
+    // hand the slot over directly so it can't be stolen by a newcomer
+    struct waiter *w = *best;
+    *best = w->next;
+    w->granted = true;
+    pthread_cond_signal(&w->cond);
+  }
+  pthread_mutex_unlock(&s->mutex);
+
+  return FUN_SUCCESS;
+}
+
+size_t runq_waiting(runq *s) {
+  if (s == NULL) {
+    return 0;
+  }
+
+  pthread_mutex_lock(&s->mutex);
+  size_t n = 0;
+  for (struct waiter *w = s->waiters; w != NULL; w = w->next) {
+    n++;
+  }
+  pthread_mutex_unlock(&s->mutex);
+
+  return n;
+}
+
+void runq_dispose(runq **runq_p) {
+  runq *s = *runq_p;
+  if (s == NULL) {
+    return;
+  }
+  pthread_mutex_destroy(&s->mutex);
+  free(s);
+  *runq_p = NULL;
+}
@@ -0,0 +1,59 @@
+#ifndef RUNQ__H
+#define RUNQ__H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+* @typedef runq
+*         limits the number of commands executed at the same time. When every
+*         slot is taken, waiting commands are granted the next free slot
+*         shortest expected runtime first, the expected runtime of a command
+*         decreasing by RUNQ_AGING for each ms it waited so long commands
+*         are not starved.
+* @field    mutex     protects the structure
+* @field    free      number of free slots
+* @field    waiters   list of the commands waiting for a slot
+*/
+typedef struct runq runq;
+
+/**
+ * @function  runq_init
+ * @abstract  creates a run queue
+ * @param   slots   number of commands executed at the same time
+ */
+extern runq *runq_init(size_t slots);
+/**
+ * @function  runq_acquire
+ * @abstract  wait for a free slot
+ * @param   s             the run queue to use
+ * @param   expected_ms   expected runtime of the command
+ */
+extern int runq_acquire(runq *s, double expected_ms);
+/**
+ * @function  runq_try_acquire
+ * @abstract  take a free slot only if one is available right away
+ * @param   s   the run queue to use
+ * @result  bool  was a slot taken?
+ */
+extern bool runq_try_acquire(runq *s);
+/**
+ * @function  runq_release
+ * @abstract  give back a slot, granting it to the best waiting command
+ * @param   s   the run queue to use
+ */
+extern int runq_release(runq *s);
+/**
+ * @function  runq_waiting
+ * @abstract  number of commands waiting for a slot
+ * @param   s   the run queue to use
+ */
+extern size_t runq_waiting(runq *s);
+/**
+ * @function  runq_dispose
+ * @abstract  free memory and destroy a run queue
+ * @param   runq_p   a pointer to the run queue's pointer
+ */
+extern void runq_dispose(runq **runq_p);
+
+#endif
@@ -0,0 +1,203 @@
+#ifdef _XOPEN_SOURCE
+#undef _XOPEN_SOURCE
+#endif
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "spool.h"
+
+/**
+ * @define  SPOOL_FILE_CHUNK  growth of the temporary file
+ */
+#define SPOOL_FILE_CHUNK (4 << 20)
+
+struct spool {
+  char *mem;
+  size_t mem_cap;
+  size_t mem_rd;
+  size_t mem_wr;
+  size_t budget;
+  int fd;
+  char *map;
+  size_t map_len;
+  size_t file_rd;
+  size_t file_wr;
+};
+
+#define FUN_FAILURE -1
+#define FUN_SUCCESS 0
+
+spool *spool_init(size_t budget) {
+  spool *sp = calloc(1, sizeof(spool));
+  if (sp == NULL) {
+    return NULL;
+  }
+  sp->budget = budget;
+  sp->fd = -1;
+  return sp;
+}
+
+/**
+ * @function  _mem_write
+ * @abstract  append to the memory buffer what fits in the budget
+ * @result  size_t  number of bytes appended
+ */
+static size_t _mem_write(spool *sp, const char *buf, size_t len) {
+  if (sp->mem_rd == sp->mem_wr) {
+    sp->mem_rd = sp->mem_wr = 0;
+  }
+  if (sp->mem_cap - sp->mem_wr < len && sp->mem_rd > 0) {
+    memmove(sp->mem, sp->mem + sp->mem_rd, sp->mem_wr - sp->mem_rd);
+    sp->mem_wr -= sp->mem_rd;
+    sp->mem_rd = 0;
+  }
+  if (sp->mem_cap - sp->mem_wr < len && sp->mem_cap < sp->budget) {
+    size_t cap = sp->mem_cap > 0 ? sp->mem_cap : 4096;
+    while (cap - sp->mem_wr < len && cap < sp->budget) {
+      cap *= 2;
+    }
+    cap = cap < sp->budget ? cap : sp->budget;
+    char *mem = realloc(sp->mem, cap);
+    if (mem != NULL) {
+      sp->mem = mem;
+      sp->mem_cap = cap;
+    }
+  }
+  size_t n = sp->mem_cap - sp->mem_wr < len ? sp->mem_cap - sp->mem_wr : len;
+  memcpy(sp->mem + sp->mem_wr, buf, n);
+  sp->mem_wr += n;
+  return n;
+}
+
+/**
+ * @function  _file_write
+ * @abstract  append to the temporary file, creating and growing it
+ */
+static int _file_write(spool *sp, const char *buf, size_t len) {
+  if (sp->fd == -1) {
+    char path[] = SPOOL_DIR "/cmds_spool_XXXXXX";
+    if ((sp->fd = mkostemp(path, O_CLOEXEC)) == -1) {
+      return FUN_FAILURE;
+    }
+    unlink(path);
+  }
+  if (sp->file_wr + len > sp->map_len) {
+    size_t map_len = sp->map_len;
+    while (sp->file_wr + len > map_len) {
+      map_len += SPOOL_FILE_CHUNK;
+    }
+    if (ftruncate(sp->fd, (off_t)map_len) == -1) {
+      return FUN_FAILURE;
+    }
+    char *map = sp->map == NULL
+                    ? mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+                           sp->fd, 0)
+                    : mremap(sp->map, sp->map_len, map_len, MREMAP_MAYMOVE);
+    if (map == MAP_FAILED) {
+      return FUN_FAILURE;
+    }
+    sp->map = map;
+    sp->map_len = map_len;
+  }
+  memcpy(sp->map + sp->file_wr, buf, len);
+  sp->file_wr += len;
+  return FUN_SUCCESS;
+}
+
+int spool_write(spool *sp, const void *buf, size_t len) {
+  const char *b = buf;
+  // memory holds the oldest bytes, never write there while the file has some
+  if (sp->file_rd == sp->file_wr) {
+    size_t n = _mem_write(sp, b, len);
+    b += n;
+    len -= n;
+  }
+  if (len == 0) {
+    return FUN_SUCCESS;
+  }
+  return _file_write(sp, b, len);
+}
+
+size_t spool_pending(const spool *sp) {
+  return (sp->mem_wr - sp->mem_rd) + (sp->file_wr - sp->file_rd);
+}
+
+/**
+ * @function  _file_release
+ * @abstract  give the disk space of a drained file back
+ */
+static void _file_release(spool *sp) {
+  if (sp->map != NULL) {
+    munmap(sp->map, sp->map_len);
+  }
+  if (ftruncate(sp->fd, 0) == -1) {
+    perror("ftruncate");
+  }
+  sp->map = NULL;
+  sp->map_len = 0;
+  sp->file_rd = sp->file_wr = 0;
+}
+
+size_t spool_peek(spool *sp, const char **data) {
+  if (sp->mem_rd < sp->mem_wr) {
+    *data = sp->mem + sp->mem_rd;
+    return sp->mem_wr - sp->mem_rd;
+  }
+  *data = sp->map + sp->file_rd;
+  return sp->file_wr - sp->file_rd;
+}
+
+void spool_consume(spool *sp, size_t len) {
+  if (sp->mem_rd < sp->mem_wr) {
+    sp->mem_rd += len;
+  } else if ((sp->file_rd += len) == sp->file_wr) {
+    _file_release(sp);
+  }
+}
+
+ssize_t spool_flush(spool *sp, int fd) {
+  size_t done = 0;
+  const char *b;
+  size_t len;
+  while ((len = spool_peek(sp, &b)) > 0) {
+    ssize_t w = write(fd, b, len);
+    if (w == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN) {
+        break;
+      }
+      return FUN_FAILURE;
+    }
+    done += (size_t)w;
+    spool_consume(sp, (size_t)w);
+  }
+  return (ssize_t)done;
+}
+
+void spool_dispose(spool **spool_p) {
+  spool *sp = *spool_p;
+  if (sp == NULL) {
+    return;
+  }
+  if (sp->map != NULL) {
+    munmap(sp->map, sp->map_len);
+  }
+  if (sp->fd != -1) {
+    close(sp->fd);
+  }
+  free(sp->mem);
+  free(sp);
+  *spool_p = NULL;
+}
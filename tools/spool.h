@@ -0,0 +1,77 @@
+#ifndef SPOOL__H
+#define SPOOL__H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+* @typedef spool
+*         first in first out byte buffer holding the output of a command until
+*         its client reads it. Bytes are kept in memory up to a budget, then
+*         appended to an unlinked temporary file mapped in memory. Memory is
+*         only used again once the file is drained so the order is kept.
+* @field    mem       memory buffer
+* @field    mem_cap   allocated size of mem
+* @field    mem_rd    offset of the first unread byte of mem
+* @field    mem_wr    offset of the first free byte of mem
+* @field    budget    max size of mem
+* @field    fd        the temporary file, -1 until needed
+* @field    map       mapping of the temporary file
+* @field    map_len   size of the file and of its mapping
+* @field    file_rd   offset of the first unread byte of the file
+* @field    file_wr   offset of the first free byte of the file
+*/
+typedef struct spool spool;
+
+/**
+ * @function  spool_init
+ * @abstract  creates an empty spool
+ * @param   budget  bytes kept in memory before using a file
+ */
+extern spool *spool_init(size_t budget);
+/**
+ * @function  spool_write
+ * @abstract  append bytes to the spool
+ * @param   sp    the spool to use
+ * @param   buf   the bytes
+ * @param   len   number of bytes
+ */
+extern int spool_write(spool *sp, const void *buf, size_t len);
+/**
+ * @function  spool_pending
+ * @abstract  number of bytes in the spool
+ * @param   sp    the spool to use
+ */
+extern size_t spool_pending(const spool *sp);
+/**
+ * @function  spool_peek
+ * @abstract  get the oldest spooled bytes in place
+ * @param   sp    the spool to use
+ * @param   data  buffer to store the address of the bytes
+ * @result  size_t  number of contiguous bytes available
+ */
+extern size_t spool_peek(spool *sp, const char **data);
+/**
+ * @function  spool_consume
+ * @abstract  remove bytes returned by spool_peek
+ * @param   sp    the spool to use
+ * @param   len   number of bytes done with
+ */
+extern void spool_consume(spool *sp, size_t len);
+/**
+ * @function  spool_flush
+ * @abstract  write as many spooled bytes as fd accepts, stopping without
+ *            error when a non blocking fd is full
+ * @param   sp    the spool to use
+ * @param   fd    file descriptor to write
+ * @result  ssize_t number of bytes written, -1 on failure
+ */
+extern ssize_t spool_flush(spool *sp, int fd);
+/**
+ * @function  spool_dispose
+ * @abstract  free memory, unmap and close the temporary file
+ * @param   spool_p   a pointer to the spool's pointer
+ */
+extern void spool_dispose(spool **spool_p);
+
+#endif
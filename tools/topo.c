@@ -0,0 +1,165 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "topo.h"
+
+#define FUN_FAILURE -1
+#define FUN_SUCCESS 0
+
+/**
+ * @define  TOPO_MPOL_BIND  MPOL_BIND of set_mempolicy, numaif.h being part of
+ *                          libnuma
+ */
+#define TOPO_MPOL_BIND 2
+
+// CPUs runners and commands are placed on, see topo_place_init
+static unsigned place_cpus[CPU_SETSIZE];
+static unsigned place_n;
+
+/**
+ * @function  _cpulist
+ * @abstract  read a list of CPUs as "0-3,8,10-11" into a set
+ */
+static int _cpulist(const char *path, cpu_set_t *set) {
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+    return FUN_FAILURE;
+  }
+  char buf[4096];
+  char *line = fgets(buf, sizeof(buf), f);
+  fclose(f);
+  if (line == NULL) {
+    errno = EINVAL;
+    return FUN_FAILURE;
+  }
+  CPU_ZERO(set);
+  char *p = line;
+  while (*p != 0 && *p != '\n') {
+    char *end;
+    unsigned long lo = strtoul(p, &end, 10);
+    unsigned long hi = lo;
+    if (end == p) {
+      errno = EINVAL;
+      return FUN_FAILURE;
+    }
+    if (*end == '-') {
+      p = end + 1;
+      hi = strtoul(p, &end, 10);
+    }
+    for (unsigned long cpu = lo; cpu <= hi && cpu < CPU_SETSIZE; cpu++) {
+      CPU_SET(cpu, set);
+    }
+    p = *end == ',' ? end + 1 : end;
+  }
+  return CPU_COUNT(set) > 0 ? FUN_SUCCESS : FUN_FAILURE;
+}
+
+unsigned topo_nodes(void) {
+  cpu_set_t nodes;
+  if (_cpulist(TOPO_NODE_DIR "/online", &nodes) == FUN_FAILURE) {
+    return 1;
+  }
+  // nodes may have holes, the last one tells how many to cycle through
+  unsigned n = 0;
+  for (unsigned i = 0; i < CPU_SETSIZE; i++) {
+    if (CPU_ISSET(i, &nodes)) {
+      n = i + 1;
+    }
+  }
+  return n;
+}
+
+int topo_bind_node(unsigned node) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), TOPO_NODE_DIR "/node%u/cpulist", node);
+  cpu_set_t set;
+  if (_cpulist(path, &set) == FUN_FAILURE) {
+    perror("cpulist");
+    return FUN_FAILURE;
+  }
+  if (sched_setaffinity(0, sizeof(set), &set) == -1) {
+    perror("sched_setaffinity");
+    return FUN_FAILURE;
+  }
+  return FUN_SUCCESS;
+}
+
+unsigned topo_place_init(void) {
+  cpu_set_t set;
+  place_n = 0;
+  if (sched_getaffinity(0, sizeof(set), &set) == -1) {
+    perror("sched_getaffinity");
+    return 0;
+  }
+  for (unsigned cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (CPU_ISSET(cpu, &set)) {
+      place_cpus[place_n++] = cpu;
+    }
+  }
+  return place_n;
+}
+
+int topo_pin(unsigned index) {
+  if (place_n == 0) {
+    errno = EINVAL;
+    return FUN_FAILURE;
+  }
+  unsigned cpu = place_cpus[index % place_n];
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  if (sched_setaffinity(0, sizeof(set), &set) == -1) {
+    return FUN_FAILURE;
+  }
+  return (int)cpu;
+}
+
+int topo_bind_memory(void) {
+  unsigned cpu, node;
+  if (getcpu(&cpu, &node) == -1) {
+    return FUN_FAILURE;
+  }
+  // a node mask is a bitmap of unsigned long, as a cpu_set_t
+  cpu_set_t mask;
+  CPU_ZERO(&mask);
+  CPU_SET(node, &mask);
+  if (syscall(SYS_set_mempolicy, TOPO_MPOL_BIND, &mask, CPU_SETSIZE) == -1) {
+    return FUN_FAILURE;
+  }
+  return (int)node;
+}
+
+int topo_last_cpu(pid_t pid) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+    return FUN_FAILURE;
+  }
+  char buf[1024];
+  size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+  fclose(f);
+  buf[n] = 0;
+  // the command name may hold spaces, fields are counted after its ')'
+  char *p = strrchr(buf, ')');
+  if (p == NULL) {
+    return FUN_FAILURE;
+  }
+  // processor is field 39, the name being field 2
+  int field = 2;
+  while (field < 39 && (p = strchr(p + 1, ' ')) != NULL) {
+    field++;
+  }
+  if (p == NULL) {
+    return FUN_FAILURE;
+  }
+  return atoi(p + 1);
+}
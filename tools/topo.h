@@ -0,0 +1,59 @@
+#ifndef TOPO__H
+#define TOPO__H
+
+#include <sys/types.h>
+
+/**
+* @define TOPO_NODE_DIR  directory describing the NUMA nodes of the host
+*/
+#ifndef TOPO_NODE_DIR
+#define TOPO_NODE_DIR "/sys/devices/system/node"
+#endif
+
+/**
+ * @function  topo_nodes
+ * @abstract  number of NUMA nodes of the host, nodes being numbered from 0
+ * @result  unsigned  the number of nodes, 1 if the host has no NUMA
+ */
+extern unsigned topo_nodes(void);
+/**
+ * @function  topo_bind_node
+ * @abstract  restrict the calling thread, and the threads and processes it
+ *            creates afterwards, to the CPUs of a NUMA node
+ * @param   node    the node
+ * @result  int     0 on success, -1 on failure
+ */
+extern int topo_bind_node(unsigned node);
+/**
+ * @function  topo_place_init
+ * @abstract  take the CPUs the process may run on, once bound to its node,
+ *            as the set runners and commands are placed on
+ * @result  unsigned  the number of CPUs of the set
+ */
+extern unsigned topo_place_init(void);
+/**
+ * @function  topo_pin
+ * @abstract  restrict the calling thread, or process after a fork, to one
+ *            CPU of the set taken by topo_place_init. Only makes system calls
+ *            so that a child can use it before exec.
+ * @param   index   index of the CPU in the set, modulo its size
+ * @result  int     the CPU, -1 on failure
+ */
+extern int topo_pin(unsigned index);
+/**
+ * @function  topo_bind_memory
+ * @abstract  allocate the memory of the calling thread, and of the processes
+ *            it forks, on the NUMA node of the CPU it runs on
+ * @result  int     the node, -1 on failure
+ */
+extern int topo_bind_memory(void);
+/**
+ * @function  topo_last_cpu
+ * @abstract  CPU a process ran on last, which can be read until it is
+ *            reaped
+ * @param   pid     the process
+ * @result  int     the CPU, -1 on failure
+ */
+extern int topo_last_cpu(pid_t pid);
+
+#endif